@@ -21,14 +21,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include "json.h"
 
 #ifdef _MSC_VER
 #define inline _inline
+#if _MSC_VER < 1900
+#define snprintf _snprintf
+#endif
 #endif
 
 #ifdef TRACING_ENABLE
-#include <stdio.h>
 #define TRACING(fmt, ...)	fprintf(stderr, "tracing: " fmt, ##__VA_ARGS__)
 #else
 #define TRACING(fmt, ...)	((void) 0)
@@ -322,6 +325,99 @@ static const uint8_t utf8_continuation_table[256] =
 };
 #undef __
 
+/* word at a time helpers: each returns a word with the high bit of a byte set
+ * for at least one byte matching if any byte match, and 0 if none match. */
+#define ONES_64		0x0101010101010101ULL
+#define HIGHS_64	0x8080808080808080ULL
+#define has_zero_byte(w)	(((w) - ONES_64) & ~(w) & HIGHS_64)
+#define has_byte(w, c)		has_zero_byte((w) ^ (ONES_64 * (c)))
+#define has_less_than(w, c)	(((w) - ONES_64 * (c)) & ~(w) & HIGHS_64)
+
+static inline uint64_t load_word(const unsigned char *s)
+{
+	uint64_t w;
+	memcpy(&w, s, sizeof(w));
+	return w;
+}
+
+/* exact version of has_zero_byte: the high bit is set only for zero bytes */
+#define zero_bytes(w)		(~((((w) & ~HIGHS_64) + ~HIGHS_64) | (w) | ~HIGHS_64))
+#define equal_bytes(w, c)	zero_bytes((w) ^ (ONES_64 * (c)))
+
+/* a word is plain text if it only contains ascii characters that are
+ * not control characters nor one of the two stop characters */
+static inline uint64_t word_not_plain(uint64_t w, unsigned char stop1, unsigned char stop2)
+{
+	return (w | has_less_than(w, 0x20) | has_byte(w, stop1) | has_byte(w, stop2)) & HIGHS_64;
+}
+
+/* return the length of the run of plain text starting at s: ascii characters
+ * that don't need any state machine processing and complete utf8 multibyte
+ * sequences. pure ascii is checked by blocks of 32 then 8 bytes skipping the
+ * utf8 tables completely. the run stops before the stop characters, before
+ * control characters (except tab, cr and nl in comments) and before a utf8
+ * sequence that is invalid or cut by the end of the input, so that the
+ * per-character path handles them and reports errors at the same offset. */
+static inline uint32_t scan_text_run(const unsigned char *s, uint32_t length,
+                                     unsigned char stop1, unsigned char stop2, int comment)
+{
+	uint32_t i = 0;
+
+	while (i < length) {
+		uint32_t end;
+
+		while (i + 32 <= length
+		       && !(word_not_plain(load_word(s + i), stop1, stop2)
+		          | word_not_plain(load_word(s + i + 8), stop1, stop2)
+		          | word_not_plain(load_word(s + i + 16), stop1, stop2)
+		          | word_not_plain(load_word(s + i + 24), stop1, stop2)))
+			i += 32;
+		while (i + 8 <= length && !word_not_plain(load_word(s + i), stop1, stop2))
+			i += 8;
+
+		/* one character at a time until the end of the word that failed */
+		end = (i + 8 < length) ? i + 8 : length;
+		while (i < end) {
+			unsigned char c = s[i];
+			uint32_t j, n;
+
+			if (c < 0x80) {
+				if (c == stop1 || c == stop2)
+					return i;
+				if (c < 0x20 && (!comment || character_class[c] == C_ERROR))
+					return i;
+				i++;
+				continue;
+			}
+			n = utf8_header_table[c];
+			if (n == 0xff || i + n >= length)
+				return i;
+			for (j = 1; j <= n; j++)
+				if (utf8_continuation_table[s[i + j]] != 0)
+					return i;
+			i += n + 1;
+		}
+	}
+	return i;
+}
+
+/* return the length of the run of whitespace (space, tab, cr, nl) starting at s */
+static inline uint32_t scan_white_run(const unsigned char *s, uint32_t length)
+{
+	uint32_t i = 0;
+
+	while (i + 8 <= length) {
+		uint64_t w = load_word(s + i);
+		if ((equal_bytes(w, ' ') | equal_bytes(w, '\t')
+		   | equal_bytes(w, '\n') | equal_bytes(w, '\r')) != HIGHS_64)
+			break;
+		i += 8;
+	}
+	while (i < length && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r'))
+		i++;
+	return i;
+}
+
 #define MODE_ARRAY 0
 #define MODE_OBJECT 1
 
@@ -335,8 +431,175 @@ static inline void *memory_calloc(void *(*calloc_fct)(size_t, size_t), size_t nm
 	return (calloc_fct) ? calloc_fct(nmemb, size) : calloc(nmemb, size);
 }
 
-#define parser_calloc(parser, n, s) memory_calloc(parser->config.user_calloc, n, s)
-#define parser_realloc(parser, n, s) memory_realloc(parser->config.user_realloc, n, s)
+/* the allocator with a context if there's one, otherwise the user functions
+ * or the standard ones */
+static inline void *allocator_realloc(const json_allocator *allocator,
+                                      void *(*realloc_fct)(void *, size_t), void *ptr, size_t size)
+{
+	if (allocator)
+		return allocator->realloc(allocator->ctx, ptr, size);
+	return memory_realloc(realloc_fct, ptr, size);
+}
+
+static inline void *allocator_calloc(const json_allocator *allocator,
+                                     void *(*calloc_fct)(size_t, size_t), size_t nmemb, size_t size)
+{
+	if (allocator)
+		return allocator->calloc(allocator->ctx, nmemb, size);
+	return memory_calloc(calloc_fct, nmemb, size);
+}
+
+static inline void allocator_free(const json_allocator *allocator, void *ptr)
+{
+	if (!ptr)
+		return;
+	if (allocator)
+		allocator->free(allocator->ctx, ptr);
+	else
+		free(ptr);
+}
+
+#define parser_calloc(parser, n, s) \
+	allocator_calloc(parser->config.allocator, parser->config.user_calloc, n, s)
+#define parser_realloc(parser, n, s) \
+	allocator_realloc(parser->config.allocator, parser->config.user_realloc, n, s)
+#define parser_free(parser, p) allocator_free(parser->config.allocator, p)
+#define dom_calloc(dom, n, s) allocator_calloc(dom->allocator, dom->user_calloc, n, s)
+#define dom_realloc(dom, n, s) allocator_realloc(dom->allocator, dom->user_realloc, n, s)
+#define dom_free(dom, p) allocator_free(dom->allocator, p)
+/* the recorder, the encoder, the snapshot writer, the index and the objects use
+ * the allocator given to their init, or the standard functions */
+#define owner_calloc(o, n, s) allocator_calloc((o)->allocator, NULL, n, s)
+#define owner_realloc(o, p, s) allocator_realloc((o)->allocator, NULL, p, s)
+#define owner_free(o, p) allocator_free((o)->allocator, p)
+
+/* keep a JSON_PARTIAL piece of a value, zero terminated, until its last event */
+static int partial_keep(struct json_partial *p, const json_allocator *allocator,
+                        void *(*realloc_fct)(void *, size_t), const char *data, uint32_t length)
+{
+	if (p->length + length + 1 > p->size) {
+		uint32_t newsize = (p->size) ? p->size : 256;
+		char *ptr;
+
+		while (p->length + length + 1 > newsize)
+			newsize *= 2;
+		ptr = allocator_realloc(allocator, realloc_fct, p->data, newsize);
+		if (!ptr)
+			return JSON_ERROR_NO_MEMORY;
+		p->data = ptr;
+		p->size = newsize;
+	}
+	memcpy(p->data + p->length, data, length);
+	p->length += length;
+	p->data[p->length] = '\0';
+	return 0;
+}
+
+/* join the kept pieces of a value with its last event: data then points to the
+ * whole value, valid until the next piece is kept */
+static int partial_join(struct json_partial *p, const json_allocator *allocator,
+                        void *(*realloc_fct)(void *, size_t), const char **data, uint32_t *length)
+{
+	int ret;
+
+	if (p->length == 0)
+		return 0;
+	ret = partial_keep(p, allocator, realloc_fct, *data, *length);
+	if (ret)
+		return ret;
+	*data = p->data;
+	*length = p->length;
+	p->length = 0;
+	return 0;
+}
+
+/* atomic operations on the budget count and the pool slots, so that parsers
+ * in different threads can share them */
+#if defined(__GNUC__)
+#define budget_load(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define budget_cas(p, old, new) __atomic_compare_exchange_n(p, &(old), new, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#define budget_sub(p, n) __atomic_fetch_sub(p, n, __ATOMIC_RELAXED)
+#define slot_exchange(p, v) __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL)
+#define slot_cas(p, old, new) __atomic_compare_exchange_n(p, &(old), new, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define budget_load(p) (*(volatile uint64_t *) (p))
+#define budget_cas(p, old, new) \
+	((uint64_t) _InterlockedCompareExchange64((volatile __int64 *) (p), new, old) == (old))
+#define budget_sub(p, n) _InterlockedExchangeAdd64((volatile __int64 *) (p), -(__int64) (n))
+#define slot_exchange(p, v) _InterlockedExchangePointer((void * volatile *) (p), v)
+#define slot_cas(p, old, new) \
+	(_InterlockedCompareExchangePointer((void * volatile *) (p), new, old) == (old))
+#else
+#define budget_load(p) (*(p))
+#define budget_cas(p, old, new) (*(p) = (new), 1)
+#define budget_sub(p, n) (*(p) -= (n))
+#define slot_exchange(p, v) slot_exchange_plain((void **) (p), v)
+#define slot_cas(p, old, new) (*(p) == (old) && (*(p) = (new), 1))
+static inline void *slot_exchange_plain(void **p, void *v)
+{
+	void *old = *p;
+	*p = v;
+	return old;
+}
+#endif
+
+/* take size more bytes of the budget for the parse buffer */
+static int budget_take(json_parser *parser, uint32_t size)
+{
+	json_budget *budget = parser->config.budget;
+	uint64_t used;
+
+	if (!budget)
+		return 0;
+	do {
+		used = budget_load(&budget->used);
+		if (used + size > budget->limit)
+			return JSON_ERROR_BUDGET;
+	} while (!budget_cas(&budget->used, used, used + size));
+	parser->budget_taken += size;
+	return 0;
+}
+
+static void budget_give(json_parser *parser, uint32_t size)
+{
+	if (!parser->config.budget || size == 0)
+		return;
+	budget_sub(&parser->config.budget->used, size);
+	parser->budget_taken -= size;
+}
+
+#define CHK(f) do { ret = f; if (ret) return ret; } while(0)
+
+/* FNV-1a hash of keys and strings, continuing from h */
+static uint32_t hash_update(uint32_t h, const char *data, uint64_t length)
+{
+	uint64_t i;
+
+	for (i = 0; i < length; i++)
+		h = (h ^ (unsigned char) data[i]) * 16777619u;
+	return h;
+}
+
+static uint32_t string_hash(const char *data, uint32_t length)
+{
+	return hash_update(2166136261u, data, length);
+}
+
+/* give data to a printer callback, in pieces of at most 1GB */
+static int write_all(json_printer_callback callback, void *userdata, const void *data, uint64_t length)
+{
+	const char *p = data;
+	int ret;
+
+	while (length > 0) {
+		uint32_t n = (length > 0x40000000) ? 0x40000000 : (uint32_t) length;
+		CHK((*callback)(userdata, p, n));
+		p += n;
+		length -= n;
+	}
+	return 0;
+}
 
 static int state_grow(json_parser *parser)
 {
@@ -375,27 +638,158 @@ static int state_pop(json_parser *parser, int mode)
 	return 0;
 }
 
+/* a callback returning JSON_SUSPEND stops the parser after the current character */
+static inline int callback_return(json_parser *parser, int ret)
+{
+	if (ret != JSON_SUSPEND)
+		return ret;
+	parser->suspended = 1;
+	return 0;
+}
+
+/* in batch mode the parse buffer is the free part of the batch data area,
+ * capped to max_data like a regular buffer */
+static uint32_t batch_room(json_parser *parser)
+{
+	uint32_t room = parser->batch_data_size - (uint32_t) (parser->buffer - parser->batch_data);
+	uint32_t max = parser->config.max_data;
+
+	return (max > 0 && room > max) ? max : room;
+}
+
+/* deliver the batched events, and move the value being parsed, if any,
+ * to the start of the data area */
+static int batch_flush(json_parser *parser)
+{
+	uint32_t count = parser->batch_events_count;
+	int ret;
+
+	parser->batch_events_count = 0;
+	ret = (*parser->batch_callback)(parser->batch_userdata, parser->batch_events,
+	                                count, parser->batch_data);
+	memmove(parser->batch_data, parser->buffer, parser->buffer_offset);
+	parser->buffer = parser->batch_data;
+	parser->buffer_size = batch_room(parser);
+	return callback_return(parser, ret);
+}
+
+/* the value being parsed doesn't fit in what's left of the data area:
+ * deliver the batch to make room, or grow the area when the parser owns it */
+static int batch_grow(json_parser *parser)
+{
+	uint32_t max = parser->config.max_data;
+	uint32_t newsize;
+	char *ptr;
+
+	if (max > 0 && parser->buffer_size == max)
+		return JSON_ERROR_DATA_LIMIT;
+	if (parser->buffer != parser->batch_data)
+		return batch_flush(parser);
+	if (!parser->batch_data_owned)
+		return JSON_ERROR_DATA_LIMIT;
+
+	newsize = parser->batch_data_size * 2;
+	if (max > 0 && newsize > max)
+		newsize = max;
+	if (budget_take(parser, newsize - parser->batch_data_size))
+		return JSON_ERROR_BUDGET;
+	ptr = parser_realloc(parser, parser->batch_data, newsize * sizeof(char));
+	if (!ptr) {
+		budget_give(parser, newsize - parser->batch_data_size);
+		return JSON_ERROR_NO_MEMORY;
+	}
+	parser->batch_data = parser->buffer = ptr;
+	parser->batch_data_size = newsize;
+	parser->buffer_size = batch_room(parser);
+	return 0;
+}
+
+static int batch_structure(json_parser *parser, int type)
+{
+	json_event *event = &parser->batch_events[parser->batch_events_count++];
+
+	event->type = type;
+	event->offset = (uint32_t) (parser->buffer - parser->batch_data);
+	event->length = 0;
+	event->key_id = JSON_KEY_UNKNOWN;
+	if (parser->batch_events_count == parser->batch_events_size)
+		return batch_flush(parser);
+	return 0;
+}
+
+/* the value is already in place in the data area: terminate it and
+ * start the next value after it */
+static int batch_value(json_parser *parser, int type)
+{
+	json_event *event = &parser->batch_events[parser->batch_events_count++];
+	uint32_t length = parser->buffer_offset;
+
+	parser->buffer[length] = '\0';
+	event->type = type;
+	event->offset = (uint32_t) (parser->buffer - parser->batch_data);
+	event->length = length;
+	event->key_id = (type == JSON_KEY) ? parser->key_id : JSON_KEY_UNKNOWN;
+
+	parser->buffer += length + 1;
+	parser->buffer_offset = 0;
+	parser->buffer_size = batch_room(parser);
+	if (parser->batch_events_count == parser->batch_events_size || parser->buffer_size == 0)
+		return batch_flush(parser);
+	return 0;
+}
+
 static int buffer_grow(json_parser *parser)
 {
 	uint32_t newsize;
 	void *ptr;
 	uint32_t max = parser->config.max_data;
 
+	if (parser->batch_events)
+		return batch_grow(parser);
 	if (max > 0 && parser->buffer_size == max)
 		return JSON_ERROR_DATA_LIMIT;
 	newsize = parser->buffer_size * 2;
 	if (max > 0 && newsize > max)
 		newsize = max;
 
+	if (budget_take(parser, newsize - parser->buffer_size))
+		return JSON_ERROR_BUDGET;
 	ptr = parser_realloc(parser, parser->buffer, newsize * sizeof(char));
-	if (!ptr)
+	if (!ptr) {
+		budget_give(parser, newsize - parser->buffer_size);
 		return JSON_ERROR_NO_MEMORY;
+	}
 	parser->buffer = ptr;
 	parser->buffer_size = newsize;
 	return 0;
 }
 
-static int buffer_push(json_parser *parser, unsigned char c)
+static int do_partial(json_parser *parser);
+
+/* the value in the buffer can be cut before c: in string content out of an
+ * utf8 sequence or an \\u escape, on a base64 quantum, or in a number not
+ * captured in an array. keys are only cut once longer than any key the parser
+ * looks up */
+static int partial_split(json_parser *parser, unsigned char c)
+{
+	switch (parser->state) {
+	case STATE__S: case STATE_E0: case STATE_U1:
+		if ((c & 0xc0) == 0x80)
+			return 0;
+		if (parser->expecting_key)
+			return parser->buffer_offset >= parser->partial_key_limit;
+		if (parser->base64_value)
+			return (parser->buffer_offset & 3) == 0;
+		return 1;
+	case STATE_M0: case STATE_Z0: case STATE_I0: case STATE_R1: case STATE_R2:
+	case STATE_X1: case STATE_X2: case STATE_X3:
+		return parser->array_depth == 0;
+	default:
+		return 0;
+	}
+}
+
+static int buffer_append(json_parser *parser, unsigned char c)
 {
 	int ret;
 
@@ -408,149 +802,832 @@ static int buffer_push(json_parser *parser, unsigned char c)
 	return 0;
 }
 
-static int do_callback_withbuf(json_parser *parser, int type)
+static int buffer_push(json_parser *parser, unsigned char c)
 {
-	if (!parser->callback)
+	int ret;
+
+	if (parser->buffer_offset >= parser->partial_limit && partial_split(parser, c)) {
+		ret = do_partial(parser);
+		if (ret)
+			return ret;
+	}
+	return buffer_append(parser, c);
+}
+
+static uint32_t buffer_reserve_grow(json_parser *parser, uint32_t length)
+{
+	/* delivering a batch is left to the per-character path, where the
+	 * return of the batch callback can be reported */
+	if (parser->batch_events)
+		return parser->buffer_size - parser->buffer_offset - 1;
+	while (parser->buffer_offset + length >= parser->buffer_size) {
+		if (buffer_grow(parser))
+			return parser->buffer_size - parser->buffer_offset - 1;
+	}
+	return length;
+}
+
+/* make room for length more characters in the buffer, growing it like
+ * buffer_push would. if the buffer cannot grow enough, return the number
+ * of characters that still fit, so that the per-character path can report
+ * the error on the exact character. */
+static inline uint32_t buffer_reserve(json_parser *parser, uint32_t length)
+{
+	/* a piece of a partial value is cut on the per-character path */
+	if (parser->buffer_offset >= parser->partial_limit)
 		return 0;
-	parser->buffer[parser->buffer_offset] = '\0';
-	return (*parser->callback)(parser->userdata, type, parser->buffer, parser->buffer_offset);
+	if (length > parser->partial_limit - parser->buffer_offset)
+		length = parser->partial_limit - parser->buffer_offset;
+	if (parser->buffer_offset + length < parser->buffer_size)
+		return length;
+	return buffer_reserve_grow(parser, length);
 }
 
-static int do_callback(json_parser *parser, int type)
+static int emit_withbuf(json_parser *parser, int type)
 {
+	if (parser->batch_events)
+		return batch_value(parser, type);
 	if (!parser->callback)
 		return 0;
-	return (*parser->callback)(parser->userdata, type, NULL, 0);
+	parser->buffer[parser->buffer_offset] = '\0';
+	return callback_return(parser, (*parser->callback)(parser->userdata, type,
+	                                                   parser->buffer, parser->buffer_offset));
 }
 
-static int do_buffer(json_parser *parser)
+static int emit(json_parser *parser, int type)
 {
-	int ret = 0;
-
-	switch (parser->type) {
-	case JSON_KEY: case JSON_STRING:
-	case JSON_FLOAT: case JSON_INT:
-	case JSON_NULL: case JSON_TRUE: case JSON_FALSE:
-		ret = do_callback_withbuf(parser, parser->type);
-		if (ret)
-			return ret;
-		break;
-	default:
-		break;
+	if (parser->batch_events)
+		return batch_structure(parser, type);
+	if (!parser->callback)
+		return 0;
+	/* the character ending the value the callback suspended on also closes
+	 * an array or an object: deliver it on the next call */
+	if (parser->suspended) {
+		parser->pending_event = type;
+		return 0;
 	}
-	parser->buffer_offset = 0;
-	return ret;
+	return callback_return(parser, (*parser->callback)(parser->userdata, type, NULL, 0));
 }
 
-static const uint8_t hextable[] = {
-	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-	  0,  1,  2,  3,  4,  5,  6,  7,  8,  9,255,255,255,255,255,255,
-	255, 10, 11, 12, 13, 14, 15,255,255,255,255,255,255,255,255,255,
-	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
-	255, 10, 11, 12, 13, 14, 15,255,255,255,255,255,255,255,255,255,
-	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+union array_value {
+	int64_t i;
+	double d;
 };
 
-#define hex(c) (hextable[(uint8_t) c])
+struct number {
+	uint64_t mantissa;
+	int digits;
+	int exponent;
+	int negative;
+	int is_float;
+};
 
-/* high surrogate range from d800 to dbff */
-/* low surrogate range dc00 to dfff */
-#define IS_HIGH_SURROGATE(uc) (((uc) & 0xfc00) == 0xd800)
-#define IS_LOW_SURROGATE(uc)  (((uc) & 0xfc00) == 0xdc00)
+static const double exact_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
 
-/* transform an unicode [0-9A-Fa-f]{4} sequence into a proper value */
-static int decode_unicode_char(json_parser *parser)
+/* scan a number with the same grammar as the state machine, collecting its
+ * digits on the way. return its length, or 0 if the characters at s are not
+ * a number followed by something else. */
+static inline uint32_t number_scan(const unsigned char *s, uint32_t length, struct number *n)
 {
-	uint32_t uval;
-	char *b = parser->buffer;
-	int offset = parser->buffer_offset;
-
-	uval = (hex(b[offset - 4]) << 12) | (hex(b[offset - 3]) << 8)
-	     | (hex(b[offset - 2]) << 4) | hex(b[offset - 1]);
-
-	parser->buffer_offset -= 4;
+	uint32_t i = 0;
+	int e = 0, eneg = 0;
 
-	/* fast case */
-	if (!parser->unicode_multi && uval < 0x80) {
-		b[parser->buffer_offset++] = (char) uval;
+	n->mantissa = 0;
+	n->digits = 0;
+	n->exponent = 0;
+	n->negative = 0;
+	n->is_float = 0;
+	if (i < length && s[i] == '-') {
+		n->negative = 1;
+		i++;
+	}
+	if (i >= length)
+		return 0;
+	if (s[i] == '0') {
+		i++;
+		/* an exponent needs a fraction after a 0 */
+		if (i < length && (s[i] == 'e' || s[i] == 'E'))
+			return 0;
+	} else if (s[i] >= '1' && s[i] <= '9') {
+		for (; i < length && s[i] >= '0' && s[i] <= '9'; i++, n->digits++)
+			n->mantissa = n->mantissa * 10 + (s[i] - '0');
+	} else
 		return 0;
+	if (i < length && s[i] == '.') {
+		n->is_float = 1;
+		if (++i >= length || s[i] < '0' || s[i] > '9')
+			return 0;
+		for (; i < length && s[i] >= '0' && s[i] <= '9'; i++, n->digits++, n->exponent--)
+			n->mantissa = n->mantissa * 10 + (s[i] - '0');
+	}
+	if (i < length && (s[i] == 'e' || s[i] == 'E')) {
+		n->is_float = 1;
+		if (++i < length && (s[i] == '+' || s[i] == '-'))
+			eneg = (s[i++] == '-');
+		if (i >= length || s[i] < '0' || s[i] > '9')
+			return 0;
+		for (; i < length && s[i] >= '0' && s[i] <= '9'; i++)
+			if (e < 100000)
+				e = e * 10 + (s[i] - '0');
+		n->exponent += (eneg) ? -e : e;
 	}
+	return (i < length) ? i : 0;
+}
 
-	if (parser->unicode_multi) {
-		if (!IS_LOW_SURROGATE(uval))
-			return JSON_ERROR_UNICODE_MISSING_LOW_SURROGATE;
+/* turn a scanned number into an int64_t if it is an integer that fits, or
+ * into a double. when the digits fit in the 53 bits of a double and the power
+ * of ten is exact, one multiplication or division gives the correctly
+ * rounded value, otherwise use strtod on the text, which is followed by a
+ * character that stops it. return JSON_INT or JSON_FLOAT */
+static inline int number_value(const struct number *n, const char *s, union array_value *v)
+{
+	double d;
 
-		uval = 0x10000 + ((parser->unicode_multi & 0x3ff) << 10) + (uval & 0x3ff);
-		b[parser->buffer_offset++] = (char) ((uval >> 18) | 0xf0);
-		b[parser->buffer_offset++] = (char) (((uval >> 12) & 0x3f) | 0x80);
-		b[parser->buffer_offset++] = (char) (((uval >> 6) & 0x3f) | 0x80);
-		b[parser->buffer_offset++] = (char) ((uval & 0x3f) | 0x80);
-		parser->unicode_multi = 0;
-		return 0;
+	if (!n->is_float && n->digits <= 18) {
+		v->i = (n->negative) ? -(int64_t) n->mantissa : (int64_t) n->mantissa;
+		return JSON_INT;
 	}
-
-	if (IS_LOW_SURROGATE(uval))
-		return JSON_ERROR_UNICODE_UNEXPECTED_LOW_SURROGATE;
-	if (IS_HIGH_SURROGATE(uval)) {
-		parser->unicode_multi = uval;
-		return 0;
+	if (!n->is_float && n->digits == 19) {
+		uint64_t limit = ((uint64_t) 1 << 63) - 1 + n->negative;
+		if (n->mantissa <= limit) {
+			v->i = (n->negative) ? (int64_t) (0 - n->mantissa) : (int64_t) n->mantissa;
+			return JSON_INT;
+		}
 	}
+	if (n->digits <= 19 && n->mantissa <= ((uint64_t) 1 << 53) && n->exponent >= -22 && n->exponent <= 22) {
+		d = (double) n->mantissa;
+		d = (n->exponent < 0) ? d / exact_powers_of_ten[-n->exponent] : d * exact_powers_of_ten[n->exponent];
+		v->d = (n->negative) ? -d : d;
+	} else
+		v->d = strtod(s, NULL);
+	return JSON_FLOAT;
+}
 
-	if (uval < 0x800) {
-		b[parser->buffer_offset++] = (char) ((uval >> 6) | 0xc0);
-		b[parser->buffer_offset++] = (char) ((uval & 0x3f) | 0x80);
-	} else {
-		b[parser->buffer_offset++] = (char) ((uval >> 12) | 0xe0);
-		b[parser->buffer_offset++] = (char) (((uval >> 6) & 0x3f) | 0x80);
-		b[parser->buffer_offset++] = (char) (((uval >> 0) & 0x3f) | 0x80);
+/* append a value to the captured array. the array is made of int64_t until
+ * the first number that isn't one, then everything is turned into doubles */
+static inline int array_value(json_parser *parser, int type, union array_value *v)
+{
+	union array_value *values = parser->array_values;
+	uint32_t i;
+
+	if (parser->array_count == parser->array_size) {
+		uint32_t newsize = (parser->array_size) ? parser->array_size * 2 : 64;
+		values = parser_realloc(parser, values, newsize * sizeof(union array_value));
+		if (!values)
+			return JSON_ERROR_NO_MEMORY;
+		parser->array_values = values;
+		parser->array_size = newsize;
+	}
+	if (type == (int) parser->array_type)
+		values[parser->array_count++] = *v;
+	else if (type == JSON_INT)
+		values[parser->array_count++].d = (double) v->i;
+	else {
+		for (i = 0; i < parser->array_count; i++)
+			values[i].d = (double) values[i].i;
+		parser->array_type = JSON_FLOAT;
+		values[parser->array_count++] = *v;
 	}
 	return 0;
 }
 
-static int buffer_push_escape(json_parser *parser, unsigned char next)
+/* keep the text of the array elements, in case the array has to be given
+ * back element by element */
+static int array_text(json_parser *parser, const char *s, uint32_t length)
 {
-	char c = '\0';
+	char *text;
 
-	switch (next) {
-	case 'b': c = '\b'; break;
-	case 'f': c = '\f'; break;
-	case 'n': c = '\n'; break;
-	case 'r': c = '\r'; break;
-	case 't': c = '\t'; break;
-	case '"': c = '"'; break;
-	case '/': c = '/'; break;
-	case '\\': c = '\\'; break;
+	if (parser->array_text_offset + length + 1 > parser->array_text_size) {
+		uint32_t newsize = parser->array_text_size * 2;
+		if (newsize < parser->array_text_offset + length + 1)
+			newsize = parser->array_text_offset + length + 1 + 256;
+		text = parser_realloc(parser, parser->array_text, newsize);
+		if (!text)
+			return JSON_ERROR_NO_MEMORY;
+		parser->array_text = text;
+		parser->array_text_size = newsize;
 	}
-	/* push the escaped character */
-	return buffer_push(parser, c);
+	memcpy(parser->array_text + parser->array_text_offset, s, length);
+	parser->array_text_offset += length;
+	return 0;
 }
 
-#define CHK(f) do { ret = f; if (ret) return ret; } while(0)
+/* append the number in the parse buffer to the captured array */
+static int array_number(json_parser *parser)
+{
+	struct number n;
+	union array_value v;
+	int ret, type;
 
-static int act_uc(json_parser *parser)
+	parser->buffer[parser->buffer_offset] = '\0';
+	number_scan((const unsigned char *) parser->buffer, parser->buffer_offset + 1, &n);
+	type = number_value(&n, parser->buffer, &v);
+	CHK(array_value(parser, type, &v));
+	CHK(array_text(parser, parser->buffer, parser->buffer_offset));
+	return array_text(parser, ",", 1);
+}
+
+static int buffer_replay(json_parser *parser, const char *s, uint32_t length)
 {
+	uint32_t i;
 	int ret;
-	CHK(decode_unicode_char(parser));
-	parser->state = (parser->unicode_multi) ? STATE_D1 : STATE__S;
+
+	for (i = 0; i < length; i++)
+		CHK(buffer_append(parser, s[i]));
 	return 0;
 }
 
-static int act_yb(json_parser *parser)
+/* an element of the captured array is not a number: send the events that
+ * were held back, before the event of that element. stash is set when the
+ * element is a value currently in the parse buffer */
+static int array_fallback(json_parser *parser, int stash)
 {
-	if (!parser->config.allow_yaml_comments)
-		return JSON_ERROR_COMMENT_NOT_ALLOWED;
-	parser->save_state = parser->state;
+	uint32_t i, start, numbers, stashed = 0;
+	int ret, is_float;
+
+	parser->array_depth = 0;
+	numbers = parser->array_text_offset;
+	if (stash) {
+		stashed = parser->buffer_offset;
+		CHK(array_text(parser, parser->buffer, stashed));
+		parser->buffer_offset = 0;
+	}
+	CHK(emit(parser, JSON_ARRAY_BEGIN));
+	for (i = 0; i < numbers; ) {
+		const char *text = parser->array_text;
+		if (text[i] == ',' || text[i] == ' ' || text[i] == '\t' || text[i] == '\n' || text[i] == '\r') {
+			i++;
+			continue;
+		}
+		is_float = 0;
+		for (start = i; i < numbers && text[i] != ',' && text[i] != ' ' && text[i] != '\t'
+		                && text[i] != '\n' && text[i] != '\r'; i++)
+			if (text[i] == '.' || text[i] == 'e' || text[i] == 'E')
+				is_float = 1;
+		CHK(buffer_replay(parser, text + start, i - start));
+		CHK(emit_withbuf(parser, (is_float) ? JSON_FLOAT : JSON_INT));
+		parser->buffer_offset = 0;
+	}
+	if (stash)
+		CHK(buffer_replay(parser, parser->array_text + numbers, stashed));
+	parser->array_count = 0;
+	parser->array_text_offset = 0;
 	return 0;
 }
 
-static int act_cb(json_parser *parser)
+static int array_end(json_parser *parser)
 {
-	if (!parser->config.allow_c_comments)
-		return JSON_ERROR_COMMENT_NOT_ALLOWED;
-	parser->save_state = parser->state;
-	return 0;
+	uint32_t count = parser->array_count;
+	int ret;
+
+	parser->array_depth = 0;
+	parser->array_count = 0;
+	parser->array_text_offset = 0;
+	/* events batched before the array go first */
+	if (parser->batch_events_count > 0)
+		CHK(batch_flush(parser));
+	return (*parser->array_callback)(parser->array_userdata, parser->array_type,
+	                                 parser->array_values, count);
+}
+
+static const char base64_alphabet[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* value of each base64 character, 0xff for the others */
+static const uint8_t base64_values[256] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+/* encode length bytes of data in out, which needs 4 characters for every 3 bytes.
+ * return the number of characters written */
+static uint32_t base64_encode(char *out, const unsigned char *data, uint32_t length)
+{
+	char *o = out;
+	uint32_t i;
+
+	for (i = 0; i + 3 <= length; i += 3) {
+		uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+		o[0] = base64_alphabet[v >> 18];
+		o[1] = base64_alphabet[(v >> 12) & 0x3f];
+		o[2] = base64_alphabet[(v >> 6) & 0x3f];
+		o[3] = base64_alphabet[v & 0x3f];
+		o += 4;
+	}
+	if (i < length) {
+		uint32_t v = data[i] << 16;
+		if (i + 1 < length)
+			v |= data[i + 1] << 8;
+		o[0] = base64_alphabet[v >> 18];
+		o[1] = base64_alphabet[(v >> 12) & 0x3f];
+		o[2] = (i + 1 < length) ? base64_alphabet[(v >> 6) & 0x3f] : '=';
+		o[3] = '=';
+		o += 4;
+	}
+	return o - out;
+}
+
+/* decode base64 text in place, padded or not. return the decoded length,
+ * or -1 if the text isn't valid base64 */
+static int64_t base64_decode(char *buf, uint32_t length)
+{
+	const unsigned char *in = (const unsigned char *) buf;
+	unsigned char *out = (unsigned char *) buf;
+	uint32_t i, v, bad = 0;
+
+	if (length >= 4 && (length & 3) == 0 && in[length - 1] == '=') {
+		length--;
+		if (in[length - 1] == '=')
+			length--;
+	}
+	if ((length & 3) == 1)
+		return -1;
+	for (i = 0; i + 4 <= length; i += 4) {
+		uint8_t a = base64_values[in[i]], b = base64_values[in[i + 1]];
+		uint8_t c = base64_values[in[i + 2]], d = base64_values[in[i + 3]];
+		bad |= a | b | c | d;
+		v = (a << 18) | (b << 12) | (c << 6) | d;
+		*out++ = v >> 16;
+		*out++ = v >> 8;
+		*out++ = v;
+	}
+	if (i < length) {
+		uint32_t left = length - i;
+		uint8_t a = base64_values[in[i]], b = base64_values[in[i + 1]];
+		uint8_t c = (left == 3) ? base64_values[in[i + 2]] : 0;
+		bad |= a | b | c;
+		v = (a << 18) | (b << 12) | (c << 6);
+		*out++ = v >> 16;
+		if (left == 3)
+			*out++ = v >> 8;
+		/* the bits of the last character past the data are zero */
+		if (v & ((left == 3) ? 0xff : 0xffff))
+			return -1;
+	}
+	if (bad & 0xc0)
+		return -1;
+	return out - (unsigned char *) buf;
+}
+
+static int is_base64_key(json_parser *parser)
+{
+	const char * const *key;
+
+	for (key = parser->config.base64_keys; *key; key++)
+		if (strlen(*key) == parser->buffer_offset
+		    && memcmp(*key, parser->buffer, parser->buffer_offset) == 0)
+			return 1;
+	return 0;
+}
+
+/* return the id of the key in the buffer */
+static int32_t key_id(json_parser *parser)
+{
+	uint32_t hash = string_hash(parser->buffer, parser->buffer_offset);
+	uint32_t mask = parser->keys_size - 1, i;
+
+	for (i = hash & mask; parser->keys[i].id; i = (i + 1) & mask) {
+		struct json_parser_key *k = &parser->keys[i];
+		if (k->hash == hash && k->length == parser->buffer_offset
+		    && memcmp(parser->config.keys[k->id - 1], parser->buffer, k->length) == 0)
+			return (int32_t) k->id - 1;
+	}
+	return JSON_KEY_UNKNOWN;
+}
+
+/* an event of a member skipped, which ends with its value */
+static void skip_event(json_parser *parser, int type)
+{
+	switch (type) {
+	case JSON_ARRAY_BEGIN: case JSON_OBJECT_BEGIN:
+		parser->skip_nesting++;
+		break;
+	case JSON_ARRAY_END: case JSON_OBJECT_END:
+		parser->skip_nesting--;
+		/* fall through */
+	default:
+		if (parser->skip_nesting == 0)
+			parser->skip_value = 0;
+		break;
+	}
+}
+
+/* deliver the start of the value in the buffer in a JSON_PARTIAL event */
+static int do_partial(json_parser *parser)
+{
+	int ret;
+
+	parser->partial = 1;
+	/* a key that long is unknown, and skipped with its value */
+	if (parser->skip_value || (parser->expecting_key && parser->keys
+	                           && parser->config.skip_unknown_keys)) {
+		parser->buffer_offset = 0;
+		return 0;
+	}
+	if (parser->base64_value && (parser->state == STATE__S || parser->state == STATE_E0
+	                             || parser->state == STATE_U1)) {
+		int64_t length;
+		/* padding only ends the value */
+		if (parser->buffer[parser->buffer_offset - 1] == '=')
+			return JSON_ERROR_BASE64;
+		length = base64_decode(parser->buffer, parser->buffer_offset);
+		if (length < 0)
+			return JSON_ERROR_BASE64;
+		parser->buffer_offset = (uint32_t) length;
+	}
+	if (parser->array_depth)
+		CHK(array_fallback(parser, 1));
+	ret = emit_withbuf(parser, JSON_PARTIAL);
+	parser->buffer_offset = 0;
+	return ret;
+}
+
+static int do_callback_withbuf(json_parser *parser, int type)
+{
+	/* the end of a key delivered in parts doesn't identify it */
+	int partial = parser->partial;
+
+	parser->partial = 0;
+	if (parser->skip_value) {
+		skip_event(parser, type);
+		return 0;
+	}
+	if (type == JSON_KEY && parser->keys) {
+		parser->key_id = (partial) ? JSON_KEY_UNKNOWN : key_id(parser);
+		if (parser->key_id == JSON_KEY_UNKNOWN && parser->config.skip_unknown_keys) {
+			parser->skip_value = 1;
+			parser->base64_value = 0;
+			return 0;
+		}
+	}
+	if (parser->config.base64_keys) {
+		if (type == JSON_KEY)
+			parser->base64_value = !partial && is_base64_key(parser);
+		else if (type == JSON_STRING && parser->base64_value) {
+			int64_t length = base64_decode(parser->buffer, parser->buffer_offset);
+			if (length < 0)
+				return JSON_ERROR_BASE64;
+			parser->buffer_offset = (uint32_t) length;
+			parser->base64_value = 0;
+			type = JSON_BSTRING;
+		} else
+			parser->base64_value = 0;
+	}
+	if (parser->array_depth) {
+		int ret;
+		if (type == JSON_INT || type == JSON_FLOAT)
+			return array_number(parser);
+		CHK(array_fallback(parser, 1));
+	}
+	return emit_withbuf(parser, type);
+}
+
+static int do_callback(json_parser *parser, int type)
+{
+	if (parser->skip_value) {
+		skip_event(parser, type);
+		return 0;
+	}
+	parser->base64_value = 0;
+	if (parser->array_depth) {
+		int ret;
+		if (type == JSON_ARRAY_END)
+			return array_end(parser);
+		CHK(array_fallback(parser, 0));
+	}
+	if (type == JSON_ARRAY_BEGIN && parser->array_match &&
+	    (*parser->array_match)(parser->array_userdata, parser->stack_offset)) {
+		parser->array_depth = parser->stack_offset + 1;
+		parser->array_type = JSON_INT;
+		return 0;
+	}
+	return emit(parser, type);
+}
+
+static int do_buffer(json_parser *parser)
+{
+	int ret = 0;
+
+	switch (parser->type) {
+	case JSON_KEY: case JSON_STRING:
+	case JSON_FLOAT: case JSON_INT:
+	case JSON_NULL: case JSON_TRUE: case JSON_FALSE:
+		ret = do_callback_withbuf(parser, parser->type);
+		if (ret)
+			return ret;
+		break;
+	default:
+		break;
+	}
+	parser->buffer_offset = 0;
+	return ret;
+}
+
+static const uint8_t hextable[] = {
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	  0,  1,  2,  3,  4,  5,  6,  7,  8,  9,255,255,255,255,255,255,
+	255, 10, 11, 12, 13, 14, 15,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255, 10, 11, 12, 13, 14, 15,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+};
+
+#define hex(c) (hextable[(uint8_t) c])
+
+/* high surrogate range from d800 to dbff */
+/* low surrogate range dc00 to dfff */
+#define IS_HIGH_SURROGATE(uc) (((uc) & 0xfc00) == 0xd800)
+#define IS_LOW_SURROGATE(uc)  (((uc) & 0xfc00) == 0xdc00)
+
+/* write the utf8 encoding of an unicode value to b and return its length */
+static inline int utf8_encode(char *b, uint32_t uval)
+{
+	if (uval < 0x80) {
+		b[0] = (char) uval;
+		return 1;
+	}
+	if (uval < 0x800) {
+		b[0] = (char) ((uval >> 6) | 0xc0);
+		b[1] = (char) ((uval & 0x3f) | 0x80);
+		return 2;
+	}
+	if (uval < 0x10000) {
+		b[0] = (char) ((uval >> 12) | 0xe0);
+		b[1] = (char) (((uval >> 6) & 0x3f) | 0x80);
+		b[2] = (char) ((uval & 0x3f) | 0x80);
+		return 3;
+	}
+	b[0] = (char) ((uval >> 18) | 0xf0);
+	b[1] = (char) (((uval >> 12) & 0x3f) | 0x80);
+	b[2] = (char) (((uval >> 6) & 0x3f) | 0x80);
+	b[3] = (char) ((uval & 0x3f) | 0x80);
+	return 4;
+}
+
+/* convert 4 hex digits at once. the digits are validated with a single
+ * test on the combined table values. return a value > 0xffff if invalid */
+static inline uint32_t hex4(const unsigned char *u)
+{
+	uint32_t h;
+
+	if ((u[0] | u[1] | u[2] | u[3]) & 0x80)
+		return 0x10000;
+	h = ((uint32_t) hex(u[0]) << 24) | ((uint32_t) hex(u[1]) << 16)
+	  | ((uint32_t) hex(u[2]) << 8) | hex(u[3]);
+	if (h & 0xf0f0f0f0)
+		return 0x10000;
+	return ((h >> 12) & 0xf000) | ((h >> 8) & 0x0f00) | ((h >> 4) & 0x00f0) | (h & 0x000f);
+}
+
+/* transform an unicode [0-9A-Fa-f]{4} sequence into a proper value */
+static int decode_unicode_char(json_parser *parser)
+{
+	uint32_t uval;
+	char *b = parser->buffer;
+	int offset = parser->buffer_offset;
+
+	uval = (hex(b[offset - 4]) << 12) | (hex(b[offset - 3]) << 8)
+	     | (hex(b[offset - 2]) << 4) | hex(b[offset - 1]);
+
+	parser->buffer_offset -= 4;
+
+	/* fast case */
+	if (!parser->unicode_multi && uval < 0x80) {
+		b[parser->buffer_offset++] = (char) uval;
+		return 0;
+	}
+
+	if (parser->unicode_multi) {
+		if (!IS_LOW_SURROGATE(uval))
+			return JSON_ERROR_UNICODE_MISSING_LOW_SURROGATE;
+
+		uval = 0x10000 + ((parser->unicode_multi & 0x3ff) << 10) + (uval & 0x3ff);
+		parser->buffer_offset += utf8_encode(b + parser->buffer_offset, uval);
+		parser->unicode_multi = 0;
+		return 0;
+	}
+
+	if (IS_LOW_SURROGATE(uval))
+		return JSON_ERROR_UNICODE_UNEXPECTED_LOW_SURROGATE;
+	if (IS_HIGH_SURROGATE(uval)) {
+		parser->unicode_multi = uval;
+		return 0;
+	}
+
+	parser->buffer_offset += utf8_encode(b + parser->buffer_offset, uval);
+	return 0;
+}
+
+/* return the character represented by a one character escape, or 0 */
+static inline char escape_char(unsigned char next)
+{
+	switch (next) {
+	case 'b': return '\b';
+	case 'f': return '\f';
+	case 'n': return '\n';
+	case 'r': return '\r';
+	case 't': return '\t';
+	case '"': return '"';
+	case '/': return '/';
+	case '\\': return '\\';
+	}
+	return '\0';
+}
+
+static int buffer_push_escape(json_parser *parser, unsigned char next)
+{
+	/* push the escaped character */
+	return buffer_push(parser, escape_char(next));
+}
+
+/* decode the escape sequence at s in one step when it is complete in the
+ * input and valid, including \\uXXXX\\uXXXX surrogate pairs, writing the
+ * resulting utf8 directly in the buffer. anything else (incomplete, invalid,
+ * or not enough buffer) is left to the per-character path which reports
+ * errors exactly as before. return the number of characters consumed */
+static uint32_t decode_escape(json_parser *parser, const char *s, uint32_t length)
+{
+	const unsigned char *u = (const unsigned char *) s;
+	uint32_t uval, low;
+	char c;
+
+	if (length < 2)
+		return 0;
+	if (u[1] != 'u') {
+		c = escape_char(u[1]);
+		if (!c || buffer_reserve(parser, 1) < 1)
+			return 0;
+		parser->buffer[parser->buffer_offset++] = c;
+		return 2;
+	}
+
+	/* the per-character path needs room for the 4 hex digits */
+	if (length < 6 || buffer_reserve(parser, 4) < 4)
+		return 0;
+	uval = hex4(u + 2);
+	if (uval > 0xffff || IS_LOW_SURROGATE(uval))
+		return 0;
+	if (!IS_HIGH_SURROGATE(uval)) {
+		parser->buffer_offset += utf8_encode(parser->buffer + parser->buffer_offset, uval);
+		return 6;
+	}
+	if (length < 12 || u[6] != '\\' || u[7] != 'u')
+		return 0;
+	low = hex4(u + 8);
+	if (low > 0xffff || !IS_LOW_SURROGATE(low))
+		return 0;
+	uval = 0x10000 + ((uval & 0x3ff) << 10) + (low & 0x3ff);
+	parser->buffer_offset += utf8_encode(parser->buffer + parser->buffer_offset, uval);
+	return 12;
+}
+
+/* append the string content starting at s to the buffer, plain runs in bulk
+ * and escapes in one step, and return the number of characters consumed */
+static uint32_t string_run(json_parser *parser, const char *s, uint32_t length)
+{
+	uint32_t i = 0;
+
+	while (i < length) {
+		uint32_t run, n;
+
+		if (s[i] == '\\') {
+			n = decode_escape(parser, s + i, length - i);
+			if (n == 0)
+				break;
+			i += n;
+			continue;
+		}
+		run = scan_text_run((const unsigned char *) s + i, length - i, '"', '\\', 0);
+		if (run == 0)
+			break;
+		n = buffer_reserve(parser, run);
+		/* never split an utf8 sequence when the buffer is full */
+		while (n < run && n > 0 && (s[i + n] & 0xc0) == 0x80)
+			n--;
+		memcpy(parser->buffer + parser->buffer_offset, s + i, n);
+		parser->buffer_offset += n;
+		i += n;
+		if (n < run)
+			break;
+	}
+	return i;
+}
+
+/* states that have a fast path in state_run */
+static const uint8_t has_state_run[NR_STATES] = {
+/*GO OK _O _K CO _V _A _S E0 U1 U2 U3 U4 M0 Z0 I0 R1 R2 X1 X2 X3 T1 T2 T3 F1 F2 F3 F4 N1 N2 N3 C1 C2 C3 Y1 D1 D2 */
+   1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0,
+};
+
+/* decode the elements of a captured array straight from the input, as long
+ * as each number is followed by a comma. the state machine takes over on
+ * anything else, including the last element, so errors and limits are
+ * reported as usual. */
+static uint32_t array_run(json_parser *parser, const unsigned char *s, uint32_t length)
+{
+	uint32_t i = 0, done = 0, n, limit = parser->config.max_data;
+	uint32_t count = parser->array_count;
+	struct number number;
+	union array_value v;
+
+	if (parser->batch_events && !parser->batch_data_owned
+	    && (limit == 0 || limit > parser->batch_data_size))
+		limit = parser->batch_data_size;
+	while (1) {
+		while (i < length && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r'))
+			i++;
+		n = number_scan(s + i, length - i, &number);
+		if (n == 0 || (limit > 0 && n >= limit))
+			break;
+		if (s[i + n] != ',') {
+			uint32_t j = i + n;
+			while (j < length && (s[j] == ' ' || s[j] == '\t' || s[j] == '\n' || s[j] == '\r'))
+				j++;
+			if (j >= length || s[j] != ',')
+				break;
+			n = j - i;
+		}
+		if (array_value(parser, number_value(&number, (const char *) s + i, &v), &v))
+			break;
+		i += n + 1;
+		done = i;
+	}
+	if (done > 0) {
+		/* the elements decoded are only kept if their text can be kept too */
+		if (array_text(parser, (const char *) s, done)) {
+			parser->array_count = count;
+			return 0;
+		}
+		parser->state = STATE__V;
+	}
+	return done;
+}
+
+/* return the number of characters starting at s that can be processed in bulk
+ * because they don't change the state: whitespace between tokens, plain
+ * string content and comment content. */
+static inline uint32_t state_run(json_parser *parser, int state, const char *s, uint32_t length)
+{
+	switch (state) {
+	case STATE_GO: case STATE_OK: case STATE__O: case STATE__K:
+	case STATE_CO:
+		return scan_white_run((const unsigned char *) s, length);
+	case STATE__V: case STATE__A:
+		if (parser->array_depth == parser->stack_offset && parser->array_depth && !parser->minify_callback)
+			return array_run(parser, (const unsigned char *) s, length);
+		return scan_white_run((const unsigned char *) s, length);
+	case STATE__S:
+		return string_run(parser, s, length);
+	case STATE_C2:
+		return scan_text_run((const unsigned char *) s, length, '*', '*', 1);
+	case STATE_Y1:
+		return scan_text_run((const unsigned char *) s, length, '\n', '\n', 1);
+	default:
+		return 0;
+	}
+}
+
+static int act_uc(json_parser *parser)
+{
+	int ret;
+	CHK(decode_unicode_char(parser));
+	parser->state = (parser->unicode_multi) ? STATE_D1 : STATE__S;
+	return 0;
+}
+
+static int act_yb(json_parser *parser)
+{
+	if (!parser->config.allow_yaml_comments)
+		return JSON_ERROR_COMMENT_NOT_ALLOWED;
+	parser->save_state = parser->state;
+	return 0;
+}
+
+static int act_cb(json_parser *parser)
+{
+	if (!parser->config.allow_c_comments)
+		return JSON_ERROR_COMMENT_NOT_ALLOWED;
+	parser->save_state = parser->state;
+	return 0;
 }
 
 static int act_ce(json_parser *parser)
@@ -661,44 +1738,130 @@ static int do_action(json_parser *parser, int next_state)
 	return 0;
 }
 
-/** json_parser_init initialize a parser structure taking a config,
- * a config and its userdata.
- * return JSON_ERROR_NO_MEMORY if memory allocation failed or SUCCESS.
- */
-int json_parser_init(json_parser *parser, json_config *config,
-                     json_parser_callback callback, void *userdata)
+/* return !0 if the minify output drops the character: whitespace outside
+ * strings and everything that is part of a comment */
+static inline int minify_drops(int state, int next_class, int next_state)
 {
-	memset(parser, 0, sizeof(*parser));
-
-	if (config)
-		memcpy(&parser->config, config, sizeof(json_config));
-	parser->callback = callback;
-	parser->userdata = userdata;
+	if (next_class <= C_WHITE && state != STATE__S)
+		return 1;
+	if (state >= STATE_C1 && state <= STATE_Y1)
+		return 1;
+	return (next_state == STATE_CB || next_state == STATE_YB);
+}
 
-	/* initialise parsing stack and state */
-	parser->stack_offset = 0;
-	parser->state = STATE_GO;
+static int minify_output(json_parser *parser, const char *s, uint32_t length)
+{
+	if ((*parser->minify_callback)(parser->minify_userdata, s, length))
+		return JSON_ERROR_CALLBACK;
+	return 0;
+}
 
-	/* initialize the parse stack */
-	parser->stack_size = (parser->config.max_nesting > 0)
-		? parser->config.max_nesting
-		: LIBJSON_DEFAULT_STACK_SIZE;
+/* build the hash table of the known keys, where the first of duplicated keys is kept */
+static int keys_init(json_parser *parser)
+{
+	uint32_t n, size = 8, i;
 
-	parser->stack = parser_calloc(parser, parser->stack_size, sizeof(parser->stack[0]));
-	if (!parser->stack)
+	for (n = 0; parser->config.keys[n]; n++);
+	while (size < n * 2)
+		size *= 2;
+	parser->keys = parser_calloc(parser, size, sizeof(*parser->keys));
+	if (!parser->keys)
 		return JSON_ERROR_NO_MEMORY;
+	parser->keys_size = size;
+	for (n = 0; parser->config.keys[n]; n++) {
+		const char *key = parser->config.keys[n];
+		uint32_t length = strlen(key), hash = string_hash(key, length);
 
-	/* initialize the parse buffer */
-	parser->buffer_size = (parser->config.buffer_initial_size > 0)
+		for (i = hash & (size - 1); parser->keys[i].id; i = (i + 1) & (size - 1))
+			if (parser->keys[i].hash == hash && parser->keys[i].length == length
+			    && memcmp(parser->config.keys[parser->keys[i].id - 1], key, length) == 0)
+				break;
+		if (!parser->keys[i].id) {
+			parser->keys[i].hash = hash;
+			parser->keys[i].length = length;
+			parser->keys[i].id = n + 1;
+		}
+	}
+	return 0;
+}
+
+/* partial values are cut at partial_size, and keys only when longer than
+ * the keys the parser looks up */
+static void partial_init(json_parser *parser)
+{
+	const char * const *key;
+	uint32_t limit = parser->config.partial_size;
+
+	if (limit == 0) {
+		parser->partial_limit = parser->partial_key_limit = UINT32_MAX;
+		return;
+	}
+	parser->partial_limit = parser->partial_key_limit = limit;
+	for (key = parser->config.keys; key && *key; key++)
+		if (strlen(*key) >= parser->partial_key_limit)
+			parser->partial_key_limit = strlen(*key) + 1;
+	for (key = parser->config.base64_keys; key && *key; key++)
+		if (strlen(*key) >= parser->partial_key_limit)
+			parser->partial_key_limit = strlen(*key) + 1;
+}
+
+static uint32_t buffer_initial_size(json_parser *parser)
+{
+	uint32_t size = (parser->config.buffer_initial_size > 0)
 		? parser->config.buffer_initial_size
 		: LIBJSON_DEFAULT_BUFFER_SIZE;
 
-	if (parser->config.max_data > 0 && parser->buffer_size > parser->config.max_data)
-		parser->buffer_size = parser->config.max_data;
+	if (parser->config.max_data > 0 && size > parser->config.max_data)
+		size = parser->config.max_data;
+	return size;
+}
+
+/** json_parser_init initialize a parser structure taking a config,
+ * a config and its userdata.
+ * return JSON_ERROR_NO_MEMORY if memory allocation failed or SUCCESS.
+ */
+int json_parser_init(json_parser *parser, json_config *config,
+                     json_parser_callback callback, void *userdata)
+{
+	memset(parser, 0, sizeof(*parser));
+
+	if (config)
+		memcpy(&parser->config, config, sizeof(json_config));
+	parser->callback = callback;
+	parser->userdata = userdata;
+
+	/* initialise parsing stack and state */
+	parser->stack_offset = 0;
+	parser->state = STATE_GO;
+
+	/* initialize the parse stack */
+	parser->stack_size = (parser->config.max_nesting > 0)
+		? parser->config.max_nesting
+		: LIBJSON_DEFAULT_STACK_SIZE;
+
+	parser->stack = parser_calloc(parser, parser->stack_size, sizeof(parser->stack[0]));
+	if (!parser->stack)
+		return JSON_ERROR_NO_MEMORY;
 
+	/* initialize the parse buffer */
+	parser->buffer_size = buffer_initial_size(parser);
+	if (budget_take(parser, parser->buffer_size)) {
+		parser_free(parser, parser->stack);
+		return JSON_ERROR_BUDGET;
+	}
 	parser->buffer = parser_calloc(parser, parser->buffer_size, sizeof(char));
 	if (!parser->buffer) {
-		free(parser->stack);
+		budget_give(parser, parser->budget_taken);
+		parser_free(parser, parser->stack);
+		return JSON_ERROR_NO_MEMORY;
+	}
+
+	partial_init(parser);
+	parser->key_id = JSON_KEY_UNKNOWN;
+	if (parser->config.keys && keys_init(parser)) {
+		budget_give(parser, parser->budget_taken);
+		parser_free(parser, parser->stack);
+		parser_free(parser, parser->buffer);
 		return JSON_ERROR_NO_MEMORY;
 	}
 	return 0;
@@ -709,18 +1872,339 @@ int json_parser_free(json_parser *parser)
 {
 	if (!parser)
 		return 0;
-	free(parser->stack);
-	free(parser->buffer);
+	parser_free(parser, parser->stack);
+	if (!parser->batch_events)
+		parser_free(parser, parser->buffer);
+	else if (parser->batch_data_owned)
+		parser_free(parser, parser->batch_data);
+	budget_give(parser, parser->budget_taken);
+	parser_free(parser, parser->array_values);
+	parser_free(parser, parser->array_text);
+	parser_free(parser, parser->keys);
 	parser->stack = NULL;
 	parser->buffer = NULL;
+	parser->array_values = NULL;
+	parser->array_text = NULL;
+	parser->keys = NULL;
+	return 0;
+}
+
+/** json_parser_minify makes the parser output the input it processes to a
+ * printer callback, without whitespace and comments. */
+int json_parser_minify(json_parser *parser, json_printer_callback callback, void *userdata)
+{
+	parser->minify_callback = callback;
+	parser->minify_userdata = userdata;
+	return 0;
+}
+
+/** json_parser_batch switches the parser to deliver its events in batches
+ * to the batch callback instead of one by one to the parser callback */
+int json_parser_batch(json_parser *parser, json_event *events, uint32_t nb_events,
+                      char *data, uint32_t data_size,
+                      json_parser_batch_callback callback, void *userdata)
+{
+	int owned = 0;
+
+	if (!events || nb_events == 0)
+		return JSON_ERROR_NO_MEMORY;
+	if (!data) {
+		if (data_size == 0)
+			data_size = (parser->config.buffer_initial_size > 0)
+				? parser->config.buffer_initial_size
+				: LIBJSON_DEFAULT_BUFFER_SIZE;
+		if (budget_take(parser, data_size))
+			return JSON_ERROR_BUDGET;
+		data = parser_calloc(parser, data_size, sizeof(char));
+		if (!data) {
+			budget_give(parser, data_size);
+			return JSON_ERROR_NO_MEMORY;
+		}
+		owned = 1;
+	} else if (data_size == 0)
+		return JSON_ERROR_NO_MEMORY;
+
+	/* the area replaces the current buffer in the budget */
+	budget_give(parser, parser->budget_taken - ((owned) ? data_size : 0));
+
+	/* the values are now parsed directly in the data area */
+	if (!parser->batch_events)
+		parser_free(parser, parser->buffer);
+	else if (parser->batch_data_owned)
+		parser_free(parser, parser->batch_data);
+
+	parser->batch_callback = callback;
+	parser->batch_userdata = userdata;
+	parser->batch_events = events;
+	parser->batch_events_size = nb_events;
+	parser->batch_events_count = 0;
+	parser->batch_data = data;
+	parser->batch_data_size = data_size;
+	parser->batch_data_owned = owned;
+
+	parser->buffer = data;
+	parser->buffer_offset = 0;
+	parser->buffer_size = batch_room(parser);
+	return 0;
+}
+
+/** json_parser_arrays makes the parser decode the arrays of numbers selected
+ * by the match callback into a vector delivered to the array callback */
+int json_parser_arrays(json_parser *parser, json_parser_array_match match,
+                       json_parser_array_callback callback, void *userdata)
+{
+	parser->array_match = match;
+	parser->array_callback = callback;
+	parser->array_userdata = userdata;
+	return 0;
+}
+
+/** json_parser_key_id returns the id of the last key delivered */
+int json_parser_key_id(json_parser *parser)
+{
+	return parser->key_id;
+}
+
+/** json_parser_value makes the parser accept one value of any type, by starting
+ * as if it was after a comma in an array, but without the array */
+int json_parser_value(json_parser *parser)
+{
+	parser->state = STATE__V;
+	return 0;
+}
+
+/* report a suspension requested by a callback during the call */
+static int suspend_return(json_parser *parser, int ret)
+{
+	if (!parser->suspended)
+		return ret;
+	parser->suspended = 0;
+	if (ret) {
+		parser->pending_event = JSON_NONE;
+		return ret;
+	}
+	return JSON_SUSPEND;
+}
+
+/** json_parser_value_end delivers a number, true, false or null ending the input
+ * of a parser set by json_parser_value. in a document, the character following
+ * them does it */
+int json_parser_value_end(json_parser *parser)
+{
+	int ret;
+
+	if (parser->stack_offset > 0)
+		return 0;
+	switch (parser->state) {
+	case STATE_I0: case STATE_Z0: case STATE_R2: case STATE_X3:
+		parser->state = STATE_OK;
+		/* fall through */
+	case STATE_OK:
+		ret = do_buffer(parser);
+		parser->type = JSON_NONE;
+		break;
+	default:
+		return 0;
+	}
+	if (parser->batch_events_count > 0 && !parser->suspended) {
+		int batch_ret = batch_flush(parser);
+		if (!ret)
+			ret = batch_ret;
+	}
+	return suspend_return(parser, ret);
+}
+
+#define PARSER_STATE_MAGIC 0x5453504a /* "JPST" */
+#define PARSER_STATE_VERSION 1
+
+enum {
+	SAVED_MAGIC, SAVED_VERSION, SAVED_STATE, SAVED_SAVE_STATE, SAVED_EXPECTING_KEY,
+	SAVED_UTF8_LEFT, SAVED_BASE64, SAVED_UNICODE_MULTI, SAVED_TYPE, SAVED_PENDING_EVENT,
+	SAVED_KEY_ID, SAVED_SKIP_NESTING, SAVED_SKIP_VALUE, SAVED_STACK, SAVED_BUFFER,
+	SAVED_ARRAY_DEPTH, SAVED_ARRAY_TYPE, SAVED_ARRAY_COUNT, SAVED_ARRAY_TEXT, SAVED_PARTIAL,
+	SAVED_CHECKSUM,
+	SAVED_HEADER_COUNT
+};
+
+/** json_parser_save writes the header with the scalar state and a hash of the
+ * rest, then the numbers of a captured array, the stack, the parse buffer and
+ * the captured array text */
+int json_parser_save(json_parser *parser, json_printer_callback callback, void *userdata)
+{
+	uint32_t header[SAVED_HEADER_COUNT] = { 0 };
+	int ret;
+
+	/* events held back by a suspension only live in the batch */
+	if (parser->batch_events_count > 0)
+		return JSON_ERROR_SNAPSHOT;
+
+	header[SAVED_MAGIC] = PARSER_STATE_MAGIC;
+	header[SAVED_VERSION] = PARSER_STATE_VERSION;
+	header[SAVED_STATE] = parser->state;
+	header[SAVED_SAVE_STATE] = parser->save_state;
+	header[SAVED_EXPECTING_KEY] = parser->expecting_key;
+	header[SAVED_UTF8_LEFT] = parser->utf8_multibyte_left;
+	header[SAVED_BASE64] = parser->base64_value;
+	header[SAVED_UNICODE_MULTI] = parser->unicode_multi;
+	header[SAVED_TYPE] = parser->type;
+	header[SAVED_PENDING_EVENT] = parser->pending_event;
+	header[SAVED_KEY_ID] = (uint32_t) parser->key_id;
+	header[SAVED_SKIP_NESTING] = parser->skip_nesting;
+	header[SAVED_SKIP_VALUE] = parser->skip_value;
+	header[SAVED_STACK] = parser->stack_offset;
+	header[SAVED_BUFFER] = parser->buffer_offset;
+	header[SAVED_ARRAY_DEPTH] = parser->array_depth;
+	header[SAVED_ARRAY_TYPE] = parser->array_type;
+	header[SAVED_ARRAY_COUNT] = (parser->array_depth) ? parser->array_count : 0;
+	header[SAVED_ARRAY_TEXT] = (parser->array_depth) ? parser->array_text_offset : 0;
+	header[SAVED_PARTIAL] = parser->partial;
+	header[SAVED_CHECKSUM] = hash_update(hash_update(hash_update(hash_update(hash_update(
+		2166136261u, (const char *) header, sizeof(header)),
+		parser->array_values, (uint64_t) header[SAVED_ARRAY_COUNT] * sizeof(union array_value)),
+		(const char *) parser->stack, parser->stack_offset),
+		parser->buffer, parser->buffer_offset),
+		parser->array_text, header[SAVED_ARRAY_TEXT]);
+
+	CHK(write_all(callback, userdata, header, sizeof(header)));
+	CHK(write_all(callback, userdata, parser->array_values,
+	                (uint64_t) header[SAVED_ARRAY_COUNT] * sizeof(union array_value)));
+	CHK(write_all(callback, userdata, parser->stack, parser->stack_offset));
+	CHK(write_all(callback, userdata, parser->buffer, parser->buffer_offset));
+	return write_all(callback, userdata, parser->array_text, header[SAVED_ARRAY_TEXT]);
+}
+
+/** json_parser_restore checks data is a saved parser state and puts the parser in it */
+int json_parser_restore(json_parser *parser, const void *data, size_t size)
+{
+	const char *p = data;
+	uint32_t header[SAVED_HEADER_COUNT], checksum, i;
+	uint64_t values_size;
+	int ret;
+
+	if (size < sizeof(header))
+		return JSON_ERROR_SNAPSHOT;
+	memcpy(header, p, sizeof(header));
+	p += sizeof(header);
+	if (header[SAVED_MAGIC] != PARSER_STATE_MAGIC || header[SAVED_VERSION] != PARSER_STATE_VERSION
+	    || header[SAVED_STATE] >= NR_STATES || header[SAVED_SAVE_STATE] >= NR_STATES
+	    || header[SAVED_EXPECTING_KEY] > 1 || header[SAVED_UTF8_LEFT] > 5
+	    || header[SAVED_BASE64] > 1 || header[SAVED_UNICODE_MULTI] > 0xffff
+	    || header[SAVED_TYPE] > JSON_BSTRING || header[SAVED_PENDING_EVENT] > JSON_OBJECT_END
+	    || header[SAVED_SKIP_VALUE] > 1 || header[SAVED_PARTIAL] > 1
+	    || header[SAVED_ARRAY_DEPTH] > header[SAVED_STACK]
+	    || (header[SAVED_ARRAY_DEPTH] && header[SAVED_ARRAY_TYPE] != JSON_INT
+	        && header[SAVED_ARRAY_TYPE] != JSON_FLOAT)
+	    || (!header[SAVED_ARRAY_DEPTH] && (header[SAVED_ARRAY_COUNT] || header[SAVED_ARRAY_TEXT])))
+		return JSON_ERROR_SNAPSHOT;
+	values_size = (uint64_t) header[SAVED_ARRAY_COUNT] * sizeof(union array_value);
+	if ((uint64_t) size != sizeof(header) + values_size + header[SAVED_STACK]
+	                      + header[SAVED_BUFFER] + header[SAVED_ARRAY_TEXT])
+		return JSON_ERROR_SNAPSHOT;
+	checksum = header[SAVED_CHECKSUM];
+	header[SAVED_CHECKSUM] = 0;
+	if (hash_update(hash_update(2166136261u, (const char *) header, sizeof(header)),
+	                p, size - sizeof(header)) != checksum)
+		return JSON_ERROR_SNAPSHOT;
+	for (i = 0; i < header[SAVED_STACK]; i++)
+		if ((uint8_t) p[values_size + i] > MODE_OBJECT)
+			return JSON_ERROR_SNAPSHOT;
+	if (header[SAVED_ARRAY_DEPTH] && !parser->array_callback)
+		return JSON_ERROR_SNAPSHOT;
+	if (parser->batch_events_count > 0)
+		return JSON_ERROR_SNAPSHOT;
+
+	/* make room within the limits of this parser */
+	while (parser->stack_size < header[SAVED_STACK])
+		CHK(state_grow(parser));
+	while (parser->buffer_size <= header[SAVED_BUFFER])
+		CHK(buffer_grow(parser));
+	if (parser->array_size < header[SAVED_ARRAY_COUNT]) {
+		void *values = parser_realloc(parser, parser->array_values, values_size);
+		if (!values)
+			return JSON_ERROR_NO_MEMORY;
+		parser->array_values = values;
+		parser->array_size = header[SAVED_ARRAY_COUNT];
+	}
+	if (parser->array_text_size < header[SAVED_ARRAY_TEXT]) {
+		char *text = parser_realloc(parser, parser->array_text, header[SAVED_ARRAY_TEXT]);
+		if (!text)
+			return JSON_ERROR_NO_MEMORY;
+		parser->array_text = text;
+		parser->array_text_size = header[SAVED_ARRAY_TEXT];
+	}
+
+	parser->state = header[SAVED_STATE];
+	parser->save_state = header[SAVED_SAVE_STATE];
+	parser->expecting_key = header[SAVED_EXPECTING_KEY];
+	parser->utf8_multibyte_left = header[SAVED_UTF8_LEFT];
+	parser->base64_value = header[SAVED_BASE64];
+	parser->unicode_multi = header[SAVED_UNICODE_MULTI];
+	parser->type = header[SAVED_TYPE];
+	parser->pending_event = header[SAVED_PENDING_EVENT];
+	parser->suspended = 0;
+	parser->key_id = (int32_t) header[SAVED_KEY_ID];
+	parser->skip_nesting = header[SAVED_SKIP_NESTING];
+	parser->skip_value = header[SAVED_SKIP_VALUE];
+	parser->array_depth = header[SAVED_ARRAY_DEPTH];
+	parser->array_type = header[SAVED_ARRAY_TYPE];
+	parser->array_count = header[SAVED_ARRAY_COUNT];
+	parser->array_text_offset = header[SAVED_ARRAY_TEXT];
+	parser->partial = header[SAVED_PARTIAL];
+
+	if (values_size > 0)
+		memcpy(parser->array_values, p, values_size);
+	p += values_size;
+	parser->stack_offset = header[SAVED_STACK];
+	memcpy(parser->stack, p, parser->stack_offset);
+	p += parser->stack_offset;
+	parser->buffer_offset = header[SAVED_BUFFER];
+	memcpy(parser->buffer, p, parser->buffer_offset);
+	p += parser->buffer_offset;
+	if (parser->array_text_offset > 0)
+		memcpy(parser->array_text, p, parser->array_text_offset);
 	return 0;
 }
 
 /** json_parser_is_done return 0 is the parser isn't in a finish state. !0 if it is */
 int json_parser_is_done(json_parser *parser)
 {
-	/* need to compare the state to !GO to not accept empty document */
-	return parser->stack_offset == 0 && parser->state != STATE_GO;
+	/* done when back to OK out of any structure, maybe in a comment following
+	 * the value. this doesn't accept an empty document or value */
+	int state = (parser->state >= STATE_C1 && parser->state <= STATE_Y1) ? parser->save_state : parser->state;
+	return parser->stack_offset == 0 && state == STATE_OK && parser->pending_event == JSON_NONE;
+}
+
+/* give back the memory of a buffer grown by a long value, once what's left
+ * in it fits in the initial size. in batch mode, only the data area owned
+ * by the parser is shrunk, when no event refers to it */
+static void buffer_shrink(json_parser *parser)
+{
+	uint32_t size = buffer_initial_size(parser);
+	char *ptr;
+
+	if (parser->buffer_offset >= size)
+		return;
+	if (!parser->batch_events) {
+		if (parser->buffer_size <= size)
+			return;
+		ptr = parser_realloc(parser, parser->buffer, size * sizeof(char));
+		if (!ptr)
+			return;
+		budget_give(parser, parser->buffer_size - size);
+		parser->buffer = ptr;
+		parser->buffer_size = size;
+		return;
+	}
+	if (!parser->batch_data_owned || parser->batch_data_size <= size
+	    || parser->batch_events_count > 0 || parser->buffer != parser->batch_data)
+		return;
+	ptr = parser_realloc(parser, parser->batch_data, size * sizeof(char));
+	if (!ptr)
+		return;
+	budget_give(parser, parser->batch_data_size - size);
+	parser->batch_data = parser->buffer = ptr;
+	parser->batch_data_size = size;
+	parser->buffer_size = batch_room(parser);
 }
 
 /** json_parser_string append a string s with a specific length to the parser
@@ -733,11 +2217,21 @@ int json_parser_string(json_parser *parser, const char *s,
 	int ret;
 	int next_class, next_state;
 	int buffer_policy;
-	uint32_t i;
+	int minify = (parser->minify_callback != NULL);
+	uint32_t i, kept = 0;
 
+	/* deliver the event held back by a suspension first */
 	ret = 0;
+	if (parser->pending_event != JSON_NONE) {
+		int type = parser->pending_event;
+		parser->pending_event = JSON_NONE;
+		ret = emit(parser, type);
+		if (ret || parser->suspended)
+			length = 0;
+	}
 	for (i = 0; i < length; i++) {
 		unsigned char ch = s[i];
+		uint8_t utf8_left = parser->utf8_multibyte_left;
 
 		ret = 0;
 		if (parser->utf8_multibyte_left > 0) {
@@ -769,26 +2263,83 @@ int json_parser_string(json_parser *parser, const char *s,
 			break;
 		}
 
+		/* output everything kept so far when dropping a character */
+		if (minify && minify_drops(parser->state, next_class, next_state)) {
+			if (kept < i) {
+				ret = minify_output(parser, s + kept, i - kept);
+				if (ret)
+					break;
+			}
+			kept = i + 1;
+		}
+
 		/* add char to buffer */
 		if (buffer_policy) {
 			ret = (buffer_policy == 2)
 				? buffer_push_escape(parser, ch)
 				: buffer_push(parser, ch);
-			if (ret)
+			if (ret) {
+				/* the character can be given again once the budget allows */
+				if (ret == JSON_ERROR_BUDGET)
+					parser->utf8_multibyte_left = utf8_left;
 				break;
+			}
 		}
 
 		/* move to the next level */
-		if (IS_STATE_ACTION(next_state))
+		if (IS_STATE_ACTION(next_state)) {
 			ret = do_action(parser, next_state);
-		else
+			if (ret)
+				break;
+			next_state = parser->state;
+		} else
 			parser->state = next_state;
-		if (ret)
+
+		if (parser->suspended) {
+			i++;
 			break;
+		}
+
+		/* fast path: process the following characters that keep the parser
+		 * in the same state in bulk */
+		if (has_state_run[next_state] && parser->utf8_multibyte_left == 0 && i + 1 < length) {
+			uint32_t run = state_run(parser, next_state, s + i + 1, length - i - 1);
+
+			/* whitespace and comments runs are dropped by the minify output */
+			if (minify && run > 0 && next_state != STATE__S) {
+				if (kept < i + 1) {
+					ret = minify_output(parser, s + kept, i + 1 - kept);
+					if (ret) {
+						i++;
+						break;
+					}
+				}
+				kept = i + 1 + run;
+			}
+			i += run;
+		}
+	}
+	if (minify && kept < i && !ret)
+		ret = minify_output(parser, s + kept, i - kept);
+	/* an error in a captured array ends it: its beginning and the numbers read
+	 * so far come before the error, as they would without arrays. the budget
+	 * error leaves the parser able to continue, so the array is kept */
+	if (ret && ret != JSON_ERROR_BUDGET && parser->array_depth) {
+		parser->buffer_offset = 0;
+		array_fallback(parser, 0);
 	}
+	/* deliver the events of this input, including the ones before an error.
+	 * after a suspension, the rest of the events wait for the next call */
+	if (parser->batch_events_count > 0 && !parser->suspended) {
+		int batch_ret = batch_flush(parser);
+		if (!ret)
+			ret = batch_ret;
+	}
+	if (parser->config.shrink_buffer)
+		buffer_shrink(parser);
 	if (processed)
 		*processed = i;
-	return ret;
+	return suspend_return(parser, ret);
 }
 
 /** json_parser_char append one single char to the parser
@@ -798,6 +2349,176 @@ int json_parser_char(json_parser *parser, unsigned char ch)
 	return json_parser_string(parser, (char *) &ch, 1, NULL);
 }
 
+/** json_parser_reset makes the parser ready for a new document, keeping its
+ * memory, callbacks and modes */
+int json_parser_reset(json_parser *parser)
+{
+	parser->state = STATE_GO;
+	parser->save_state = 0;
+	parser->expecting_key = 0;
+	parser->utf8_multibyte_left = 0;
+	parser->base64_value = 0;
+	parser->suspended = 0;
+	parser->pending_event = JSON_NONE;
+	parser->partial = 0;
+	parser->unicode_multi = 0;
+	parser->type = JSON_NONE;
+	parser->stack_offset = 0;
+	parser->buffer_offset = 0;
+	parser->key_id = JSON_KEY_UNKNOWN;
+	parser->skip_nesting = 0;
+	parser->skip_value = 0;
+	parser->array_depth = 0;
+	parser->array_count = 0;
+	parser->array_text_offset = 0;
+	if (parser->batch_events) {
+		parser->batch_events_count = 0;
+		parser->buffer = parser->batch_data;
+		parser->buffer_size = batch_room(parser);
+	}
+	if (parser->config.shrink_buffer)
+		buffer_shrink(parser);
+	return 0;
+}
+
+int json_parser_documents(json_parser *parser, const json_document *documents,
+                          uint32_t count, int *status)
+{
+	int ret, failed = 0;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		json_parser_reset(parser);
+		parser->document = i;
+		ret = json_parser_string(parser, documents[i].data, documents[i].length, NULL);
+		if (!ret && !json_parser_is_done(parser))
+			ret = JSON_ERROR_INCOMPLETE;
+		if (status)
+			status[i] = ret;
+		if (ret)
+			failed++;
+	}
+	return failed;
+}
+
+uint32_t json_parser_document(json_parser *parser)
+{
+	return parser->document;
+}
+
+/* back to the parse buffer and the parser callback, as after json_parser_init.
+ * a data area owned by the parser becomes its parse buffer */
+static int parser_leave_modes(json_parser *parser)
+{
+	char *buffer = parser->batch_data;
+	uint32_t size = parser->batch_data_size;
+
+	parser->minify_callback = NULL;
+	parser->array_match = NULL;
+	if (!parser->batch_events)
+		return 0;
+	if (!parser->batch_data_owned) {
+		size = buffer_initial_size(parser);
+		if (budget_take(parser, size))
+			return JSON_ERROR_BUDGET;
+		buffer = parser_calloc(parser, size, sizeof(char));
+		if (!buffer) {
+			budget_give(parser, size);
+			return JSON_ERROR_NO_MEMORY;
+		}
+	}
+	parser->buffer = buffer;
+	parser->buffer_size = size;
+	parser->batch_events = NULL;
+	parser->batch_events_size = 0;
+	parser->batch_data = NULL;
+	parser->batch_data_size = 0;
+	parser->batch_data_owned = 0;
+	return 0;
+}
+
+#define pool_calloc(pool, n, s) allocator_calloc(pool->config.allocator, pool->config.user_calloc, n, s)
+#define pool_free(pool, p) allocator_free(pool->config.allocator, p)
+
+/** json_parser_pool_init initializes a pool keeping up to size parsers */
+int json_parser_pool_init(json_parser_pool *pool, const json_config *config, uint32_t size)
+{
+	memset(pool, 0, sizeof(*pool));
+	if (config)
+		memcpy(&pool->config, config, sizeof(json_config));
+	pool->slots = pool_calloc(pool, size, sizeof(*pool->slots));
+	if (!pool->slots)
+		return JSON_ERROR_NO_MEMORY;
+	pool->size = size;
+	return 0;
+}
+
+/** json_parser_pool_get takes a parser from a slot of the pool, or makes a new
+ * one when all the slots are empty */
+int json_parser_pool_get(json_parser_pool *pool, json_parser **parser,
+                         json_parser_callback callback, void *userdata)
+{
+	json_parser *p;
+	uint32_t i;
+	int ret;
+
+	for (i = 0; i < pool->size; i++) {
+		p = slot_exchange(&pool->slots[i], NULL);
+		if (p) {
+			p->callback = callback;
+			p->userdata = userdata;
+			*parser = p;
+			return 0;
+		}
+	}
+	p = pool_calloc(pool, 1, sizeof(*p));
+	if (!p)
+		return JSON_ERROR_NO_MEMORY;
+	ret = json_parser_init(p, &pool->config, callback, userdata);
+	if (ret) {
+		pool_free(pool, p);
+		return ret;
+	}
+	*parser = p;
+	return 0;
+}
+
+/** json_parser_pool_put resets the parser and puts it in an empty slot, or
+ * frees it when there's none */
+int json_parser_pool_put(json_parser_pool *pool, json_parser *parser)
+{
+	uint32_t i;
+
+	json_parser_reset(parser);
+	if (parser_leave_modes(parser) == 0) {
+		for (i = 0; i < pool->size; i++) {
+			json_parser *empty = NULL;
+			if (slot_cas(&pool->slots[i], empty, parser))
+				return 0;
+		}
+	}
+	json_parser_free(parser);
+	pool_free(pool, parser);
+	return 0;
+}
+
+/** json_parser_pool_free frees the parsers in the pool and the pool */
+int json_parser_pool_free(json_parser_pool *pool)
+{
+	uint32_t i;
+
+	for (i = 0; i < pool->size; i++) {
+		if (pool->slots[i]) {
+			json_parser_free(pool->slots[i]);
+			pool_free(pool, pool->slots[i]);
+		}
+	}
+	pool_free(pool, pool->slots);
+	pool->slots = NULL;
+	pool->size = 0;
+	return 0;
+}
+
 /** json_print_init initialize a printer context. always succeed */
 int json_print_init(json_printer *printer, json_printer_callback callback, void *userdata)
 {
@@ -855,6 +2576,20 @@ static int print_binary_string(json_printer *printer, const char *data, uint32_t
 	return 0;
 }
 
+static int print_base64_string(json_printer *printer, const char *data, uint32_t length)
+{
+	char out[4096];
+	uint32_t i, n;
+
+	printer->callback(printer->userdata, "\"", 1);
+	for (i = 0; i < length; i += n) {
+		n = (length - i > 3072) ? 3072 : length - i;
+		printer->callback(printer->userdata, out,
+		                  base64_encode(out, (const unsigned char *) data + i, n));
+	}
+	printer->callback(printer->userdata, "\"", 1);
+	return 0;
+}
 
 static int print_indent(json_printer *printer)
 {
@@ -869,6 +2604,10 @@ static int json_print_mode(json_printer *printer, int type, const char *data, ui
 {
 	int enterobj = printer->enter_object;
 
+	/* the printer can't tell a piece of a string from a piece of a number */
+	if (type == JSON_PARTIAL)
+		return JSON_ERROR_PARTIAL;
+
 	if (!enterobj && !printer->afterkey && (type != JSON_ARRAY_END && type != JSON_OBJECT_END)) {
 		printer->callback(printer->userdata, ",", 1);
 		if (pretty) print_indent(printer);
@@ -912,7 +2651,10 @@ static int json_print_mode(json_printer *printer, int type, const char *data, ui
 		print_string(printer, data, length);
 		break;
 	case JSON_BSTRING:
-		print_binary_string(printer, data, length);
+		if (printer->base64)
+			print_base64_string(printer, data, length);
+		else
+			print_binary_string(printer, data, length);
 		break;
 	default:
 		break;
@@ -933,53 +2675,338 @@ int json_print_raw(json_printer *printer, int type, const char *data, uint32_t l
 	return json_print_mode(printer, type, data, length, 0);
 }
 
-/** json_print_args takes multiple types and pass them to the printer function */
-int json_print_args(json_printer *printer,
-                    int (*f)(json_printer *, int, const char *, uint32_t),
-                    ...)
-{
-	va_list ap;
-	char *data;
+#define PRINT_CHUNK_SIZE 4096
+
+/* output of the array printers, given to the printer callback in chunks */
+struct print_chunk {
+	json_printer *printer;
 	uint32_t length;
-	int type, ret;
+	char data[PRINT_CHUNK_SIZE];
+};
 
-	ret = 0;
-	va_start(ap, f);
-	while ((type = va_arg(ap, int)) != -1) {
-		switch (type) {
-		case JSON_ARRAY_BEGIN:
-		case JSON_ARRAY_END:
-		case JSON_OBJECT_BEGIN:
-		case JSON_OBJECT_END:
-		case JSON_NULL:
-		case JSON_TRUE:
-		case JSON_FALSE:
-			ret = (*f)(printer, type, NULL, 0);
-			break;
-		case JSON_INT:
-		case JSON_FLOAT:
-		case JSON_KEY:
-		case JSON_STRING:
-			data = va_arg(ap, char *);
-			length = va_arg(ap, uint32_t);
-			if (length == -1)
-				length = strlen(data);
-			ret = (*f)(printer, type, data, length);
-			break;
-		}
-		if (ret)
-			break;
-	}
-	va_end(ap);
-	return ret;
+static int chunk_flush(struct print_chunk *chunk)
+{
+	uint32_t length = chunk->length;
+
+	chunk->length = 0;
+	if (length > 0)
+		return chunk->printer->callback(chunk->printer->userdata, chunk->data, length);
+	return 0;
 }
 
-static int dom_push(struct json_parser_dom *ctx, void *val)
+static inline int chunk_append(struct print_chunk *chunk, const char *s, uint32_t length)
 {
-	if (ctx->stack_offset == ctx->stack_size) {
-		void *ptr;
+	int ret;
+
+	if (chunk->length + length > PRINT_CHUNK_SIZE) {
+		CHK(chunk_flush(chunk));
+		if (length > PRINT_CHUNK_SIZE)
+			return chunk->printer->callback(chunk->printer->userdata, s, length);
+	}
+	memcpy(chunk->data + chunk->length, s, length);
+	chunk->length += length;
+	return 0;
+}
+
+/* output what json_print_mode outputs before an array element */
+static int chunk_separator(struct print_chunk *chunk, uint32_t index, int pretty)
+{
+	int i, ret;
+
+	if (index > 0)
+		CHK(chunk_append(chunk, ",", 1));
+	if (pretty) {
+		uint32_t indentlength = strlen(chunk->printer->indentstr);
+		CHK(chunk_append(chunk, "\n", 1));
+		for (i = 0; i < chunk->printer->indentlevel; i++)
+			CHK(chunk_append(chunk, chunk->printer->indentstr, indentlength));
+	}
+	return 0;
+}
+
+/* the same escaping as print_string, with the plain characters in runs */
+static int chunk_string(struct print_chunk *chunk, const char *data, uint32_t length)
+{
+	uint32_t i, start;
+	int ret;
+
+	CHK(chunk_append(chunk, "\"", 1));
+	for (i = 0; i < length; ) {
+		unsigned char c;
+		for (start = i; i < length; i++) {
+			c = data[i];
+			if (c < 0x20 || c == '"' || c == '\\')
+				break;
+		}
+		CHK(chunk_append(chunk, data + start, i - start));
+		if (i < length) {
+			const char *esc = character_escape[(unsigned char) data[i++]];
+			CHK(chunk_append(chunk, esc, strlen(esc)));
+		}
+	}
+	return chunk_append(chunk, "\"", 1);
+}
+
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/* format u in b, which needs 20 characters. return the length */
+static uint32_t format_uint64(char *b, uint64_t u)
+{
+	char tmp[20];
+	uint32_t i = 20;
+
+	while (u >= 100) {
+		uint32_t pair = (uint32_t) (u % 100) * 2;
+		u /= 100;
+		tmp[--i] = digit_pairs[pair + 1];
+		tmp[--i] = digit_pairs[pair];
+	}
+	if (u >= 10) {
+		tmp[--i] = digit_pairs[u * 2 + 1];
+		tmp[--i] = digit_pairs[u * 2];
+	} else
+		tmp[--i] = '0' + (char) u;
+	memcpy(b, tmp + i, 20 - i);
+	return 20 - i;
+}
+
+/* format v in b, which needs 20 characters. return the length */
+static uint32_t format_int64(char *b, int64_t v)
+{
+	if (v < 0) {
+		b[0] = '-';
+		return 1 + format_uint64(b + 1, 0 - (uint64_t) v);
+	}
+	return format_uint64(b, (uint64_t) v);
+}
+
+/* format d in b, which needs 32 characters, with the fewest digits that
+ * read back as the same double. return the length.
+ * JSON has no representation for NaN and infinities: they become null. */
+static uint32_t format_double(char *b, double d)
+{
+	int precision, length = 0;
+
+	if (d != d || d - d != 0) {
+		memcpy(b, "null", 4);
+		return 4;
+	}
+	if (d >= -9007199254740992.0 && d <= 9007199254740992.0 && d == (double) (int64_t) d && (d != 0 || 1 / d > 0))
+		return format_int64(b, (int64_t) d);
+	/* a few decimals: d is m / 10^k with m exactly representable, and the
+	 * division being correctly rounded, the decimal m.10^-k reads back as d */
+	if (d != 0 && d > -9007199254740992.0 && d < 9007199254740992.0) {
+		for (precision = 1; precision <= 9; precision++) {
+			double x = d * exact_powers_of_ten[precision];
+			int64_t m;
+			char digits[20];
+			uint32_t ndigits;
+
+			if (x <= -9007199254740992.0 || x >= 9007199254740992.0)
+				break;
+			m = (int64_t) ((x < 0) ? x - 0.5 : x + 0.5);
+			if ((double) m / exact_powers_of_ten[precision] != d)
+				continue;
+			if (m < 0) {
+				b[length++] = '-';
+				m = -m;
+			}
+			ndigits = format_int64(digits, m);
+			if (ndigits <= (uint32_t) precision) {
+				b[length++] = '0';
+				b[length++] = '.';
+				memset(b + length, '0', precision - ndigits);
+				length += precision - ndigits;
+				memcpy(b + length, digits, ndigits);
+				return length + ndigits;
+			}
+			memcpy(b + length, digits, ndigits - precision);
+			length += ndigits - precision;
+			b[length++] = '.';
+			memcpy(b + length, digits + ndigits - precision, precision);
+			return length + precision;
+		}
+	}
+	/* 15 digits read back for most doubles, the others need 16 or 17. the
+	 * ones that do with 15 may need less: a read back with some digits holds
+	 * with more, so the fewest are found by a binary search */
+	length = snprintf(b, 32, "%.15g", d);
+	if (strtod(b, NULL) == d) {
+		int low = 1, high = 15;
+		char t[32];
+
+		while (low < high) {
+			int middle = (low + high) / 2;
+			int n = snprintf(t, 32, "%.*g", middle, d);
+			if (strtod(t, NULL) == d) {
+				memcpy(b, t, n);
+				length = n;
+				high = middle;
+			} else
+				low = middle + 1;
+		}
+		return length;
+	}
+	length = snprintf(b, 32, "%.16g", d);
+	if (strtod(b, NULL) != d)
+		length = snprintf(b, 32, "%.17g", d);
+	return length;
+}
+
+static int print_array_end(json_printer *printer,
+                           int (*f)(json_printer *, int, const char *, uint32_t),
+                           uint32_t count)
+{
+	/* leave the printer as if the elements were printed one by one */
+	if (count > 0) {
+		printer->enter_object = 0;
+		printer->afterkey = 0;
+	}
+	return (*f)(printer, JSON_ARRAY_END, NULL, 0);
+}
+
+/** json_print_int64_array prints an array of integers at once */
+int json_print_int64_array(json_printer *printer,
+                           int (*f)(json_printer *, int, const char *, uint32_t),
+                           const int64_t *values, uint32_t count)
+{
+	struct print_chunk chunk;
+	char b[32];
+	uint32_t i;
+	int ret, pretty = (f == json_print_pretty);
+
+	if (f != json_print_pretty && f != json_print_raw) {
+		CHK((*f)(printer, JSON_ARRAY_BEGIN, NULL, 0));
+		for (i = 0; i < count; i++)
+			CHK((*f)(printer, JSON_INT, b, format_int64(b, values[i])));
+		return (*f)(printer, JSON_ARRAY_END, NULL, 0);
+	}
+
+	CHK((*f)(printer, JSON_ARRAY_BEGIN, NULL, 0));
+	chunk.printer = printer;
+	chunk.length = 0;
+	for (i = 0; i < count; i++) {
+		CHK(chunk_separator(&chunk, i, pretty));
+		CHK(chunk_append(&chunk, b, format_int64(b, values[i])));
+	}
+	CHK(chunk_flush(&chunk));
+	return print_array_end(printer, f, count);
+}
+
+/** json_print_double_array prints an array of doubles at once */
+int json_print_double_array(json_printer *printer,
+                            int (*f)(json_printer *, int, const char *, uint32_t),
+                            const double *values, uint32_t count)
+{
+	struct print_chunk chunk;
+	char b[32];
+	uint32_t i;
+	int ret, pretty = (f == json_print_pretty);
+
+	if (f != json_print_pretty && f != json_print_raw) {
+		CHK((*f)(printer, JSON_ARRAY_BEGIN, NULL, 0));
+		for (i = 0; i < count; i++) {
+			uint32_t length = format_double(b, values[i]);
+			CHK((*f)(printer, (b[0] == 'n') ? JSON_NULL : JSON_FLOAT, b, length));
+		}
+		return (*f)(printer, JSON_ARRAY_END, NULL, 0);
+	}
+
+	CHK((*f)(printer, JSON_ARRAY_BEGIN, NULL, 0));
+	chunk.printer = printer;
+	chunk.length = 0;
+	for (i = 0; i < count; i++) {
+		CHK(chunk_separator(&chunk, i, pretty));
+		CHK(chunk_append(&chunk, b, format_double(b, values[i])));
+	}
+	CHK(chunk_flush(&chunk));
+	return print_array_end(printer, f, count);
+}
+
+/** json_print_string_array prints an array of strings at once */
+int json_print_string_array(json_printer *printer,
+                            int (*f)(json_printer *, int, const char *, uint32_t),
+                            const char * const *strings, const uint32_t *lengths, uint32_t count)
+{
+	struct print_chunk chunk;
+	uint32_t i;
+	int ret, pretty = (f == json_print_pretty);
+
+	if (f != json_print_pretty && f != json_print_raw) {
+		CHK((*f)(printer, JSON_ARRAY_BEGIN, NULL, 0));
+		for (i = 0; i < count; i++) {
+			if (!strings[i])
+				CHK((*f)(printer, JSON_NULL, NULL, 0));
+			else
+				CHK((*f)(printer, JSON_STRING, strings[i], (lengths) ? lengths[i] : strlen(strings[i])));
+		}
+		return (*f)(printer, JSON_ARRAY_END, NULL, 0);
+	}
+
+	CHK((*f)(printer, JSON_ARRAY_BEGIN, NULL, 0));
+	chunk.printer = printer;
+	chunk.length = 0;
+	for (i = 0; i < count; i++) {
+		CHK(chunk_separator(&chunk, i, pretty));
+		if (!strings[i])
+			CHK(chunk_append(&chunk, "null", 4));
+		else
+			CHK(chunk_string(&chunk, strings[i], (lengths) ? lengths[i] : strlen(strings[i])));
+	}
+	CHK(chunk_flush(&chunk));
+	return print_array_end(printer, f, count);
+}
+
+/** json_print_args takes multiple types and pass them to the printer function */
+int json_print_args(json_printer *printer,
+                    int (*f)(json_printer *, int, const char *, uint32_t),
+                    ...)
+{
+	va_list ap;
+	char *data;
+	uint32_t length;
+	int type, ret;
+
+	ret = 0;
+	va_start(ap, f);
+	while ((type = va_arg(ap, int)) != -1) {
+		switch (type) {
+		case JSON_ARRAY_BEGIN:
+		case JSON_ARRAY_END:
+		case JSON_OBJECT_BEGIN:
+		case JSON_OBJECT_END:
+		case JSON_NULL:
+		case JSON_TRUE:
+		case JSON_FALSE:
+			ret = (*f)(printer, type, NULL, 0);
+			break;
+		case JSON_INT:
+		case JSON_FLOAT:
+		case JSON_KEY:
+		case JSON_STRING:
+			data = va_arg(ap, char *);
+			length = va_arg(ap, uint32_t);
+			if (length == -1)
+				length = strlen(data);
+			ret = (*f)(printer, type, data, length);
+			break;
+		}
+		if (ret)
+			break;
+	}
+	va_end(ap);
+	return ret;
+}
+
+static int dom_push(struct json_parser_dom *ctx, void *val)
+{
+	if (ctx->stack_offset == ctx->stack_size) {
+		void *ptr;
 		uint32_t newsize = ctx->stack_size * 2;
-		ptr = memory_realloc(ctx->user_realloc, ctx->stack, newsize * sizeof(*(ctx->stack)));
+		ptr = dom_realloc(ctx, ctx->stack, newsize * sizeof(*(ctx->stack)));
 		if (!ptr)
 			return JSON_ERROR_NO_MEMORY;
 		ctx->stack = ptr;
@@ -1007,7 +3034,7 @@ int json_parser_dom_init(json_parser_dom *dom,
 	memset(dom, 0, sizeof(*dom));
 	dom->stack_size = 1024;
 	dom->stack_offset = 0;
-	dom->stack = memory_calloc(dom->user_calloc, dom->stack_size, sizeof(*(dom->stack)));
+	dom->stack = dom_calloc(dom, dom->stack_size, sizeof(*(dom->stack)));
 	if (!dom->stack)
 		return JSON_ERROR_NO_MEMORY;
 	dom->append = append;
@@ -1016,17 +3043,141 @@ int json_parser_dom_init(json_parser_dom *dom,
 	return 0;
 }
 
+/** json_parser_dom_intern makes the DOM helper keep one copy of each key, and of
+ * each string up to max_string_length */
+int json_parser_dom_intern(json_parser_dom *dom, uint32_t max_string_length)
+{
+	dom->intern = 1;
+	dom->intern_max_length = max_string_length;
+	return 0;
+}
+
+/** json_parser_dom_allocator makes the DOM helper use allocator for all its memory.
+ * the stack allocated by json_parser_dom_init moves to it */
+int json_parser_dom_allocator(json_parser_dom *dom, const json_allocator *allocator)
+{
+	void *stack = allocator->calloc(allocator->ctx, dom->stack_size, sizeof(*(dom->stack)));
+
+	if (!stack)
+		return JSON_ERROR_NO_MEMORY;
+	memcpy(stack, dom->stack, dom->stack_offset * sizeof(*(dom->stack)));
+	dom_free(dom, dom->stack);
+	dom->stack = stack;
+	dom->allocator = allocator;
+	return 0;
+}
+
+/** json_parser_dom_reset makes the DOM helper ready for a new document */
+int json_parser_dom_reset(json_parser_dom *dom)
+{
+	uint32_t i;
+
+	for (i = 0; !dom->intern && i < dom->stack_offset; i++)
+		dom_free(dom, dom->stack[i].key);
+	dom->stack_offset = 0;
+	dom->root_structure = NULL;
+	dom->partial.length = 0;
+	return 0;
+}
+
 int json_parser_dom_free(json_parser_dom *dom)
 {
-	free(dom->stack);
+	struct json_parser_dom_block *block, *next;
+	uint32_t i;
+
+	/* keys waiting for their value when the parsing stopped */
+	for (i = 0; !dom->intern && i < dom->stack_offset; i++)
+		dom_free(dom, dom->stack[i].key);
+	for (block = dom->intern_blocks; block; block = next) {
+		next = block->next;
+		dom_free(dom, block);
+	}
+	dom_free(dom, dom->intern_table);
+	dom_free(dom, dom->stack);
+	dom_free(dom, dom->partial.data);
 	return 0;
 }
 
+#define DOM_INTERN_BLOCK_SIZE 65536
+
+/* copy a string in the intern blocks, where it stays until the context is freed.
+ * long strings get a block of their own, behind the current one */
+static char *dom_intern_copy(struct json_parser_dom *ctx, const char *data, uint32_t length)
+{
+	struct json_parser_dom_block *block = ctx->intern_blocks;
+	char *copy;
+
+	if (!block || block->size - block->offset < length + 1) {
+		uint32_t size = (length + 1 > DOM_INTERN_BLOCK_SIZE / 4) ? length + 1 : DOM_INTERN_BLOCK_SIZE;
+		struct json_parser_dom_block *b = dom_calloc(ctx, 1, sizeof(*b) + size);
+		if (!b)
+			return NULL;
+		b->size = size;
+		if (block && size != DOM_INTERN_BLOCK_SIZE) {
+			b->next = block->next;
+			block->next = b;
+		} else {
+			b->next = block;
+			ctx->intern_blocks = b;
+		}
+		block = b;
+	}
+	copy = (char *) (block + 1) + block->offset;
+	memcpy(copy, data, length);
+	copy[length] = '\0';
+	block->offset += length + 1;
+	return copy;
+}
+
+/* return the shared copy of data, making it the first time */
+static char *dom_intern(struct json_parser_dom *ctx, const char *data, uint32_t length)
+{
+	uint32_t hash = string_hash(data, length), i, mask = ctx->intern_size - 1;
+	struct json_parser_dom_string *str;
+
+	for (i = hash & mask; ctx->intern_size && ctx->intern_table[i].data; i = (i + 1) & mask) {
+		str = &ctx->intern_table[i];
+		if (str->hash == hash && str->length == length && memcmp(str->data, data, length) == 0)
+			return str->data;
+	}
+
+	if ((ctx->intern_count + 1) * 2 > ctx->intern_size) {
+		uint32_t j, size = (ctx->intern_size) ? ctx->intern_size * 2 : 256;
+		struct json_parser_dom_string *table = dom_calloc(ctx, size, sizeof(*table));
+		if (!table)
+			return NULL;
+		for (j = 0; j < ctx->intern_size; j++) {
+			if (!ctx->intern_table[j].data)
+				continue;
+			for (i = ctx->intern_table[j].hash & (size - 1); table[i].data; i = (i + 1) & (size - 1));
+			table[i] = ctx->intern_table[j];
+		}
+		dom_free(ctx, ctx->intern_table);
+		ctx->intern_table = table;
+		ctx->intern_size = size;
+		for (i = hash & (size - 1); table[i].data; i = (i + 1) & (size - 1));
+	}
+
+	str = &ctx->intern_table[i];
+	str->data = dom_intern_copy(ctx, data, length);
+	if (!str->data)
+		return NULL;
+	str->hash = hash;
+	str->length = length;
+	ctx->intern_count++;
+	return str->data;
+}
+
 int json_parser_dom_callback(void *userdata, int type, const char *data, uint32_t length)
 {
 	struct json_parser_dom *ctx = userdata;
 	void *v;
 	struct stack_elem *stack = NULL;
+	int ret;
+
+	if (type == JSON_PARTIAL)
+		return partial_keep(&ctx->partial, ctx->allocator, ctx->user_realloc, data, length);
+	CHK(partial_join(&ctx->partial, ctx->allocator, ctx->user_realloc, &data, &length));
 
 	switch (type) {
 	case JSON_ARRAY_BEGIN:
@@ -1042,32 +3193,2135 @@ int json_parser_dom_callback(void *userdata, int type, const char *data, uint32_
 		if (ctx->stack_offset > 0) {
 			stack = &(ctx->stack[ctx->stack_offset - 1]);
 			ctx->append(stack->val, stack->key, stack->key_length, v);
-			free(stack->key);
+			if (!ctx->intern)
+				dom_free(ctx, stack->key);
+			stack->key = NULL;
 		} else
 			ctx->root_structure = v;
 		break;
 	case JSON_KEY:
 		stack = &(ctx->stack[ctx->stack_offset - 1]);
-		stack->key = memory_calloc(ctx->user_calloc, length + 1, sizeof(char));
 		stack->key_length = length;
+		if (ctx->intern) {
+			stack->key = dom_intern(ctx, data, length);
+			if (!stack->key)
+				return JSON_ERROR_NO_MEMORY;
+			break;
+		}
+		stack->key = dom_calloc(ctx, length + 1, sizeof(char));
 		if (!stack->key)
 			return JSON_ERROR_NO_MEMORY;
 		memcpy(stack->key, data, length);
 		break;
 	case JSON_STRING:
+	case JSON_BSTRING:
 	case JSON_INT:
 	case JSON_FLOAT:
 	case JSON_NULL:
 	case JSON_TRUE:
 	case JSON_FALSE:
-		stack = &(ctx->stack[ctx->stack_offset - 1]);
+		if (type == JSON_STRING && ctx->intern && length <= ctx->intern_max_length) {
+			data = dom_intern(ctx, data, length);
+			if (!data)
+				return JSON_ERROR_NO_MEMORY;
+		}
 		v = ctx->create_data(type, data, length);
 		if (!v)
 			return JSON_ERROR_CALLBACK;
+		/* a value on its own, parsed with json_parser_value, is the root */
+		if (ctx->stack_offset == 0) {
+			ctx->root_structure = v;
+			break;
+		}
+		stack = &(ctx->stack[ctx->stack_offset - 1]);
 		if (ctx->append(stack->val, stack->key, stack->key_length, v))
 			return JSON_ERROR_CALLBACK;
-		free(stack->key);
+		if (!ctx->intern)
+			dom_free(ctx, stack->key);
+		stack->key = NULL;
 		break;
 	}
 	return 0;
 }
+
+/** json_object_init initialize an empty object */
+int json_object_init(json_object *obj, const json_allocator *allocator)
+{
+	memset(obj, 0, sizeof(*obj));
+	obj->allocator = allocator;
+	return 0;
+}
+
+/** json_object_free free the members and the index of the object */
+int json_object_free(json_object *obj)
+{
+	owner_free(obj, obj->members);
+	owner_free(obj, obj->index);
+	return json_object_init(obj, obj->allocator);
+}
+
+/** json_object_append adds a member at the end of the object. the index, if
+ * any, is only updated by the next lookup */
+int json_object_append(json_object *obj, char *key, uint32_t key_length, void *value)
+{
+	json_object_member *m;
+
+	if (obj->count == obj->size) {
+		uint32_t newsize = (obj->size) ? obj->size * 2 : 4;
+		void *ptr;
+
+		if (newsize <= obj->size)
+			return JSON_ERROR_NO_MEMORY;
+		ptr = owner_realloc(obj, obj->members, (size_t) newsize * sizeof(*m));
+		if (!ptr)
+			return JSON_ERROR_NO_MEMORY;
+		obj->members = ptr;
+		obj->size = newsize;
+	}
+	m = &obj->members[obj->count++];
+	m->key = key;
+	m->key_length = key_length;
+	m->value = value;
+	return 0;
+}
+
+/* add the members appended since the last lookup to the index, keeping the
+ * first of duplicated keys */
+static int object_index(json_object *obj)
+{
+	uint32_t mask, i, j;
+
+	if ((uint64_t) obj->count * 2 > obj->index_size) {
+		uint32_t size = (obj->index_size) ? obj->index_size : 64;
+		struct json_object_slot *index;
+
+		while ((uint64_t) obj->count * 2 > size)
+			size *= 2;
+		index = owner_calloc(obj, size, sizeof(*index));
+		if (!index)
+			return JSON_ERROR_NO_MEMORY;
+		for (j = 0; j < obj->index_size; j++) {
+			if (!obj->index[j].member)
+				continue;
+			for (i = obj->index[j].hash & (size - 1); index[i].member; i = (i + 1) & (size - 1));
+			index[i] = obj->index[j];
+		}
+		owner_free(obj, obj->index);
+		obj->index = index;
+		obj->index_size = size;
+	}
+
+	mask = obj->index_size - 1;
+	for (; obj->indexed < obj->count; obj->indexed++) {
+		json_object_member *m = &obj->members[obj->indexed];
+		uint32_t hash = string_hash(m->key, m->key_length);
+
+		for (i = hash & mask; obj->index[i].member; i = (i + 1) & mask) {
+			json_object_member *o = &obj->members[obj->index[i].member - 1];
+			if (obj->index[i].hash == hash && o->key_length == m->key_length
+			    && memcmp(o->key, m->key, m->key_length) == 0)
+				break;
+		}
+		if (!obj->index[i].member) {
+			obj->index[i].hash = hash;
+			obj->index[i].member = obj->indexed + 1;
+		}
+	}
+	return 0;
+}
+
+/** json_object_find returns the first member with key, or NULL */
+json_object_member *json_object_find(json_object *obj, const char *key, uint32_t key_length)
+{
+	uint32_t hash, mask, i;
+
+	/* small objects are faster to scan than to index */
+	if (obj->count < JSON_OBJECT_INDEX_THRESHOLD || (obj->indexed < obj->count && object_index(obj))) {
+		for (i = 0; i < obj->count; i++) {
+			json_object_member *m = &obj->members[i];
+			if (m->key_length == key_length && memcmp(m->key, key, key_length) == 0)
+				return m;
+		}
+		return NULL;
+	}
+
+	hash = string_hash(key, key_length);
+	mask = obj->index_size - 1;
+	for (i = hash & mask; obj->index[i].member; i = (i + 1) & mask) {
+		json_object_member *m = &obj->members[obj->index[i].member - 1];
+		if (obj->index[i].hash == hash && m->key_length == key_length && memcmp(m->key, key, key_length) == 0)
+			return m;
+	}
+	return NULL;
+}
+
+/* record tags besides the json types */
+#define RECORD_KEY_REF      0x10
+#define RECORD_KEY_LITERAL  0x11
+#define RECORD_INT_TEXT     0x12
+
+#define RECORD_BUFFER_SIZE  4096
+#define RECORD_MAX_KEYS     65536
+#define RECORD_MAX_KEY_SIZE 256
+
+static const char record_magic[4] = { '\xff', 'J', 'R', '\x01' };
+
+static int record_flush(json_recorder *rec)
+{
+	int ret = 0;
+
+	if (rec->buffer_offset > 0)
+		ret = (*rec->callback)(rec->userdata, rec->buffer, rec->buffer_offset);
+	rec->buffer_offset = 0;
+	return ret;
+}
+
+static int record_bytes(json_recorder *rec, const char *s, uint32_t length)
+{
+	int ret;
+
+	if (rec->buffer_offset + length > RECORD_BUFFER_SIZE) {
+		CHK(record_flush(rec));
+		if (length > RECORD_BUFFER_SIZE)
+			return (*rec->callback)(rec->userdata, s, length);
+	}
+	memcpy(rec->buffer + rec->buffer_offset, s, length);
+	rec->buffer_offset += length;
+	return 0;
+}
+
+/* append a tag and a varint */
+static int record_tag_varint(json_recorder *rec, int tag, uint64_t v)
+{
+	char b[11];
+	uint32_t n = 0;
+
+	b[n++] = tag;
+	while (v >= 0x80) {
+		b[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	b[n++] = v;
+	return record_bytes(rec, b, n);
+}
+
+/* append a tag, the length of data and data with a terminating zero */
+static int record_tag_data(json_recorder *rec, int tag, const char *data, uint32_t length)
+{
+	int ret;
+
+	CHK(record_tag_varint(rec, tag, length));
+	CHK(record_bytes(rec, data, length));
+	return record_bytes(rec, "", 1);
+}
+
+/* return !0 if data is an integer of 64 bits magnitude, printed in its shortest form;
+ * as in CBOR, the magnitude of a negative integer is given less one */
+static int parse_integer(const char *data, uint32_t length, uint64_t *n, int *neg)
+{
+	uint64_t u = 0;
+	uint32_t i = 0;
+	unsigned int digit;
+
+	*neg = 0;
+	if (length > 0 && data[0] == '-')
+		*neg = i = 1;
+	if (i == length || length - i > 20 || (data[i] == '0' && (length - i > 1 || *neg)))
+		return 0;
+	/* -2^64 is the only magnitude not held by an uint64_t */
+	if (*neg && length == 21 && memcmp(data + 1, "18446744073709551616", 20) == 0) {
+		*n = UINT64_MAX;
+		return 1;
+	}
+	for (; i < length; i++) {
+		if (data[i] < '0' || data[i] > '9')
+			return 0;
+		digit = data[i] - '0';
+		if (u > (UINT64_MAX - digit) / 10)
+			return 0;
+		u = u * 10 + digit;
+	}
+	*n = u - *neg;
+	return 1;
+}
+
+/* return !0 if data is an integer that format_int64 prints back the same */
+static int parse_int64(const char *data, uint32_t length, int64_t *v)
+{
+	uint64_t n;
+	int neg;
+
+	if (!parse_integer(data, length, &n, &neg) || n > INT64_MAX)
+		return 0;
+	*v = (neg) ? -(int64_t) n - 1 : (int64_t) n;
+	return 1;
+}
+
+static int record_keys_grow(json_recorder *rec)
+{
+	struct json_recorder_key *keys;
+	uint32_t i, size = (rec->keys_size) ? rec->keys_size * 2 : 64;
+
+	keys = owner_calloc(rec, size, sizeof(*keys));
+	if (!keys)
+		return JSON_ERROR_NO_MEMORY;
+	for (i = 0; i < rec->keys_size; i++) {
+		struct json_recorder_key *k = &rec->keys[i];
+		uint32_t j;
+		if (!k->key)
+			continue;
+		for (j = k->hash & (size - 1); keys[j].key; j = (j + 1) & (size - 1));
+		keys[j] = *k;
+	}
+	owner_free(rec, rec->keys);
+	rec->keys = keys;
+	rec->keys_size = size;
+	return 0;
+}
+
+static int record_key(json_recorder *rec, const char *data, uint32_t length)
+{
+	struct json_recorder_key *k;
+	uint32_t hash, i;
+	int ret;
+
+	if (length > RECORD_MAX_KEY_SIZE)
+		return record_tag_data(rec, RECORD_KEY_LITERAL, data, length);
+
+	hash = string_hash(data, length);
+	for (i = hash & (rec->keys_size - 1); rec->keys_size && rec->keys[i].key; i = (i + 1) & (rec->keys_size - 1)) {
+		k = &rec->keys[i];
+		if (k->hash == hash && k->length == length && memcmp(k->key, data, length) == 0)
+			return record_tag_varint(rec, RECORD_KEY_REF, k->index);
+	}
+
+	if (rec->keys_count == RECORD_MAX_KEYS)
+		return record_tag_data(rec, RECORD_KEY_LITERAL, data, length);
+	if ((rec->keys_count + 1) * 2 > rec->keys_size) {
+		CHK(record_keys_grow(rec));
+		for (i = hash & (rec->keys_size - 1); rec->keys[i].key; i = (i + 1) & (rec->keys_size - 1));
+	}
+	k = &rec->keys[i];
+	k->key = owner_calloc(rec, length + 1, sizeof(char));
+	if (!k->key)
+		return JSON_ERROR_NO_MEMORY;
+	memcpy(k->key, data, length);
+	k->hash = hash;
+	k->length = length;
+	k->index = rec->keys_count++;
+	return record_tag_data(rec, JSON_KEY, data, length);
+}
+
+/** json_recorder_init initialize a recorder writing to callback */
+int json_recorder_init(json_recorder *rec, json_printer_callback callback, void *userdata,
+                       const json_allocator *allocator)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->callback = callback;
+	rec->userdata = userdata;
+	rec->allocator = allocator;
+	rec->buffer = owner_calloc(rec, RECORD_BUFFER_SIZE, sizeof(char));
+	if (!rec->buffer)
+		return JSON_ERROR_NO_MEMORY;
+	memcpy(rec->buffer, record_magic, sizeof(record_magic));
+	rec->buffer_offset = sizeof(record_magic);
+	return 0;
+}
+
+/** json_recorder_free free memory allocated by the recorder */
+int json_recorder_free(json_recorder *rec)
+{
+	uint32_t i;
+
+	for (i = 0; i < rec->keys_size; i++)
+		owner_free(rec, rec->keys[i].key);
+	owner_free(rec, rec->keys);
+	owner_free(rec, rec->buffer);
+	owner_free(rec, rec->partial.data);
+	return 0;
+}
+
+/** json_recorder_callback records one event */
+int json_recorder_callback(void *userdata, int type, const char *data, uint32_t length)
+{
+	json_recorder *rec = userdata;
+	int64_t v;
+	char tag;
+	int ret;
+
+	if (type == JSON_PARTIAL)
+		return partial_keep(&rec->partial, rec->allocator, NULL, data, length);
+	CHK(partial_join(&rec->partial, rec->allocator, NULL, &data, &length));
+
+	switch (type) {
+	case JSON_ARRAY_BEGIN: case JSON_OBJECT_BEGIN:
+	case JSON_ARRAY_END: case JSON_OBJECT_END:
+	case JSON_TRUE: case JSON_FALSE: case JSON_NULL:
+		tag = type;
+		CHK(record_bytes(rec, &tag, 1));
+		break;
+	case JSON_INT:
+		if (parse_int64(data, length, &v)) {
+			uint64_t zigzag = (v < 0) ? ~((uint64_t) v << 1) : (uint64_t) v << 1;
+			CHK(record_tag_varint(rec, JSON_INT, zigzag));
+		} else
+			CHK(record_tag_data(rec, RECORD_INT_TEXT, data, length));
+		break;
+	case JSON_FLOAT: case JSON_STRING: case JSON_BSTRING:
+		CHK(record_tag_data(rec, type, data, length));
+		break;
+	case JSON_KEY:
+		return record_key(rec, data, length);
+	default:
+		return 0;
+	}
+
+	if (type == JSON_ARRAY_BEGIN || type == JSON_OBJECT_BEGIN)
+		rec->depth++;
+	else if (type == JSON_ARRAY_END || type == JSON_OBJECT_END)
+		rec->depth--;
+	/* a whole value is recorded: hand it to the callback */
+	if (rec->depth == 0)
+		return record_flush(rec);
+	return 0;
+}
+
+/* the replay keeps the interned keys, and checks the events make valid JSON */
+struct replay {
+	const char **keys;
+	uint32_t *keys_length;
+	uint32_t keys_count;
+	uint32_t keys_size;
+	uint8_t *stack;
+	uint32_t stack_offset;
+	uint32_t stack_size;
+	const json_allocator *allocator;
+};
+
+#define REPLAY_ARRAY 0
+#define REPLAY_KEY   1
+#define REPLAY_VALUE 2
+
+static int replay_varint(const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+	const unsigned char *s = *p;
+	uint64_t r = 0;
+	int shift;
+
+	for (shift = 0; shift < 64 && s < end; shift += 7) {
+		r |= (uint64_t) (*s & 0x7f) << shift;
+		if (!(*s++ & 0x80)) {
+			*p = s;
+			*v = r;
+			return 0;
+		}
+	}
+	return JSON_ERROR_RECORD;
+}
+
+/* read the data of a tag: length, data and the terminating zero */
+static int replay_data(const unsigned char **p, const unsigned char *end,
+                       const char **data, uint32_t *length)
+{
+	uint64_t v;
+
+	if (replay_varint(p, end, &v) || v >= (uint64_t) (end - *p) || (*p)[v] != '\0')
+		return JSON_ERROR_RECORD;
+	*data = (const char *) *p;
+	*length = (uint32_t) v;
+	*p += v + 1;
+	return 0;
+}
+
+static int replay_push(struct replay *r, uint8_t mode)
+{
+	if (r->stack_offset == r->stack_size) {
+		uint32_t newsize = (r->stack_size) ? r->stack_size * 2 : 64;
+		uint8_t *ptr = owner_realloc(r, r->stack, newsize);
+		if (!ptr)
+			return JSON_ERROR_NO_MEMORY;
+		r->stack = ptr;
+		r->stack_size = newsize;
+	}
+	r->stack[r->stack_offset++] = mode;
+	return 0;
+}
+
+static int replay_add_key(struct replay *r, const char *data, uint32_t length)
+{
+	if (r->keys_count == RECORD_MAX_KEYS)
+		return JSON_ERROR_RECORD;
+	if (r->keys_count == r->keys_size) {
+		uint32_t newsize = (r->keys_size) ? r->keys_size * 2 : 64;
+		const char **keys = owner_realloc(r, r->keys, newsize * sizeof(*keys));
+		uint32_t *lengths;
+		if (!keys)
+			return JSON_ERROR_NO_MEMORY;
+		r->keys = keys;
+		lengths = owner_realloc(r, r->keys_length, newsize * sizeof(*lengths));
+		if (!lengths)
+			return JSON_ERROR_NO_MEMORY;
+		r->keys_length = lengths;
+		r->keys_size = newsize;
+	}
+	r->keys[r->keys_count] = data;
+	r->keys_length[r->keys_count++] = length;
+	return 0;
+}
+
+static int replay_run(struct replay *r, const unsigned char *p, const unsigned char *end,
+                      json_parser_callback callback, void *userdata)
+{
+	while (p < end) {
+		int tag = *p++;
+		int type = (tag == RECORD_KEY_REF || tag == RECORD_KEY_LITERAL) ? JSON_KEY
+		         : (tag == RECORD_INT_TEXT) ? JSON_INT : tag;
+		uint8_t *mode = (r->stack_offset) ? &r->stack[r->stack_offset - 1] : NULL;
+		const char *data = NULL;
+		uint32_t length = 0;
+		char b[32];
+		uint64_t v;
+		int ret;
+
+		/* keys and values must come where JSON allows them */
+		if (type == JSON_KEY) {
+			if (!mode || *mode != REPLAY_KEY)
+				return JSON_ERROR_RECORD;
+			*mode = REPLAY_VALUE;
+		} else if (type == JSON_OBJECT_END) {
+			if (!mode || *mode != REPLAY_KEY)
+				return JSON_ERROR_RECORD;
+		} else if (type == JSON_ARRAY_END) {
+			if (!mode || *mode != REPLAY_ARRAY)
+				return JSON_ERROR_RECORD;
+		} else if (mode) {
+			if (*mode == REPLAY_KEY)
+				return JSON_ERROR_RECORD;
+			if (*mode == REPLAY_VALUE)
+				*mode = REPLAY_KEY;
+		}
+
+		switch (tag) {
+		case JSON_ARRAY_BEGIN:
+			CHK(replay_push(r, REPLAY_ARRAY));
+			break;
+		case JSON_OBJECT_BEGIN:
+			CHK(replay_push(r, REPLAY_KEY));
+			break;
+		case JSON_ARRAY_END: case JSON_OBJECT_END:
+			r->stack_offset--;
+			break;
+		case JSON_TRUE: case JSON_FALSE: case JSON_NULL:
+			break;
+		case JSON_INT:
+			if (replay_varint(&p, end, &v))
+				return JSON_ERROR_RECORD;
+			data = b;
+			length = format_int64(b, (int64_t) ((v >> 1) ^ (0 - (v & 1))));
+			b[length] = '\0';
+			break;
+		case JSON_KEY:
+			CHK(replay_data(&p, end, &data, &length));
+			CHK(replay_add_key(r, data, length));
+			break;
+		case RECORD_KEY_REF:
+			if (replay_varint(&p, end, &v) || v >= r->keys_count)
+				return JSON_ERROR_RECORD;
+			data = r->keys[v];
+			length = r->keys_length[v];
+			break;
+		case JSON_FLOAT: case JSON_STRING: case JSON_BSTRING:
+		case RECORD_KEY_LITERAL: case RECORD_INT_TEXT:
+			CHK(replay_data(&p, end, &data, &length));
+			break;
+		default:
+			return JSON_ERROR_RECORD;
+		}
+		if (callback)
+			CHK((*callback)(userdata, type, data, length));
+	}
+	return (r->stack_offset == 0) ? 0 : JSON_ERROR_RECORD;
+}
+
+/** json_replay gives the events recorded in data to a parser callback */
+int json_replay(const char *data, size_t length, json_parser_callback callback, void *userdata,
+                const json_allocator *allocator)
+{
+	struct replay r;
+	int ret;
+
+	if (length < sizeof(record_magic) || memcmp(data, record_magic, sizeof(record_magic)))
+		return JSON_ERROR_RECORD;
+	memset(&r, 0, sizeof(r));
+	r.allocator = allocator;
+	ret = replay_run(&r, (const unsigned char *) data + sizeof(record_magic),
+	                 (const unsigned char *) data + length, callback, userdata);
+	owner_free(&r, r.keys);
+	owner_free(&r, r.keys_length);
+	owner_free(&r, r.stack);
+	return ret;
+}
+
+static int encoder_reserve(json_encoder *enc, uint32_t length)
+{
+	uint32_t newsize;
+	char *ptr;
+
+	if (enc->buffer_offset + length <= enc->buffer_size)
+		return 0;
+	if (enc->buffer_offset + length < enc->buffer_offset)
+		return JSON_ERROR_NO_MEMORY;
+	for (newsize = (enc->buffer_size) ? enc->buffer_size : 4096; newsize < enc->buffer_offset + length; newsize *= 2)
+		if (newsize > 0x7fffffff)
+			return JSON_ERROR_NO_MEMORY;
+	ptr = owner_realloc(enc, enc->buffer, newsize);
+	if (!ptr)
+		return JSON_ERROR_NO_MEMORY;
+	enc->buffer = ptr;
+	enc->buffer_size = newsize;
+	return 0;
+}
+
+/* write the head of a CBOR item: major type and argument */
+static uint32_t cbor_head(unsigned char *b, int major, uint64_t n)
+{
+	major <<= 5;
+	if (n < 24) {
+		b[0] = major | n;
+		return 1;
+	} else if (n <= 0xff) {
+		b[0] = major | 24;
+		b[1] = n;
+		return 2;
+	} else if (n <= 0xffff) {
+		b[0] = major | 25;
+		b[1] = n >> 8; b[2] = n;
+		return 3;
+	} else if (n <= 0xffffffff) {
+		b[0] = major | 26;
+		b[1] = n >> 24; b[2] = n >> 16; b[3] = n >> 8; b[4] = n;
+		return 5;
+	}
+	b[0] = major | 27;
+	b[1] = n >> 56; b[2] = n >> 48; b[3] = n >> 40; b[4] = n >> 32;
+	b[5] = n >> 24; b[6] = n >> 16; b[7] = n >> 8; b[8] = n;
+	return 9;
+}
+
+/* write a MessagePack tag followed by n on size bytes */
+static uint32_t msgpack_head(unsigned char *b, int tag, uint64_t n, uint32_t size)
+{
+	uint32_t i;
+
+	b[0] = tag;
+	for (i = 0; i < size; i++)
+		b[1 + i] = n >> (8 * (size - 1 - i));
+	return 1 + size;
+}
+
+/* write the head of a string, of binary data, of an array or of an object */
+static uint32_t encoder_head(json_encoder *enc, unsigned char *b, int type, uint64_t n)
+{
+	if (enc->format == JSON_FORMAT_CBOR) {
+		switch (type) {
+		case JSON_BSTRING: return cbor_head(b, 2, n);
+		case JSON_STRING: return cbor_head(b, 3, n);
+		case JSON_ARRAY_BEGIN: return cbor_head(b, 4, n);
+		default: return cbor_head(b, 5, n);
+		}
+	}
+	switch (type) {
+	case JSON_BSTRING:
+		return (n <= 0xff) ? msgpack_head(b, 0xc4, n, 1)
+		     : (n <= 0xffff) ? msgpack_head(b, 0xc5, n, 2) : msgpack_head(b, 0xc6, n, 4);
+	case JSON_STRING:
+		return (n < 32) ? msgpack_head(b, 0xa0 | n, 0, 0) : (n <= 0xff) ? msgpack_head(b, 0xd9, n, 1)
+		     : (n <= 0xffff) ? msgpack_head(b, 0xda, n, 2) : msgpack_head(b, 0xdb, n, 4);
+	case JSON_ARRAY_BEGIN:
+		return (n < 16) ? msgpack_head(b, 0x90 | n, 0, 0)
+		     : (n <= 0xffff) ? msgpack_head(b, 0xdc, n, 2) : msgpack_head(b, 0xdd, n, 4);
+	default:
+		return (n < 16) ? msgpack_head(b, 0x80 | n, 0, 0)
+		     : (n <= 0xffff) ? msgpack_head(b, 0xde, n, 2) : msgpack_head(b, 0xdf, n, 4);
+	}
+}
+
+/* write an integer given as in parse_integer; MessagePack holds no negative below INT64_MIN */
+static uint32_t encoder_int(json_encoder *enc, unsigned char *b, uint64_t n, int neg)
+{
+	int64_t v;
+
+	if (enc->format == JSON_FORMAT_CBOR)
+		return cbor_head(b, neg, n);
+	if (!neg) {
+		return (n < 128) ? msgpack_head(b, n, 0, 0) : (n <= 0xff) ? msgpack_head(b, 0xcc, n, 1)
+		     : (n <= 0xffff) ? msgpack_head(b, 0xcd, n, 2)
+		     : (n <= 0xffffffff) ? msgpack_head(b, 0xce, n, 4) : msgpack_head(b, 0xcf, n, 8);
+	}
+	v = -(int64_t) n - 1;
+	return (v >= -32) ? msgpack_head(b, v & 0xff, 0, 0) : (v >= -128) ? msgpack_head(b, 0xd0, v, 1)
+	     : (v >= -32768) ? msgpack_head(b, 0xd1, v, 2)
+	     : (v >= -2147483647 - 1) ? msgpack_head(b, 0xd2, v, 4) : msgpack_head(b, 0xd3, v, 8);
+}
+
+/* doubles that a float holds exactly are written as a float */
+static uint32_t encoder_double(json_encoder *enc, unsigned char *b, double d)
+{
+	int cbor = (enc->format == JSON_FORMAT_CBOR);
+	float f;
+	uint64_t bits;
+
+	/* out of the float range, the conversion is undefined */
+	f = (d >= -3.4028234663852886e38 && d <= 3.4028234663852886e38) ? (float) d : 0;
+	if (d != d || (d >= -3.4028234663852886e38 && d <= 3.4028234663852886e38 && (double) f == d)) {
+		uint32_t fbits;
+		memcpy(&fbits, &f, sizeof(fbits));
+		return msgpack_head(b, (cbor) ? 0xfa : 0xca, fbits, 4);
+	}
+	memcpy(&bits, &d, sizeof(bits));
+	return msgpack_head(b, (cbor) ? 0xfb : 0xcb, bits, 8);
+}
+
+static uint32_t encoder_simple(json_encoder *enc, unsigned char *b, int type)
+{
+	if (enc->format == JSON_FORMAT_CBOR)
+		b[0] = (type == JSON_FALSE) ? 0xf4 : (type == JSON_TRUE) ? 0xf5 : 0xf6;
+	else
+		b[0] = (type == JSON_FALSE) ? 0xc2 : (type == JSON_TRUE) ? 0xc3 : 0xc0;
+	return 1;
+}
+
+/* output the encoded value, with the heads of its arrays and objects */
+static int encoder_flush(json_encoder *enc)
+{
+	uint32_t i, n, last = 0, length = enc->buffer_offset + enc->headers_count * 9;
+	unsigned char *out;
+	int ret;
+
+	if (length < enc->buffer_offset)
+		return JSON_ERROR_NO_MEMORY;
+	if (length > enc->output_size) {
+		char *ptr = owner_realloc(enc, enc->output, length);
+		if (!ptr)
+			return JSON_ERROR_NO_MEMORY;
+		enc->output = ptr;
+		enc->output_size = length;
+	}
+	out = (unsigned char *) enc->output;
+	for (i = 0, n = 0; i < enc->headers_count; i++) {
+		struct json_encoder_header *h = &enc->headers[i];
+		memcpy(out + n, enc->buffer + last, h->offset - last);
+		n += h->offset - last;
+		n += encoder_head(enc, out + n, h->type, h->count);
+		last = h->offset;
+	}
+	memcpy(out + n, enc->buffer + last, enc->buffer_offset - last);
+	n += enc->buffer_offset - last;
+
+	enc->buffer_offset = 0;
+	enc->headers_count = 0;
+	ret = (*enc->callback)(enc->userdata, enc->output, n);
+	return ret;
+}
+
+/** json_encoder_init initialize an encoder to format, that outputs to callback */
+int json_encoder_init(json_encoder *enc, json_binary_format format,
+                      json_printer_callback callback, void *userdata,
+                      const json_allocator *allocator)
+{
+	memset(enc, 0, sizeof(*enc));
+	enc->format = format;
+	enc->callback = callback;
+	enc->userdata = userdata;
+	enc->allocator = allocator;
+	return 0;
+}
+
+/** json_encoder_free free memory allocated by the encoder */
+int json_encoder_free(json_encoder *enc)
+{
+	owner_free(enc, enc->buffer);
+	owner_free(enc, enc->output);
+	owner_free(enc, enc->headers);
+	owner_free(enc, enc->stack);
+	owner_free(enc, enc->partial.data);
+	return 0;
+}
+
+/** json_encoder_callback encodes one event */
+int json_encoder_callback(void *userdata, int type, const char *data, uint32_t length)
+{
+	json_encoder *enc = userdata;
+	unsigned char *b;
+	uint64_t n;
+	int neg, ret;
+
+	if (type == JSON_PARTIAL)
+		return partial_keep(&enc->partial, enc->allocator, NULL, data, length);
+	CHK(partial_join(&enc->partial, enc->allocator, NULL, &data, &length));
+
+	/* arrays count their values, and objects their keys */
+	if (enc->stack_offset > 0 && type != JSON_ARRAY_END && type != JSON_OBJECT_END) {
+		struct json_encoder_header *h = &enc->headers[enc->stack[enc->stack_offset - 1]];
+		if (type == JSON_KEY || h->type == JSON_ARRAY_BEGIN)
+			h->count++;
+	}
+
+	CHK(encoder_reserve(enc, 9));
+	b = (unsigned char *) enc->buffer + enc->buffer_offset;
+
+	switch (type) {
+	case JSON_ARRAY_BEGIN: case JSON_OBJECT_BEGIN:
+		if (enc->headers_count == enc->headers_size) {
+			uint32_t newsize = (enc->headers_size) ? enc->headers_size * 2 : 64;
+			void *ptr = owner_realloc(enc, enc->headers, newsize * sizeof(*enc->headers));
+			if (!ptr)
+				return JSON_ERROR_NO_MEMORY;
+			enc->headers = ptr;
+			enc->headers_size = newsize;
+		}
+		if (enc->stack_offset == enc->stack_size) {
+			uint32_t newsize = (enc->stack_size) ? enc->stack_size * 2 : 64;
+			void *ptr = owner_realloc(enc, enc->stack, newsize * sizeof(*enc->stack));
+			if (!ptr)
+				return JSON_ERROR_NO_MEMORY;
+			enc->stack = ptr;
+			enc->stack_size = newsize;
+		}
+		enc->headers[enc->headers_count].offset = enc->buffer_offset;
+		enc->headers[enc->headers_count].count = 0;
+		enc->headers[enc->headers_count].type = type;
+		enc->stack[enc->stack_offset++] = enc->headers_count++;
+		break;
+	case JSON_ARRAY_END: case JSON_OBJECT_END:
+		if (enc->stack_offset == 0)
+			return JSON_ERROR_POP_EMPTY;
+		enc->stack_offset--;
+		break;
+	case JSON_INT:
+		if (parse_integer(data, length, &n, &neg)
+		    && (enc->format == JSON_FORMAT_CBOR || !neg || n <= INT64_MAX)) {
+			enc->buffer_offset += encoder_int(enc, b, n, neg);
+			break;
+		}
+		/* integers out of range are kept as a double */
+		/* fall through */
+	case JSON_FLOAT:
+		enc->buffer_offset += encoder_double(enc, b, strtod(data, NULL));
+		break;
+	case JSON_KEY: case JSON_STRING: case JSON_BSTRING:
+		enc->buffer_offset += encoder_head(enc, b, (type == JSON_BSTRING) ? JSON_BSTRING : JSON_STRING, length);
+		CHK(encoder_reserve(enc, length));
+		memcpy(enc->buffer + enc->buffer_offset, data, length);
+		enc->buffer_offset += length;
+		break;
+	case JSON_TRUE: case JSON_FALSE: case JSON_NULL:
+		enc->buffer_offset += encoder_simple(enc, b, type);
+		break;
+	default:
+		return 0;
+	}
+
+	/* a whole value is encoded: hand it to the callback */
+	if (enc->stack_offset == 0 && type != JSON_KEY)
+		return encoder_flush(enc);
+	return 0;
+}
+
+/* an item read by the decoders */
+struct decoded {
+	int type;
+	int negative;
+	int indefinite;
+	uint64_t n;
+	double d;
+	const unsigned char *data;
+};
+
+#define DECODED_BREAK 0x100
+
+struct decoder {
+	const unsigned char *p;
+	const unsigned char *end;
+	/* zero terminated copy of the last string */
+	char *scratch;
+	uint32_t scratch_size;
+	/* open arrays and objects */
+	struct decoder_level { uint64_t left; uint8_t is_object; uint8_t indefinite; uint8_t key; } *stack;
+	uint32_t stack_offset;
+	uint32_t stack_size;
+	const json_allocator *allocator;
+};
+
+static int decoder_uint(struct decoder *d, uint32_t size, uint64_t *n)
+{
+	uint32_t i;
+
+	if ((uint32_t) (d->end - d->p) < size)
+		return JSON_ERROR_BINARY_FORMAT;
+	for (*n = 0, i = 0; i < size; i++)
+		*n = (*n << 8) | *d->p++;
+	return 0;
+}
+
+static double half_to_double(uint32_t h)
+{
+	uint32_t exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+	uint64_t bits;
+	double v;
+
+	if (exponent == 0)
+		v = mantissa / 16777216.0;
+	else {
+		bits = (uint64_t) ((exponent == 31) ? 0x7ff : exponent + 1008) << 52 | (uint64_t) mantissa << 42;
+		memcpy(&v, &bits, sizeof(v));
+	}
+	return (h & 0x8000) ? -v : v;
+}
+
+static double bits_to_double(uint64_t n, uint32_t size)
+{
+	if (size == 4) {
+		uint32_t bits = (uint32_t) n;
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	} else {
+		double v;
+		memcpy(&v, &n, sizeof(v));
+		return v;
+	}
+}
+
+static int cbor_item(struct decoder *d, struct decoded *item)
+{
+	int ret, initial, major, info;
+	uint64_t n;
+
+	item->indefinite = 0;
+	/* tags are ignored: skip them, in a loop as the input can hold any number */
+	do {
+		initial = *d->p++;
+		major = initial >> 5;
+		info = initial & 0x1f;
+		n = info;
+		if (info >= 24 && info <= 27)
+			CHK(decoder_uint(d, 1 << (info - 24), &n));
+		else if (info == 31) {
+			if (major == 7) {
+				item->type = DECODED_BREAK;
+				return 0;
+			}
+			if (major < 2 || major > 5)
+				return JSON_ERROR_BINARY_FORMAT;
+			item->indefinite = 1;
+		} else if (info > 27)
+			return JSON_ERROR_BINARY_FORMAT;
+		if (major == 6 && d->p == d->end)
+			return JSON_ERROR_BINARY_FORMAT;
+	} while (major == 6);
+
+	item->n = n;
+	switch (major) {
+	case 0: case 1:
+		item->type = JSON_INT;
+		item->negative = major;
+		break;
+	case 2: case 3:
+		item->type = (major == 2) ? JSON_BSTRING : JSON_STRING;
+		item->data = d->p;
+		if (!item->indefinite) {
+			if (n > (uint64_t) (d->end - d->p))
+				return JSON_ERROR_BINARY_FORMAT;
+			d->p += n;
+		}
+		break;
+	case 4:
+		item->type = JSON_ARRAY_BEGIN;
+		break;
+	case 5:
+		item->type = JSON_OBJECT_BEGIN;
+		break;
+	default:
+		if (info == 20 || info == 21)
+			item->type = (info == 20) ? JSON_FALSE : JSON_TRUE;
+		else if (info == 22 || info == 23)
+			item->type = JSON_NULL;
+		else if (info >= 25 && info <= 27) {
+			item->type = JSON_FLOAT;
+			item->d = (info == 25) ? half_to_double((uint32_t) n) : bits_to_double(n, (info == 26) ? 4 : 8);
+		} else
+			return JSON_ERROR_BINARY_FORMAT;
+		break;
+	}
+	return 0;
+}
+
+static int msgpack_item(struct decoder *d, struct decoded *item)
+{
+	int ret, tag = *d->p++;
+	uint64_t n = 0;
+
+	item->indefinite = 0;
+	item->negative = 0;
+	if (tag <= 0x7f) {
+		item->type = JSON_INT;
+		item->n = tag;
+		return 0;
+	} else if (tag >= 0xe0) {
+		item->type = JSON_INT;
+		item->negative = 1;
+		item->n = 0xff - tag;
+		return 0;
+	} else if (tag <= 0x8f) {
+		item->type = JSON_OBJECT_BEGIN;
+		item->n = tag & 0xf;
+		return 0;
+	} else if (tag <= 0x9f) {
+		item->type = JSON_ARRAY_BEGIN;
+		item->n = tag & 0xf;
+		return 0;
+	} else if (tag <= 0xbf) {
+		item->type = JSON_STRING;
+		n = tag & 0x1f;
+		goto data;
+	}
+
+	switch (tag) {
+	case 0xc0: item->type = JSON_NULL; return 0;
+	case 0xc2: item->type = JSON_FALSE; return 0;
+	case 0xc3: item->type = JSON_TRUE; return 0;
+	case 0xc4: case 0xc5: case 0xc6:
+		item->type = JSON_BSTRING;
+		CHK(decoder_uint(d, 1 << (tag - 0xc4), &n));
+		goto data;
+	case 0xca: case 0xcb:
+		item->type = JSON_FLOAT;
+		CHK(decoder_uint(d, (tag == 0xca) ? 4 : 8, &n));
+		item->d = bits_to_double(n, (tag == 0xca) ? 4 : 8);
+		return 0;
+	case 0xcc: case 0xcd: case 0xce: case 0xcf:
+		item->type = JSON_INT;
+		return decoder_uint(d, 1 << (tag - 0xcc), &item->n);
+	case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+		uint32_t size = 1 << (tag - 0xd0);
+		CHK(decoder_uint(d, size, &n));
+		/* sign extend, then keep the magnitude minus one like CBOR */
+		if (size < 8 && (n >> (size * 8 - 1)))
+			n |= ~(uint64_t) 0 << (size * 8);
+		item->type = JSON_INT;
+		item->negative = (n >> 63) != 0;
+		item->n = (item->negative) ? ~n : n;
+		return 0;
+	}
+	case 0xd9: case 0xda: case 0xdb:
+		item->type = JSON_STRING;
+		CHK(decoder_uint(d, 1 << (tag - 0xd9), &n));
+		goto data;
+	case 0xdc: case 0xdd:
+		item->type = JSON_ARRAY_BEGIN;
+		return decoder_uint(d, (tag == 0xdc) ? 2 : 4, &item->n);
+	case 0xde: case 0xdf:
+		item->type = JSON_OBJECT_BEGIN;
+		return decoder_uint(d, (tag == 0xde) ? 2 : 4, &item->n);
+	default:
+		/* extension types can't be represented */
+		return JSON_ERROR_BINARY_FORMAT;
+	}
+data:
+	if (n > (uint64_t) (d->end - d->p))
+		return JSON_ERROR_BINARY_FORMAT;
+	item->data = d->p;
+	item->n = n;
+	d->p += n;
+	return 0;
+}
+
+static int decoder_scratch(struct decoder *d, uint64_t length)
+{
+	uint32_t newsize;
+	char *ptr;
+
+	if (length < d->scratch_size)
+		return 0;
+	if (length >= 0xffffffff)
+		return JSON_ERROR_NO_MEMORY;
+	for (newsize = (d->scratch_size) ? d->scratch_size : 256; newsize <= length; )
+		newsize = (newsize > 0x7fffffff) ? 0xffffffff : newsize * 2;
+	ptr = owner_realloc(d, d->scratch, newsize);
+	if (!ptr)
+		return JSON_ERROR_NO_MEMORY;
+	d->scratch = ptr;
+	d->scratch_size = newsize;
+	return 0;
+}
+
+/* copy the string of item to the scratch buffer with a terminating zero,
+ * joining the chunks of a CBOR indefinite length string */
+static int decoder_string(struct decoder *d, struct decoded *item, uint32_t *length)
+{
+	uint64_t n = 0;
+	int ret;
+
+	if (!item->indefinite) {
+		CHK(decoder_scratch(d, item->n));
+		memcpy(d->scratch, item->data, item->n);
+		n = item->n;
+	} else {
+		while (1) {
+			struct decoded chunk;
+			if (d->p == d->end)
+				return JSON_ERROR_BINARY_FORMAT;
+			CHK(cbor_item(d, &chunk));
+			if (chunk.type == DECODED_BREAK)
+				break;
+			if (chunk.type != item->type || chunk.indefinite)
+				return JSON_ERROR_BINARY_FORMAT;
+			CHK(decoder_scratch(d, n + chunk.n));
+			memcpy(d->scratch + n, chunk.data, chunk.n);
+			n += chunk.n;
+		}
+		CHK(decoder_scratch(d, n));
+	}
+	d->scratch[n] = '\0';
+	*length = (uint32_t) n;
+	return 0;
+}
+
+static int decoder_run(struct decoder *d, json_binary_format format,
+                       json_parser_callback callback, void *userdata)
+{
+	while (d->p < d->end || d->stack_offset > 0) {
+		struct decoder_level *level = (d->stack_offset) ? &d->stack[d->stack_offset - 1] : NULL;
+		struct decoded item;
+		uint32_t length = 0;
+		const char *data = NULL;
+		char b[32];
+		int ret, type, is_key = 0;
+
+		if (level && !level->indefinite && level->left == 0) {
+			d->stack_offset--;
+			if (callback)
+				CHK((*callback)(userdata, (level->is_object) ? JSON_OBJECT_END : JSON_ARRAY_END, NULL, 0));
+			continue;
+		}
+		if (d->p == d->end)
+			return JSON_ERROR_BINARY_FORMAT;
+		if (format == JSON_FORMAT_CBOR)
+			CHK(cbor_item(d, &item));
+		else
+			CHK(msgpack_item(d, &item));
+
+		if (item.type == DECODED_BREAK) {
+			if (!level || !level->indefinite || !level->key)
+				return JSON_ERROR_BINARY_FORMAT;
+			d->stack_offset--;
+			if (callback)
+				CHK((*callback)(userdata, (level->is_object) ? JSON_OBJECT_END : JSON_ARRAY_END, NULL, 0));
+			continue;
+		}
+		if (level) {
+			level->left--;
+			if (level->is_object) {
+				is_key = level->key;
+				level->key = !level->key;
+			}
+		}
+
+		type = item.type;
+		switch (type) {
+		case JSON_INT:
+			data = b;
+			if (!item.negative)
+				length = format_uint64(b, item.n);
+			else if (item.n == ~(uint64_t) 0) {
+				length = 21;
+				memcpy(b, "-18446744073709551616", length);
+			} else {
+				b[0] = '-';
+				length = 1 + format_uint64(b + 1, item.n + 1);
+			}
+			b[length] = '\0';
+			break;
+		case JSON_FLOAT:
+			data = b;
+			length = format_double(b, item.d);
+			b[length] = '\0';
+			if (b[0] == 'n') {
+				type = JSON_NULL;
+				data = NULL;
+				length = 0;
+			} else if (!memchr(b, '.', length) && !memchr(b, 'e', length)) {
+				/* an integral double: keep it a float */
+				memcpy(b + length, ".0", 3);
+				length += 2;
+			}
+			break;
+		case JSON_STRING: case JSON_BSTRING:
+			CHK(decoder_string(d, &item, &length));
+			data = d->scratch;
+			break;
+		case JSON_ARRAY_BEGIN: case JSON_OBJECT_BEGIN:
+			if (is_key)
+				return JSON_ERROR_BINARY_FORMAT;
+			if (d->stack_offset == d->stack_size) {
+				uint32_t newsize = (d->stack_size) ? d->stack_size * 2 : 64;
+				void *ptr = owner_realloc(d, d->stack, newsize * sizeof(*d->stack));
+				if (!ptr)
+					return JSON_ERROR_NO_MEMORY;
+				d->stack = ptr;
+				d->stack_size = newsize;
+			}
+			if (type == JSON_OBJECT_BEGIN && item.n > (~(uint64_t) 0) / 2)
+				return JSON_ERROR_BINARY_FORMAT;
+			level = &d->stack[d->stack_offset++];
+			level->left = (type == JSON_OBJECT_BEGIN) ? item.n * 2 : item.n;
+			level->is_object = (type == JSON_OBJECT_BEGIN);
+			level->indefinite = item.indefinite;
+			level->key = 1;
+			break;
+		default:
+			break;
+		}
+
+		/* JSON keys are strings: integer keys are given as their text */
+		if (is_key) {
+			if (type != JSON_STRING && type != JSON_INT)
+				return JSON_ERROR_BINARY_FORMAT;
+			type = JSON_KEY;
+		}
+		if (callback)
+			CHK((*callback)(userdata, type, data, length));
+	}
+	return 0;
+}
+
+/** json_decode gives the events of the CBOR or MessagePack values in data to a parser callback */
+int json_decode(json_binary_format format, const char *data, size_t length,
+                json_parser_callback callback, void *userdata, const json_allocator *allocator)
+{
+	struct decoder d;
+	int ret;
+
+	memset(&d, 0, sizeof(d));
+	d.allocator = allocator;
+	d.p = (const unsigned char *) data;
+	d.end = d.p + length;
+	ret = decoder_run(&d, format, callback, userdata);
+	owner_free(&d, d.scratch);
+	owner_free(&d, d.stack);
+	return ret;
+}
+
+#define SNAPSHOT_MAGIC       0x4d4f444a
+#define SNAPSHOT_VERSION     1
+#define SNAPSHOT_BUFFER_SIZE 65536
+
+/* the snapshot starts with the magic and the version, and ends with the root
+ * node and the magic. each node is 4 bytes aligned, and starts with its type
+ * and length:
+ * - strings, keys and numbers: the data with a terminating zero.
+ * - arrays: the offsets of the elements.
+ * - objects: the offsets of the key and the value of each member in order,
+ *   then the indexes of the members sorted by key.
+ * nodes are written after what they refer to. */
+
+static int snapshot_flush(json_snapshot_writer *w)
+{
+	int ret = 0;
+
+	if (w->buffer_offset > 0)
+		ret = (*w->callback)(w->userdata, w->buffer, w->buffer_offset);
+	w->buffer_offset = 0;
+	return ret;
+}
+
+static int snapshot_write(json_snapshot_writer *w, const void *data, uint32_t length)
+{
+	int ret;
+
+	if (length == 0)
+		return 0;
+	if (w->offset + length < w->offset || w->offset + length > 0xfffffff0)
+		return JSON_ERROR_DATA_LIMIT;
+	w->offset += length;
+	if (w->buffer_offset + length > SNAPSHOT_BUFFER_SIZE) {
+		CHK(snapshot_flush(w));
+		if (length > SNAPSHOT_BUFFER_SIZE)
+			return (*w->callback)(w->userdata, data, length);
+	}
+	memcpy(w->buffer + w->buffer_offset, data, length);
+	w->buffer_offset += length;
+	return 0;
+}
+
+static int snapshot_u32(json_snapshot_writer *w, uint32_t v)
+{
+	return snapshot_write(w, &v, sizeof(v));
+}
+
+/* write a data node, and return its offset */
+static int snapshot_data(json_snapshot_writer *w, int type, const char *data, uint32_t length, uint32_t *node)
+{
+	static const char padding[4] = { 0, 0, 0, 0 };
+	int ret;
+
+	*node = w->offset;
+	CHK(snapshot_u32(w, type));
+	CHK(snapshot_u32(w, length));
+	CHK(snapshot_write(w, data, length));
+	return snapshot_write(w, padding, 4 - (length & 3));
+}
+
+static int snapshot_children_add(json_snapshot_writer *w, uint32_t v)
+{
+	if (w->children_count == w->children_size) {
+		uint32_t newsize = (w->children_size) ? w->children_size * 2 : 1024;
+		uint32_t *ptr = owner_realloc(w, w->children, newsize * sizeof(*ptr));
+		if (!ptr)
+			return JSON_ERROR_NO_MEMORY;
+		w->children = ptr;
+		w->children_size = newsize;
+	}
+	w->children[w->children_count++] = v;
+	return 0;
+}
+
+/* return the index of the key in the interned keys, writing its node the first time */
+static int snapshot_key(json_snapshot_writer *w, const char *data, uint32_t length, uint32_t *index)
+{
+	uint32_t hash = string_hash(data, length), i;
+	struct json_snapshot_key *k;
+	int ret;
+
+	for (i = hash & (w->table_size - 1); w->table_size && w->table[i]; i = (i + 1) & (w->table_size - 1)) {
+		k = &w->keys[w->table[i] - 1];
+		if (k->hash == hash && k->length == length && memcmp(k->key, data, length) == 0) {
+			*index = w->table[i] - 1;
+			return 0;
+		}
+	}
+
+	if (w->keys_count == w->keys_size) {
+		uint32_t newsize = (w->keys_size) ? w->keys_size * 2 : 64;
+		void *ptr = owner_realloc(w, w->keys, newsize * sizeof(*w->keys));
+		if (!ptr)
+			return JSON_ERROR_NO_MEMORY;
+		w->keys = ptr;
+		w->keys_size = newsize;
+	}
+	if ((w->keys_count + 1) * 2 > w->table_size) {
+		uint32_t j, size = (w->table_size) ? w->table_size * 2 : 128;
+		uint32_t *table = owner_calloc(w, size, sizeof(*table));
+		if (!table)
+			return JSON_ERROR_NO_MEMORY;
+		for (j = 0; j < w->keys_count; j++) {
+			for (i = w->keys[j].hash & (size - 1); table[i]; i = (i + 1) & (size - 1));
+			table[i] = j + 1;
+		}
+		owner_free(w, w->table);
+		w->table = table;
+		w->table_size = size;
+		for (i = hash & (size - 1); table[i]; i = (i + 1) & (size - 1));
+	}
+
+	k = &w->keys[w->keys_count];
+	k->key = owner_calloc(w, length + 1, sizeof(char));
+	if (!k->key)
+		return JSON_ERROR_NO_MEMORY;
+	memcpy(k->key, data, length);
+	k->hash = hash;
+	k->length = length;
+	CHK(snapshot_data(w, JSON_KEY, data, length, &k->offset));
+	w->table[i] = w->keys_count + 1;
+	*index = w->keys_count++;
+	return 0;
+}
+
+static int key_cmp(const char *a, uint32_t alength, const char *b, uint32_t blength)
+{
+	int r = memcmp(a, b, (alength < blength) ? alength : blength);
+	if (r)
+		return r;
+	return (alength < blength) ? -1 : (alength > blength);
+}
+
+/* merge sort of the count indexes in a, using b as room, in the order of cmp.
+ * stable, for duplicated keys. return the one of a or b holding the result */
+static uint32_t *sort_indexes(uint32_t *a, uint32_t *b, uint32_t count,
+                              int (*cmp)(const void *, uint32_t, uint32_t), const void *ctx)
+{
+	uint32_t width, i;
+
+	for (width = 1; width < count; width *= 2) {
+		uint32_t *t;
+		for (i = 0; i < count; i += 2 * width) {
+			uint32_t l = i, mid = (i + width < count) ? i + width : count;
+			uint32_t r = mid, end = (i + 2 * width < count) ? i + 2 * width : count, o = i;
+			while (l < mid && r < end)
+				b[o++] = (cmp(ctx, a[r], a[l]) < 0) ? a[r++] : a[l++];
+			while (l < mid)
+				b[o++] = a[l++];
+			while (r < end)
+				b[o++] = a[r++];
+		}
+		t = a; a = b; b = t;
+	}
+	return a;
+}
+
+struct snapshot_members { const json_snapshot_writer *w; const uint32_t *pairs; };
+
+static int snapshot_member_cmp(const void *ctx, uint32_t a, uint32_t b)
+{
+	const struct snapshot_members *m = ctx;
+	struct json_snapshot_key *ka = &m->w->keys[m->pairs[a * 2]];
+	struct json_snapshot_key *kb = &m->w->keys[m->pairs[b * 2]];
+	return key_cmp(ka->key, ka->length, kb->key, kb->length);
+}
+
+/* sort the members of an object by key: pairs holds the key index and the
+ * value offset of each member */
+static int snapshot_sort(json_snapshot_writer *w, const uint32_t *pairs, uint32_t count, uint32_t **sorted)
+{
+	struct snapshot_members members = { w, pairs };
+	uint32_t i;
+
+	if (count * 2 > w->sort_size) {
+		uint32_t *ptr = owner_realloc(w, w->sort, count * 2 * sizeof(*ptr));
+		if (!ptr)
+			return JSON_ERROR_NO_MEMORY;
+		w->sort = ptr;
+		w->sort_size = count * 2;
+	}
+	for (i = 0; i < count; i++)
+		w->sort[i] = i;
+	*sorted = sort_indexes(w->sort, w->sort + count, count, snapshot_member_cmp, &members);
+	return 0;
+}
+
+/* write the node of the array or object at the top of the stack */
+static int snapshot_structure(json_snapshot_writer *w, uint32_t *node)
+{
+	uint32_t start = w->stack[w->stack_offset - 1].start;
+	int type = w->stack[w->stack_offset - 1].type;
+	uint32_t *children = w->children + start;
+	uint32_t i, count = w->children_count - start;
+	int ret;
+
+	*node = w->offset;
+	if (type == JSON_ARRAY_BEGIN) {
+		CHK(snapshot_u32(w, type));
+		CHK(snapshot_u32(w, count));
+		CHK(snapshot_write(w, children, count * sizeof(uint32_t)));
+	} else {
+		uint32_t *sorted;
+		count /= 2;
+		CHK(snapshot_u32(w, type));
+		CHK(snapshot_u32(w, count));
+		for (i = 0; i < count; i++) {
+			CHK(snapshot_u32(w, w->keys[children[i * 2]].offset));
+			CHK(snapshot_u32(w, children[i * 2 + 1]));
+		}
+		CHK(snapshot_sort(w, children, count, &sorted));
+		CHK(snapshot_write(w, sorted, count * sizeof(uint32_t)));
+	}
+	w->children_count = start;
+	w->stack_offset--;
+	return 0;
+}
+
+/** json_snapshot_writer_init initialize a snapshot writer that outputs to callback */
+int json_snapshot_writer_init(json_snapshot_writer *w, json_printer_callback callback, void *userdata,
+                              const json_allocator *allocator)
+{
+	memset(w, 0, sizeof(*w));
+	w->callback = callback;
+	w->userdata = userdata;
+	w->allocator = allocator;
+	w->buffer = owner_calloc(w, SNAPSHOT_BUFFER_SIZE, sizeof(char));
+	if (!w->buffer)
+		return JSON_ERROR_NO_MEMORY;
+	return 0;
+}
+
+/** json_snapshot_writer_free free memory allocated by the snapshot writer */
+int json_snapshot_writer_free(json_snapshot_writer *w)
+{
+	uint32_t i;
+
+	for (i = 0; i < w->keys_count; i++)
+		owner_free(w, w->keys[i].key);
+	owner_free(w, w->keys);
+	owner_free(w, w->table);
+	owner_free(w, w->children);
+	owner_free(w, w->stack);
+	owner_free(w, w->sort);
+	owner_free(w, w->buffer);
+	owner_free(w, w->partial.data);
+	return 0;
+}
+
+/** json_snapshot_writer_callback adds one event to the snapshot */
+int json_snapshot_writer_callback(void *userdata, int type, const char *data, uint32_t length)
+{
+	json_snapshot_writer *w = userdata;
+	uint32_t node;
+	int ret;
+
+	/* a snapshot holds one value */
+	if (w->done)
+		return JSON_ERROR_SNAPSHOT;
+	if (type == JSON_PARTIAL)
+		return partial_keep(&w->partial, w->allocator, NULL, data, length);
+	CHK(partial_join(&w->partial, w->allocator, NULL, &data, &length));
+	if (w->offset == 0) {
+		CHK(snapshot_u32(w, SNAPSHOT_MAGIC));
+		CHK(snapshot_u32(w, SNAPSHOT_VERSION));
+	}
+
+	switch (type) {
+	case JSON_ARRAY_BEGIN: case JSON_OBJECT_BEGIN:
+		if (w->stack_offset == w->stack_size) {
+			uint32_t newsize = (w->stack_size) ? w->stack_size * 2 : 64;
+			void *ptr = owner_realloc(w, w->stack, newsize * sizeof(*w->stack));
+			if (!ptr)
+				return JSON_ERROR_NO_MEMORY;
+			w->stack = ptr;
+			w->stack_size = newsize;
+		}
+		w->stack[w->stack_offset].start = w->children_count;
+		w->stack[w->stack_offset].type = type;
+		w->stack_offset++;
+		return 0;
+	case JSON_ARRAY_END: case JSON_OBJECT_END:
+		if (w->stack_offset == 0)
+			return JSON_ERROR_POP_EMPTY;
+		CHK(snapshot_structure(w, &node));
+		break;
+	case JSON_KEY:
+		CHK(snapshot_key(w, data, length, &node));
+		return snapshot_children_add(w, node);
+	case JSON_INT: case JSON_FLOAT: case JSON_STRING: case JSON_BSTRING:
+		CHK(snapshot_data(w, type, data, length, &node));
+		break;
+	case JSON_TRUE: case JSON_FALSE: case JSON_NULL:
+		node = w->offset;
+		CHK(snapshot_u32(w, type));
+		CHK(snapshot_u32(w, 0));
+		break;
+	default:
+		return 0;
+	}
+
+	if (w->stack_offset > 0)
+		return snapshot_children_add(w, node);
+
+	/* the root is written: finish the snapshot */
+	w->done = 1;
+	CHK(snapshot_u32(w, node));
+	CHK(snapshot_u32(w, SNAPSHOT_MAGIC));
+	return snapshot_flush(w);
+}
+
+static inline uint32_t snapshot_get(const json_snapshot *snap, uint32_t offset)
+{
+	uint32_t v;
+	memcpy(&v, snap->data + offset, sizeof(v));
+	return v;
+}
+
+/* return the type of node, checking that it and what it holds are in the snapshot */
+static int snapshot_node(const json_snapshot *snap, uint32_t node, uint32_t *length)
+{
+	uint32_t type, left;
+
+	if (node == 0 || (node & 3) || node > snap->size || snap->size - node < 8)
+		return JSON_NONE;
+	type = snapshot_get(snap, node);
+	*length = snapshot_get(snap, node + 4);
+	left = snap->size - node - 8;
+	switch (type) {
+	case JSON_ARRAY_BEGIN:
+		return (*length <= left / 4) ? type : JSON_NONE;
+	case JSON_OBJECT_BEGIN:
+		return (*length <= left / 12) ? type : JSON_NONE;
+	case JSON_INT: case JSON_FLOAT: case JSON_STRING: case JSON_KEY: case JSON_BSTRING:
+		/* the data is given as a zero terminated string */
+		return (*length < left && snap->data[node + 8 + *length] == '\0') ? type : JSON_NONE;
+	case JSON_TRUE: case JSON_FALSE: case JSON_NULL:
+		return type;
+	default:
+		return JSON_NONE;
+	}
+}
+
+/** json_snapshot_open checks data is a snapshot and initializes snap to read it */
+int json_snapshot_open(json_snapshot *snap, const void *data, size_t size)
+{
+	const char *p = data;
+	uint32_t magic, version;
+
+	memset(snap, 0, sizeof(*snap));
+	if (size < 16 || size > 0xfffffff0 || (size & 3))
+		return JSON_ERROR_SNAPSHOT;
+	memcpy(&magic, p, 4);
+	memcpy(&version, p + 4, 4);
+	if (magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION)
+		return JSON_ERROR_SNAPSHOT;
+	memcpy(&magic, p + size - 4, 4);
+	memcpy(&snap->root, p + size - 8, 4);
+	if (magic != SNAPSHOT_MAGIC)
+		return JSON_ERROR_SNAPSHOT;
+	snap->data = p;
+	/* nodes are before the end marker */
+	snap->size = (uint32_t) size - 8;
+	return 0;
+}
+
+/** json_snapshot_type returns the type of node, JSON_NONE if it's not a node */
+int json_snapshot_type(const json_snapshot *snap, uint32_t node)
+{
+	uint32_t length;
+	return snapshot_node(snap, node, &length);
+}
+
+/** json_snapshot_length returns the number of elements or members of an array or
+ * object node, and the length of the data of the others */
+uint32_t json_snapshot_length(const json_snapshot *snap, uint32_t node)
+{
+	uint32_t length;
+	return (snapshot_node(snap, node, &length) == JSON_NONE) ? 0 : length;
+}
+
+/** json_snapshot_data returns the zero terminated data of a string, key or number node */
+const char *json_snapshot_data(const json_snapshot *snap, uint32_t node)
+{
+	uint32_t length;
+
+	switch (snapshot_node(snap, node, &length)) {
+	case JSON_INT: case JSON_FLOAT: case JSON_STRING: case JSON_KEY: case JSON_BSTRING:
+		return snap->data + node + 8;
+	default:
+		return NULL;
+	}
+}
+
+/* nodes only refer to nodes before them, so a bad snapshot can't loop */
+static uint32_t snapshot_child(const json_snapshot *snap, uint32_t node, uint32_t offset)
+{
+	uint32_t child = snapshot_get(snap, offset);
+	return (child < node) ? child : 0;
+}
+
+/** json_snapshot_get returns the element at index of an array node, or the value
+ * of the member at index of an object node. 0 if there's none */
+uint32_t json_snapshot_get(const json_snapshot *snap, uint32_t node, uint32_t index)
+{
+	uint32_t length;
+
+	switch (snapshot_node(snap, node, &length)) {
+	case JSON_ARRAY_BEGIN:
+		return (index < length) ? snapshot_child(snap, node, node + 8 + index * 4) : 0;
+	case JSON_OBJECT_BEGIN:
+		return (index < length) ? snapshot_child(snap, node, node + 12 + index * 8) : 0;
+	default:
+		return 0;
+	}
+}
+
+/** json_snapshot_key returns the key node of the member at index of an object node */
+uint32_t json_snapshot_key(const json_snapshot *snap, uint32_t node, uint32_t index)
+{
+	uint32_t length;
+
+	if (snapshot_node(snap, node, &length) != JSON_OBJECT_BEGIN || index >= length)
+		return 0;
+	return snapshot_child(snap, node, node + 8 + index * 8);
+}
+
+/** json_snapshot_find returns the value of key in an object node, 0 if it's not there */
+uint32_t json_snapshot_find(const json_snapshot *snap, uint32_t node, const char *key, uint32_t key_length)
+{
+	uint32_t length, low, high, sorted;
+
+	if (snapshot_node(snap, node, &length) != JSON_OBJECT_BEGIN)
+		return 0;
+	sorted = node + 8 + length * 8;
+	for (low = 0, high = length; low < high; ) {
+		uint32_t mid = low + (high - low) / 2;
+		uint32_t index = snapshot_get(snap, sorted + mid * 4);
+		uint32_t k = json_snapshot_key(snap, node, index);
+		uint32_t klength;
+		int cmp;
+
+		if (snapshot_node(snap, k, &klength) != JSON_KEY)
+			return 0;
+		cmp = key_cmp(snap->data + k + 8, klength, key, key_length);
+		if (cmp == 0) {
+			/* the first of duplicated keys, like the order of the members */
+			while (mid > 0) {
+				uint32_t prev = json_snapshot_key(snap, node, snapshot_get(snap, sorted + (mid - 1) * 4));
+				if (snapshot_node(snap, prev, &klength) != JSON_KEY
+				    || key_cmp(snap->data + prev + 8, klength, key, key_length))
+					break;
+				index = snapshot_get(snap, sorted + --mid * 4);
+			}
+			return json_snapshot_get(snap, node, index);
+		}
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return 0;
+}
+
+/* the token the index is reading. the escapes follow their string */
+enum {
+	INDEX_LEX_VALUE,
+	INDEX_LEX_STRING, INDEX_LEX_STRING_ESCAPE,
+	INDEX_LEX_KEY, INDEX_LEX_KEY_ESCAPE,
+	INDEX_LEX_SLASH, INDEX_LEX_COMMENT, INDEX_LEX_COMMENT_STAR, INDEX_LEX_LINE_COMMENT,
+};
+
+/* what's expected next at a depth */
+enum { INDEX_EXPECT_VALUE, INDEX_EXPECT_KEY, INDEX_EXPECT_COLON, INDEX_EXPECT_NEXT };
+
+#define INDEX_MAGIC 0x5844494a /* "JIDX" */
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE 24
+
+/** json_index_init initializes an index of the values down to max_depth */
+int json_index_init(json_index *index, uint32_t max_depth, const json_allocator *allocator)
+{
+	memset(index, 0, sizeof(*index));
+	index->allocator = allocator;
+	if (max_depth > JSON_INDEX_MAX_DEPTH)
+		return JSON_ERROR_INDEX;
+	index->max_depth = max_depth;
+	index->owned = 1;
+	return 0;
+}
+
+/** json_index_free free memory allocated by the index */
+int json_index_free(json_index *index)
+{
+	uint32_t i;
+
+	for (i = 0; i <= JSON_INDEX_MAX_DEPTH; i++)
+		owner_free(index, index->levels[i].entries);
+	if (index->owned) {
+		owner_free(index, index->entries);
+		owner_free(index, index->sorted);
+		owner_free(index, index->keys);
+	}
+	memset(index, 0, sizeof(*index));
+	return 0;
+}
+
+static int index_keys_append(json_index *index, const char *s, uint32_t length)
+{
+	if (length > index->keys_size - index->keys_length) {
+		uint64_t newsize = (index->keys_size) ? index->keys_size : 4096;
+		char *ptr;
+
+		if ((uint64_t) index->keys_length + length > 0xffffffff)
+			return JSON_ERROR_INDEX;
+		while (newsize - index->keys_length < length)
+			newsize *= 2;
+		if (newsize > 0xffffffff)
+			newsize = 0xffffffff;
+		ptr = owner_realloc(index, index->keys, (size_t) newsize);
+		if (!ptr)
+			return JSON_ERROR_NO_MEMORY;
+		index->keys = ptr;
+		index->keys_size = (uint32_t) newsize;
+	}
+	memcpy(index->keys + index->keys_length, s, length);
+	index->keys_length += length;
+	return 0;
+}
+
+/* a value of type starts at offset, at the current depth */
+static int index_value(json_index *index, int type, uint64_t offset)
+{
+	uint32_t depth = index->depth;
+	struct json_index_level *level;
+	json_index_entry *e;
+
+	if (depth > index->max_depth)
+		return 0;
+	level = &index->levels[depth];
+	if (level->expect != INDEX_EXPECT_VALUE)
+		return JSON_ERROR_INDEX;
+	level->expect = INDEX_EXPECT_NEXT;
+
+	if (level->count == level->size) {
+		uint32_t newsize = (level->size) ? level->size * 2 : 64;
+		void *ptr;
+
+		if (newsize <= level->size)
+			return JSON_ERROR_INDEX;
+		ptr = owner_realloc(index, level->entries, (size_t) newsize * sizeof(*e));
+		if (!ptr)
+			return JSON_ERROR_NO_MEMORY;
+		level->entries = ptr;
+		level->size = newsize;
+	}
+	e = &level->entries[level->count];
+	memset(e, 0, sizeof(*e));
+	e->offset = offset;
+	e->length = 1;
+	e->type = type;
+	e->parent = JSON_INDEX_NONE;
+	if (depth > 0) {
+		struct json_index_level *up = &index->levels[depth - 1];
+		json_index_entry *parent = &up->entries[up->count - 1];
+
+		if (parent->count++ == 0)
+			parent->first = level->count;
+		e->parent = up->count - 1;
+		if (level->object) {
+			e->key = level->key;
+			e->key_length = level->key_length;
+		}
+	}
+	level->count++;
+	return 0;
+}
+
+/* the value being read at the current depth ends at offset */
+static void index_end(json_index *index, uint64_t offset)
+{
+	struct json_index_level *level;
+
+	if (index->depth > index->max_depth)
+		return;
+	level = &index->levels[index->depth];
+	if (level->count > 0)
+		level->entries[level->count - 1].length = offset + 1 - level->entries[level->count - 1].offset;
+}
+
+/* a character out of strings and comments */
+static int index_char(json_index *index, unsigned char c, uint64_t offset)
+{
+	uint32_t depth = index->depth;
+	struct json_index_level *level = (depth <= index->max_depth) ? &index->levels[depth] : NULL;
+	json_index_entry *e;
+	int type, ret;
+
+	switch (c) {
+	case ' ': case '\t': case '\n': case '\r':
+		return 0;
+	case '/':
+		index->lex = INDEX_LEX_SLASH;
+		return 0;
+	case '#':
+		index->lex = INDEX_LEX_LINE_COMMENT;
+		return 0;
+	case ',':
+		if (depth == 0 || (level && level->expect != INDEX_EXPECT_NEXT))
+			return JSON_ERROR_INDEX;
+		if (level)
+			level->expect = (level->object) ? INDEX_EXPECT_KEY : INDEX_EXPECT_VALUE;
+		return 0;
+	case ':':
+		if (level) {
+			if (level->expect != INDEX_EXPECT_COLON)
+				return JSON_ERROR_INDEX;
+			level->expect = INDEX_EXPECT_VALUE;
+		}
+		return 0;
+	case '{': case '[':
+		CHK(index_value(index, (c == '{') ? JSON_OBJECT_BEGIN : JSON_ARRAY_BEGIN, offset));
+		index->depth++;
+		if (depth < index->max_depth) {
+			level = &index->levels[depth + 1];
+			level->object = (c == '{');
+			level->expect = (level->object) ? INDEX_EXPECT_KEY : INDEX_EXPECT_VALUE;
+		}
+		return 0;
+	case '}': case ']':
+		if (depth == 0 || (level && (level->expect == INDEX_EXPECT_COLON || level->object != (c == '}'))))
+			return JSON_ERROR_INDEX;
+		index->depth--;
+		index_end(index, offset);
+		return 0;
+	case '"':
+		if (level && level->expect == INDEX_EXPECT_KEY) {
+			level->key = index->keys_length;
+			level->expect = INDEX_EXPECT_COLON;
+			index->lex = INDEX_LEX_KEY;
+			return 0;
+		}
+		CHK(index_value(index, JSON_STRING, offset));
+		index->lex = INDEX_LEX_STRING;
+		return 0;
+	default:
+		if (!level)
+			return 0;
+		/* the next character of a number or a literal */
+		if (level->expect == INDEX_EXPECT_NEXT) {
+			e = &level->entries[level->count - 1];
+			if (e->type == JSON_STRING || e->type == JSON_ARRAY_BEGIN || e->type == JSON_OBJECT_BEGIN)
+				return JSON_ERROR_INDEX;
+			if (e->type == JSON_INT && (c == '.' || c == 'e' || c == 'E'))
+				e->type = JSON_FLOAT;
+			e->length = offset + 1 - e->offset;
+			return 0;
+		}
+		switch (c) {
+		case 't': type = JSON_TRUE; break;
+		case 'f': type = JSON_FALSE; break;
+		case 'n': type = JSON_NULL; break;
+		case '-': case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			type = JSON_INT;
+			break;
+		default:
+			return JSON_ERROR_INDEX;
+		}
+		return index_value(index, type, offset);
+	}
+}
+
+/** json_index_string reads the next length characters of the input */
+int json_index_string(json_index *index, const char *s, uint32_t length)
+{
+	uint32_t i = 0, j;
+	int ret;
+
+	while (i < length) {
+		switch (index->lex) {
+		case INDEX_LEX_VALUE:
+			CHK(index_char(index, s[i], index->offset + i));
+			break;
+		case INDEX_LEX_STRING: case INDEX_LEX_KEY:
+			/* keys are kept as written, escapes included */
+			for (j = i; j < length && s[j] != '"' && s[j] != '\\'; j++);
+			if (index->lex == INDEX_LEX_KEY)
+				CHK(index_keys_append(index, s + i, (j < length) ? j - i + (s[j] == '\\') : j - i));
+			if (j == length) {
+				i = j;
+				continue;
+			}
+			if (s[j] == '\\')
+				index->lex++;
+			else if (index->lex == INDEX_LEX_KEY) {
+				struct json_index_level *level = &index->levels[index->depth];
+				level->key_length = index->keys_length - level->key;
+				index->lex = INDEX_LEX_VALUE;
+			} else {
+				index_end(index, index->offset + j);
+				index->lex = INDEX_LEX_VALUE;
+			}
+			i = j;
+			break;
+		case INDEX_LEX_STRING_ESCAPE: case INDEX_LEX_KEY_ESCAPE:
+			if (index->lex == INDEX_LEX_KEY_ESCAPE)
+				CHK(index_keys_append(index, s + i, 1));
+			index->lex--;
+			break;
+		case INDEX_LEX_SLASH:
+			if (s[i] != '*')
+				return JSON_ERROR_INDEX;
+			index->lex = INDEX_LEX_COMMENT;
+			break;
+		case INDEX_LEX_COMMENT:
+			if (s[i] == '*')
+				index->lex = INDEX_LEX_COMMENT_STAR;
+			break;
+		case INDEX_LEX_COMMENT_STAR:
+			if (s[i] == '/')
+				index->lex = INDEX_LEX_VALUE;
+			else if (s[i] != '*')
+				index->lex = INDEX_LEX_COMMENT;
+			break;
+		case INDEX_LEX_LINE_COMMENT:
+			if (s[i] == '\n')
+				index->lex = INDEX_LEX_VALUE;
+			break;
+		}
+		i++;
+	}
+	index->offset += length;
+	return 0;
+}
+
+static int index_key_cmp(const void *ctx, uint32_t a, uint32_t b)
+{
+	const json_index *index = ctx;
+	const json_index_entry *ea = &index->entries[a], *eb = &index->entries[b];
+	return key_cmp(index->keys + ea->key, ea->key_length, index->keys + eb->key, eb->key_length);
+}
+
+/** json_index_finish puts the entries of all depths together, and sorts the
+ * members of each object by key */
+int json_index_finish(json_index *index)
+{
+	uint32_t base[JSON_INDEX_MAX_DEPTH + 2], total = 0, d, i;
+	uint32_t *room;
+
+	if (index->depth || (index->lex != INDEX_LEX_VALUE && index->lex != INDEX_LEX_LINE_COMMENT)
+	    || index->levels[0].count != 1 || index->entries)
+		return JSON_ERROR_INDEX;
+	for (d = 0; d <= index->max_depth; d++) {
+		base[d] = total;
+		if (index->levels[d].count >= JSON_INDEX_NONE - total)
+			return JSON_ERROR_INDEX;
+		total += index->levels[d].count;
+	}
+	base[d] = total;
+
+	if (!index->keys && !(index->keys = owner_calloc(index, 1, sizeof(char))))
+		return JSON_ERROR_NO_MEMORY;
+	index->entries = owner_calloc(index, total, sizeof(json_index_entry));
+	index->sorted = owner_calloc(index, total, sizeof(uint32_t));
+	room = owner_calloc(index, total, sizeof(uint32_t));
+	if (!index->entries || !index->sorted || !room) {
+		owner_free(index, room);
+		return JSON_ERROR_NO_MEMORY;
+	}
+
+	for (d = 0; d <= index->max_depth; d++) {
+		struct json_index_level *level = &index->levels[d];
+		for (i = 0; i < level->count; i++) {
+			json_index_entry *e = &index->entries[base[d] + i];
+			*e = level->entries[i];
+			if (d > 0)
+				e->parent += base[d - 1];
+			if (e->count > 0)
+				e->first += base[d + 1];
+		}
+		owner_free(index, level->entries);
+		memset(level, 0, sizeof(*level));
+	}
+	index->nb_entries = total;
+
+	for (i = 0; i < total; i++)
+		index->sorted[i] = i;
+	for (i = 0; i < total; i++) {
+		json_index_entry *e = &index->entries[i];
+		if (e->type == JSON_OBJECT_BEGIN && e->count > 0) {
+			uint32_t *sorted = sort_indexes(index->sorted + e->first, room, e->count, index_key_cmp, index);
+			if (sorted != index->sorted + e->first)
+				memcpy(index->sorted + e->first, sorted, e->count * sizeof(uint32_t));
+		}
+	}
+	owner_free(index, room);
+	return 0;
+}
+
+/** json_index_save writes the header, the entries, the sorted members and the keys */
+int json_index_save(const json_index *index, json_printer_callback callback, void *userdata)
+{
+	uint32_t header[INDEX_HEADER_SIZE / 4] = {
+		INDEX_MAGIC, INDEX_VERSION, index->nb_entries, index->keys_length, index->max_depth, 0
+	};
+	int ret;
+
+	if (index->nb_entries == 0)
+		return JSON_ERROR_INDEX;
+	CHK(write_all(callback, userdata, header, sizeof(header)));
+	CHK(write_all(callback, userdata, index->entries, (uint64_t) index->nb_entries * sizeof(json_index_entry)));
+	CHK(write_all(callback, userdata, index->sorted, (uint64_t) index->nb_entries * sizeof(uint32_t)));
+	return write_all(callback, userdata, index->keys, index->keys_length);
+}
+
+/** json_index_open checks data is a saved index and initializes index to read it */
+int json_index_open(json_index *index, const void *data, size_t size)
+{
+	const char *p = data;
+	uint32_t header[INDEX_HEADER_SIZE / 4];
+	uint64_t entries_size;
+
+	memset(index, 0, sizeof(*index));
+	if (size < INDEX_HEADER_SIZE || ((uintptr_t) p & 7))
+		return JSON_ERROR_INDEX;
+	memcpy(header, p, sizeof(header));
+	if (header[0] != INDEX_MAGIC || header[1] != INDEX_VERSION || header[2] == 0
+	    || header[4] > JSON_INDEX_MAX_DEPTH)
+		return JSON_ERROR_INDEX;
+	entries_size = (uint64_t) header[2] * sizeof(json_index_entry);
+	if ((uint64_t) size != INDEX_HEADER_SIZE + entries_size + (uint64_t) header[2] * sizeof(uint32_t) + header[3])
+		return JSON_ERROR_INDEX;
+
+	/* the index is only read, never freed */
+	index->entries = (json_index_entry *) (p + INDEX_HEADER_SIZE);
+	index->sorted = (uint32_t *) (p + INDEX_HEADER_SIZE + entries_size);
+	index->keys = (char *) (index->sorted + header[2]);
+	index->nb_entries = header[2];
+	index->keys_length = header[3];
+	index->max_depth = header[4];
+	return 0;
+}
+
+/** json_index_get returns the entry of the element or member at n of entry */
+uint32_t json_index_get(const json_index *index, uint32_t entry, uint32_t n)
+{
+	const json_index_entry *e;
+
+	if (entry >= index->nb_entries)
+		return JSON_INDEX_NONE;
+	e = &index->entries[entry];
+	if (n >= e->count || e->first >= index->nb_entries || n >= index->nb_entries - e->first)
+		return JSON_INDEX_NONE;
+	return e->first + n;
+}
+
+/* compare the key of the member at n in key order of the object e to key.
+ * member is set to JSON_INDEX_NONE if the index is invalid */
+static int index_member_cmp(const json_index *index, const json_index_entry *e, uint32_t n,
+                            const char *key, uint32_t key_length, uint32_t *member)
+{
+	const json_index_entry *m;
+
+	*member = index->sorted[e->first + n];
+	if (*member - e->first >= e->count) {
+		*member = JSON_INDEX_NONE;
+		return 0;
+	}
+	m = &index->entries[*member];
+	if (m->key > index->keys_length || m->key_length > index->keys_length - m->key) {
+		*member = JSON_INDEX_NONE;
+		return 0;
+	}
+	return key_cmp(index->keys + m->key, m->key_length, key, key_length);
+}
+
+/** json_index_find returns the entry of the member with key of an object entry,
+ * found by binary search */
+uint32_t json_index_find(const json_index *index, uint32_t entry, const char *key, uint32_t key_length)
+{
+	const json_index_entry *e;
+	uint32_t low, high, member, prev;
+	int cmp;
+
+	if (entry >= index->nb_entries || index->entries[entry].type != JSON_OBJECT_BEGIN)
+		return JSON_INDEX_NONE;
+	e = &index->entries[entry];
+	if (json_index_get(index, entry, e->count - 1) == JSON_INDEX_NONE)
+		return JSON_INDEX_NONE;
+	for (low = 0, high = e->count; low < high; ) {
+		uint32_t mid = low + (high - low) / 2;
+
+		cmp = index_member_cmp(index, e, mid, key, key_length, &member);
+		if (member == JSON_INDEX_NONE)
+			return JSON_INDEX_NONE;
+		if (cmp == 0) {
+			/* the first of duplicated keys, like the order of the members */
+			while (mid > 0 && index_member_cmp(index, e, mid - 1, key, key_length, &prev) == 0
+			       && prev != JSON_INDEX_NONE) {
+				member = prev;
+				mid--;
+			}
+			return member;
+		}
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return JSON_INDEX_NONE;
+}
@@ -25,11 +25,13 @@ extern "C" {
 typedef unsigned __int8 uint8_t;
 typedef unsigned __int16 uint16_t;
 typedef unsigned __int32 uint32_t;
+typedef unsigned __int64 uint64_t;
+typedef __int64 int64_t;
 #else
 #include <stdint.h>
 #endif
 
-#define JSON_MAJOR 	1
+#define JSON_MAJOR 	2
 #define JSON_MINOR	0
 #define JSON_VERSION	(JSON_MAJOR * 100 + JSON_MINOR)
 
@@ -48,6 +50,7 @@ typedef enum
 	JSON_FALSE,
 	JSON_NULL,
 	JSON_BSTRING,
+	JSON_PARTIAL,
 } json_type;
 
 typedef enum
@@ -79,14 +82,79 @@ typedef enum
 	JSON_ERROR_CALLBACK,
 	/* utf8 stream is invalid */
 	JSON_ERROR_UTF8,
+	/* base64 string value is invalid */
+	JSON_ERROR_BASE64,
+	/* binary record is invalid */
+	JSON_ERROR_RECORD,
+	/* CBOR or MessagePack data is invalid */
+	JSON_ERROR_BINARY_FORMAT,
+	/* snapshot or saved parser state is invalid */
+	JSON_ERROR_SNAPSHOT,
+	/* input can't be indexed, or index is invalid */
+	JSON_ERROR_INDEX,
+	/* value doesn't match the C++ type it is decoded into */
+	JSON_ERROR_BIND,
+	/* input ends before the end of the document */
+	JSON_ERROR_INCOMPLETE,
+	/* the memory budget shared by the parsers is exhausted */
+	JSON_ERROR_BUDGET,
+	/* JSON_PARTIAL event given to a callback that needs whole values */
+	JSON_ERROR_PARTIAL,
 } json_error;
 
+#define JSON_KEY_UNKNOWN (-1)
+
+/** returned by a parser or batch callback to suspend the parser: it stops after the
+ * character it is processing, and json_parser_string returns JSON_SUSPEND with the
+ * characters consumed in processed. the next call continues with the rest of the
+ * input. if the character also closes an array or an object, its event is
+ * delivered at the start of the next call */
+#define JSON_SUSPEND (-0x5355)
+
 #define LIBJSON_DEFAULT_STACK_SIZE 256
 #define LIBJSON_DEFAULT_BUFFER_SIZE 4096
 
 typedef int (*json_parser_callback)(void *userdata, int type, const char *data, uint32_t length);
 typedef int (*json_printer_callback)(void *userdata, const char *s, uint32_t length);
 
+/** a parsing event delivered in batch mode. the data of the event starts at
+ * offset in the batch data area, is length bytes long and zero terminated.
+ * array and object events don't have data and have a zero length. */
+typedef struct {
+	uint32_t type;
+	uint32_t offset;
+	uint32_t length;
+	/* for JSON_KEY, the id of the key in the config keys, or JSON_KEY_UNKNOWN */
+	int32_t key_id;
+} json_event;
+
+typedef int (*json_parser_batch_callback)(void *userdata, const json_event *events,
+                                          uint32_t nb_events, const char *data);
+
+/** select the arrays to decode as a vector: depth is the nesting level of the array */
+typedef int (*json_parser_array_match)(void *userdata, uint32_t depth);
+
+/** receive a decoded array: values is an array of count int64_t if type is JSON_INT,
+ * or of count double if type is JSON_FLOAT */
+typedef int (*json_parser_array_callback)(void *userdata, int type, const void *values, uint32_t count);
+
+/** memory allocator with a context given first to each function. all three
+ * functions are needed; memory from calloc and realloc is given back to free */
+typedef struct {
+	void * (*calloc)(void *ctx, size_t nmemb, size_t size);
+	void * (*realloc)(void *ctx, void *ptr, size_t size);
+	void (*free)(void *ctx, void *ptr);
+	void *ctx;
+} json_allocator;
+
+/** memory budget shared by parsers: the parse buffers of the parsers using it
+ * never take more than limit bytes in total. used is updated atomically, so
+ * parsers in different threads can share a budget */
+typedef struct {
+	uint64_t limit;
+	uint64_t used;
+} json_budget;
+
 typedef struct {
 	uint32_t buffer_initial_size;
 	uint32_t max_nesting;
@@ -95,6 +163,26 @@ typedef struct {
 	int allow_yaml_comments;
 	void * (*user_calloc)(size_t nmemb, size_t size);
 	void * (*user_realloc)(void *ptr, size_t size);
+	/* string values of these keys are base64 decoded and given as JSON_BSTRING.
+	 * NULL terminated list, or NULL */
+	const char * const *base64_keys;
+	/* the keys known to the caller: the id of a key is its index in this NULL
+	 * terminated list. with skip_unknown_keys, the members with other keys are
+	 * not delivered at all */
+	const char * const *keys;
+	int skip_unknown_keys;
+	/* strings, keys and numbers longer than this are delivered in JSON_PARTIAL
+	 * events of about this size, then the usual event with the end of the value.
+	 * 0 to deliver them whole */
+	uint32_t partial_size;
+	/* give the memory of a grown parse buffer back at the end of the
+	 * json_parser_string call, shrinking it to buffer_initial_size */
+	int shrink_buffer;
+	/* budget the parse buffer is taken from, or NULL */
+	json_budget *budget;
+	/* allocator of all the memory of the parser, instead of user_calloc and
+	 * user_realloc. it must stay valid until json_parser_free */
+	const json_allocator *allocator;
 } json_config;
 
 typedef struct json_parser {
@@ -109,6 +197,10 @@ typedef struct json_parser {
 	uint8_t save_state;
 	uint8_t expecting_key;
 	uint8_t utf8_multibyte_left;
+	uint8_t base64_value;
+	uint8_t suspended;
+	uint8_t pending_event;
+	uint8_t partial;
 	uint16_t unicode_multi;
 	json_type type;
 
@@ -121,6 +213,48 @@ typedef struct json_parser {
 	char *buffer;
 	uint32_t buffer_size;
 	uint32_t buffer_offset;
+	/* values, and keys, longer than these are delivered in pieces */
+	uint32_t partial_limit;
+	uint32_t partial_key_limit;
+	/* bytes of the config budget taken by this parser */
+	uint32_t budget_taken;
+
+	/* minify output */
+	json_printer_callback minify_callback;
+	void *minify_userdata;
+
+	/* event batch */
+	json_parser_batch_callback batch_callback;
+	void *batch_userdata;
+	json_event *batch_events;
+	uint32_t batch_events_size;
+	uint32_t batch_events_count;
+	char *batch_data;
+	uint32_t batch_data_size;
+	int batch_data_owned;
+
+	/* known keys: hash table of hash, length and id + 1, and member skipped */
+	struct json_parser_key { uint32_t hash; uint32_t length; uint32_t id; } *keys;
+	uint32_t keys_size;
+	int32_t key_id;
+	uint32_t skip_nesting;
+	uint8_t skip_value;
+
+	/* numeric arrays */
+	json_parser_array_match array_match;
+	json_parser_array_callback array_callback;
+	void *array_userdata;
+	uint32_t array_depth;
+	json_type array_type;
+	void *array_values;
+	uint32_t array_count;
+	uint32_t array_size;
+	char *array_text;
+	uint32_t array_text_offset;
+	uint32_t array_text_size;
+
+	/* index of the document parsed by json_parser_documents */
+	uint32_t document;
 } json_parser;
 
 typedef struct json_printer {
@@ -132,6 +266,8 @@ typedef struct json_printer {
 	int afterkey;
 	int enter_object;
 	int first;
+	/* print JSON_BSTRING as base64 instead of escaped bytes */
+	int base64;
 } json_printer;
 
 /** json_parser_init initialize a parser structure taking a config,
@@ -143,8 +279,38 @@ int json_parser_init(json_parser *parser, json_config *cfg,
 /** json_parser_free freed memory structure allocated by the parser */
 int json_parser_free(json_parser *parser);
 
+/** json_parser_reset makes the parser ready for a new document, as after
+ * json_parser_init, but keeping its memory, its callbacks and its modes
+ * (batch, arrays, minify). batched events not delivered yet are dropped */
+int json_parser_reset(json_parser *parser);
+
+/** pool of parsers sharing a config, kept with their grown memory between
+ * documents. get and put are lock-free, so threads can share a pool */
+typedef struct {
+	json_config config;
+	json_parser **slots;
+	uint32_t size;
+} json_parser_pool;
+
+/** json_parser_pool_init initializes a pool keeping up to size parsers.
+ * the config is copied */
+int json_parser_pool_init(json_parser_pool *pool, const json_config *config, uint32_t size);
+
+/** json_parser_pool_get gives a parser of the pool, or a new one, as after
+ * json_parser_init with the pool config and the callback */
+int json_parser_pool_get(json_parser_pool *pool, json_parser **parser,
+                         json_parser_callback callback, void *userdata);
+
+/** json_parser_pool_put gives a parser back to the pool, reset and out of the
+ * batch, arrays and minify modes. it is freed if the pool is full */
+int json_parser_pool_put(json_parser_pool *pool, json_parser *parser);
+
+/** json_parser_pool_free frees the pool and its parsers. all the parsers need
+ * to be put back before */
+int json_parser_pool_free(json_parser_pool *pool);
+
 /** json_parser_string append a string s with a specific length to the parser
- * return 0 if everything went ok, a JSON_ERROR_* otherwise.
+ * return 0 if everything went ok, a JSON_ERROR_* otherwise, or JSON_SUSPEND.
  * the user can supplied a valid processed pointer that will
  * be fill with the number of processed characters before returning */
 int json_parser_string(json_parser *parser, const char *string,
@@ -154,6 +320,85 @@ int json_parser_string(json_parser *parser, const char *string,
  * return 0 if everything went ok, a JSON_ERROR_* otherwise */
 int json_parser_char(json_parser *parser, unsigned char next_char);
 
+/** one document of a json_parser_documents call */
+typedef struct {
+	const char *data;
+	uint32_t length;
+} json_document;
+
+/** json_parser_documents parses count complete documents, resetting the parser
+ * before each one. the status of each document is stored in status when it's
+ * not NULL: 0, a JSON_ERROR_* (JSON_ERROR_INCOMPLETE if the document ends
+ * before its value), or JSON_SUSPEND if a callback suspended it. an error
+ * doesn't stop the following documents.
+ * return the number of documents with a non-zero status */
+int json_parser_documents(json_parser *parser, const json_document *documents,
+                          uint32_t count, int *status);
+
+/** json_parser_document returns the index of the document being parsed by
+ * json_parser_documents, for the callbacks */
+uint32_t json_parser_document(json_parser *parser);
+
+/** json_parser_minify makes the parser output the input it processes to a
+ * printer callback, without whitespace and comments. tokens are copied as they
+ * are in the input, escapes included, so nothing is decoded and re-encoded.
+ * the output is a valid minified document only if the whole input is valid.
+ * a non-zero return from the callback stops the parser with JSON_ERROR_CALLBACK */
+int json_parser_minify(json_parser *parser, json_printer_callback callback, void *userdata);
+
+/** json_parser_batch switches the parser to batch mode: instead of calling the
+ * parser callback for each event, the events are stored in the events array,
+ * the values are parsed directly in the data area, and the batch callback is
+ * called once with all of them when the array or the area is full, and at the
+ * end of each json_parser_string call. events and data are only valid during
+ * the call. it needs to be called before the first json_parser_string.
+ * a value that doesn't fit in the data area is a JSON_ERROR_DATA_LIMIT.
+ * with a NULL data, the parser allocates the area itself, of data_size bytes
+ * or the initial buffer size, and grows it like its parse buffer up to
+ * max_data, so values are limited exactly as without batch mode.
+ * a non-zero return from the batch callback is returned by json_parser_string */
+int json_parser_batch(json_parser *parser, json_event *events, uint32_t nb_events,
+                      char *data, uint32_t data_size,
+                      json_parser_batch_callback callback, void *userdata);
+
+/** json_parser_arrays makes the parser call match for each array, with the
+ * nesting level of the array. when match returns !0 and the array only contains
+ * numbers, the array is delivered in one call to the array callback instead of
+ * the array and number events. the values are int64_t, or double as soon as one
+ * number is a float or doesn't fit in an int64_t. if the array contains anything
+ * else, the parser falls back to the usual events for that array. */
+int json_parser_arrays(json_parser *parser, json_parser_array_match match,
+                       json_parser_array_callback callback, void *userdata);
+
+/** json_parser_key_id returns the id of the last key delivered: its index in the
+ * config keys, or JSON_KEY_UNKNOWN. to be called by the parser callback on JSON_KEY */
+int json_parser_key_id(json_parser *parser);
+
+/** json_parser_value makes a parser that didn't start accept one value of any type
+ * instead of an object or an array, to parse a value found with an index on its own */
+int json_parser_value(json_parser *parser);
+
+/** json_parser_value_end needs to be called once all the text of the value is given
+ * to a parser set by json_parser_value: it delivers a number, true, false or null
+ * that the parser delivers only on seeing what follows them */
+int json_parser_value_end(json_parser *parser);
+
+/** json_parser_save writes the state of the parser to callback: the position in
+ * the document and the value being parsed, but not the config and callbacks.
+ * stored with the offset of the input consumed so far, it lets another process
+ * continue the parse from there with json_parser_restore. the state is saved
+ * as it is in memory, so it is only restored by the same libjson version on
+ * the same architecture.
+ * return 0, the callback error, or JSON_ERROR_SNAPSHOT if batch events held
+ * back by a suspension haven't been delivered yet */
+int json_parser_save(json_parser *parser, json_printer_callback callback, void *userdata);
+
+/** json_parser_restore puts a parser, initialized with the same config and set
+ * up the same way, in the state saved in data, before any input is given to it.
+ * return 0, JSON_ERROR_SNAPSHOT if data isn't a saved parser state, or the
+ * error of the parser limits the state doesn't fit in */
+int json_parser_restore(json_parser *parser, const void *data, size_t size);
+
 /** json_parser_is_done return 0 is the parser isn't in a finish state. !0 if it is */
 int json_parser_is_done(json_parser *parser);
 
@@ -177,6 +422,22 @@ int json_print_raw(json_printer *printer, int type, const char *data, uint32_t l
  * the function call should always be terminated by -1 */
 int json_print_args(json_printer *, int (*f)(json_printer *, int, const char *, uint32_t), ...);
 
+/** json_print_int64_array prints an array of count integers in one call.
+ * f is json_print_pretty or json_print_raw, like for json_print_args. */
+int json_print_int64_array(json_printer *printer, int (*f)(json_printer *, int, const char *, uint32_t),
+                           const int64_t *values, uint32_t count);
+
+/** json_print_double_array prints an array of count doubles in one call, each
+ * with the fewest digits that read back as the same double. NaN and infinities
+ * are printed as null. */
+int json_print_double_array(json_printer *printer, int (*f)(json_printer *, int, const char *, uint32_t),
+                            const double *values, uint32_t count);
+
+/** json_print_string_array prints an array of count strings in one call.
+ * if lengths is NULL, the strings are zero terminated. a NULL string is printed as null. */
+int json_print_string_array(json_printer *printer, int (*f)(json_printer *, int, const char *, uint32_t),
+                            const char * const *strings, const uint32_t *lengths, uint32_t count);
+
 /** callback from the parser_dom callback to create object and array */
 typedef void * (*json_parser_dom_create_structure)(int, int);
 
@@ -187,6 +448,10 @@ typedef void * (*json_parser_dom_create_data)(int, const char *, uint32_t);
  * append(parent, key, key_length, val); */
 typedef int (*json_parser_dom_append)(void *, char *, uint32_t, void *);
 
+/** the JSON_PARTIAL pieces of a value, kept by the callbacks of the library
+ * until the last event of the value */
+struct json_partial { char *data; uint32_t length; uint32_t size; };
+
 /** the json_parser_dom permits to create a DOM like tree easily through the
  * use of 3 callbacks where the user can choose the representation of the JSON values */
 typedef struct json_parser_dom
@@ -200,13 +465,27 @@ typedef struct json_parser_dom
 	void * (*user_calloc)(size_t nmemb, size_t size);
 	void * (*user_realloc)(void *ptr, size_t size);
 
-	/* returned root structure (object or array) */
+	/* returned root structure (object or array), or value parsed with json_parser_value */
 	void *root_structure;
 
 	/* callbacks */
 	json_parser_dom_create_structure create_structure;
 	json_parser_dom_create_data create_data;
 	json_parser_dom_append append;
+
+	/* interned keys and short strings, in a hash set, stored in blocks */
+	int intern;
+	uint32_t intern_max_length;
+	struct json_parser_dom_string { uint32_t hash; uint32_t length; char *data; } *intern_table;
+	uint32_t intern_size;
+	uint32_t intern_count;
+	struct json_parser_dom_block { struct json_parser_dom_block *next; uint32_t offset; uint32_t size; } *intern_blocks;
+
+	/* allocator set by json_parser_dom_allocator, instead of user_calloc and user_realloc */
+	const json_allocator *allocator;
+
+	/* pieces of the value being parsed with partial_size */
+	struct json_partial partial;
 } json_parser_dom;
 
 /** initialize a parser dom structure with the necessary callbacks */
@@ -214,12 +493,344 @@ int json_parser_dom_init(json_parser_dom *helper,
                          json_parser_dom_create_structure create_structure,
                          json_parser_dom_create_data create_data,
                          json_parser_dom_append append);
+/** json_parser_dom_intern makes the DOM helper keep a single copy of each different
+ * key, and of each different string up to max_string_length: the key given to append
+ * and the data of those strings given to create_data are then shared, zero terminated,
+ * and kept until json_parser_dom_free. they must not be modified nor freed */
+int json_parser_dom_intern(json_parser_dom *dom, uint32_t max_string_length);
+/** json_parser_dom_allocator makes the DOM helper allocate and free all its memory
+ * with allocator, which must stay valid until json_parser_dom_free. it is called
+ * after json_parser_dom_init, before parsing */
+int json_parser_dom_allocator(json_parser_dom *dom, const json_allocator *allocator);
+/** json_parser_dom_reset makes the DOM helper ready for a new document, keeping
+ * its memory. interned strings are kept, shared by the trees of all documents */
+int json_parser_dom_reset(json_parser_dom *dom);
 /** free memory allocated by the DOM callback helper */
 int json_parser_dom_free(json_parser_dom *ctx);
 
 /** helper to parser callback that arrange parsing events into comprehensive JSON data structure */
 int json_parser_dom_callback(void *userdata, int type, const char *data, uint32_t length);
 
+#define JSON_OBJECT_INDEX_THRESHOLD 16
+
+/** a member of a json_object */
+typedef struct json_object_member
+{
+	char *key;
+	uint32_t key_length;
+	void *value;
+} json_object_member;
+
+/** an object for DOM trees: its members in order, and for large objects a hash
+ * index of their keys, built by the first lookup needing it */
+typedef struct json_object
+{
+	json_object_member *members;
+	uint32_t count;
+	uint32_t size;
+
+	/* open addressing table of hash and member + 1, of the first indexed members */
+	struct json_object_slot { uint32_t hash; uint32_t member; } *index;
+	uint32_t index_size;
+	uint32_t indexed;
+
+	/* allocator of the members and the index, or NULL */
+	const json_allocator *allocator;
+} json_object;
+
+/** initialize an empty object, allocating with allocator, or the standard functions
+ * if NULL. the allocator must stay valid until json_object_free */
+int json_object_init(json_object *obj, const json_allocator *allocator);
+/** free memory allocated by the object, leaving it empty. keys and values are the caller's */
+int json_object_free(json_object *obj);
+
+/** json_object_append adds a member at the end of the object. the key is kept, not copied */
+int json_object_append(json_object *obj, char *key, uint32_t key_length, void *value);
+
+/** json_object_find returns the first member with key, or NULL. objects of at least
+ * JSON_OBJECT_INDEX_THRESHOLD members are looked up in their hash index, others
+ * are scanned */
+json_object_member *json_object_find(json_object *obj, const char *key, uint32_t key_length);
+
+/** the json_recorder writes the events it gets as a parser callback in a compact
+ * binary format, that json_replay gives back to any parser callback without parsing */
+typedef struct json_recorder
+{
+	json_printer_callback callback;
+	void *userdata;
+
+	/* output buffer, given to the callback after each whole value */
+	char *buffer;
+	uint32_t buffer_offset;
+	uint32_t depth;
+
+	/* interned keys */
+	struct json_recorder_key { uint32_t hash; uint32_t length; uint32_t index; char *key; } *keys;
+	uint32_t keys_size;
+	uint32_t keys_count;
+
+	/* pieces of the value being parsed with partial_size */
+	struct json_partial partial;
+
+	/* allocator of all the memory of the recorder, or NULL */
+	const json_allocator *allocator;
+} json_recorder;
+
+/** initialize a recorder that outputs the record to callback. it allocates with
+ * allocator, or the standard functions if NULL, until json_recorder_free */
+int json_recorder_init(json_recorder *rec, json_printer_callback callback, void *userdata,
+                       const json_allocator *allocator);
+/** free memory allocated by the recorder */
+int json_recorder_free(json_recorder *rec);
+
+/** parser callback recording the events, with a json_recorder as userdata */
+int json_recorder_callback(void *userdata, int type, const char *data, uint32_t length);
+
+/** json_replay calls callback with every event recorded in data.
+ * the data given to the callback points into the record, except for integers.
+ * its memory comes from allocator, or the standard functions if NULL.
+ * return 0, the callback error, or JSON_ERROR_RECORD if the record is invalid */
+int json_replay(const char *data, size_t length, json_parser_callback callback, void *userdata,
+                const json_allocator *allocator);
+
+typedef enum
+{
+	/* CBOR, RFC 8949 */
+	JSON_FORMAT_CBOR,
+	/* MessagePack */
+	JSON_FORMAT_MSGPACK,
+} json_binary_format;
+
+/** the json_encoder encodes the events it gets as a parser callback in CBOR or
+ * MessagePack. arrays and objects are given with their number of elements,
+ * so a value is output only once it's whole. */
+typedef struct json_encoder
+{
+	json_binary_format format;
+	json_printer_callback callback;
+	void *userdata;
+
+	/* the value being encoded, without the heads of its arrays and objects */
+	char *buffer;
+	uint32_t buffer_offset;
+	uint32_t buffer_size;
+	char *output;
+	uint32_t output_size;
+
+	/* heads of the arrays and objects of the value, in order */
+	struct json_encoder_header { uint32_t offset; uint32_t count; int type; } *headers;
+	uint32_t headers_count;
+	uint32_t headers_size;
+
+	/* indexes in headers of the arrays and objects not finished */
+	uint32_t *stack;
+	uint32_t stack_offset;
+	uint32_t stack_size;
+
+	/* pieces of the value being parsed with partial_size */
+	struct json_partial partial;
+
+	/* allocator of all the memory of the encoder, or NULL */
+	const json_allocator *allocator;
+} json_encoder;
+
+/** initialize an encoder to format, that outputs the encoded values to callback. it
+ * allocates with allocator, or the standard functions if NULL, until json_encoder_free */
+int json_encoder_init(json_encoder *enc, json_binary_format format,
+                      json_printer_callback callback, void *userdata,
+                      const json_allocator *allocator);
+/** free memory allocated by the encoder */
+int json_encoder_free(json_encoder *enc);
+
+/** parser callback encoding the events, with a json_encoder as userdata.
+ * integers out of [-2^64, 2^64-1] in CBOR, or [INT64_MIN, UINT64_MAX] in MessagePack,
+ * are encoded as doubles. */
+int json_encoder_callback(void *userdata, int type, const char *data, uint32_t length);
+
+/** json_decode calls callback with the events of the CBOR or MessagePack values
+ * in data. numbers are given as their text, strings are zero terminated.
+ * its memory comes from allocator, or the standard functions if NULL.
+ * return 0, the callback error, or JSON_ERROR_BINARY_FORMAT if data is invalid
+ * or has a value JSON can't represent */
+int json_decode(json_binary_format format, const char *data, size_t length,
+                json_parser_callback callback, void *userdata, const json_allocator *allocator);
+
+/** the json_snapshot_writer writes the value it gets as a parser callback as a
+ * snapshot: a tree where nodes refer to each other by offset, that can be read in
+ * place, from memory or from a mapped file, by the json_snapshot functions.
+ * the snapshot is in the byte order of the machine writing it. */
+typedef struct json_snapshot_writer
+{
+	json_printer_callback callback;
+	void *userdata;
+
+	/* output buffer, and size of the snapshot written */
+	char *buffer;
+	uint32_t buffer_offset;
+	uint32_t offset;
+	int done;
+
+	/* arrays and objects not finished, with the offsets of their values */
+	struct json_snapshot_level { uint32_t start; int type; } *stack;
+	uint32_t stack_offset;
+	uint32_t stack_size;
+	uint32_t *children;
+	uint32_t children_count;
+	uint32_t children_size;
+
+	/* interned keys, each written once */
+	struct json_snapshot_key { uint32_t hash; uint32_t length; uint32_t offset; char *key; } *keys;
+	uint32_t keys_count;
+	uint32_t keys_size;
+	uint32_t *table;
+	uint32_t table_size;
+
+	/* space to sort object members */
+	uint32_t *sort;
+	uint32_t sort_size;
+
+	/* pieces of the value being parsed with partial_size */
+	struct json_partial partial;
+
+	/* allocator of all the memory of the writer, or NULL */
+	const json_allocator *allocator;
+} json_snapshot_writer;
+
+/** initialize a snapshot writer that outputs the snapshot to callback. it allocates
+ * with allocator, or the standard functions if NULL, until json_snapshot_writer_free */
+int json_snapshot_writer_init(json_snapshot_writer *w, json_printer_callback callback, void *userdata,
+                              const json_allocator *allocator);
+/** free memory allocated by the snapshot writer */
+int json_snapshot_writer_free(json_snapshot_writer *w);
+
+/** parser callback writing the snapshot, with a json_snapshot_writer as userdata.
+ * the snapshot is output once the value is whole */
+int json_snapshot_writer_callback(void *userdata, int type, const char *data, uint32_t length);
+
+/** a snapshot being read. nodes are designated by their offset, 0 is no node */
+typedef struct json_snapshot
+{
+	const char *data;
+	uint32_t size;
+	uint32_t root;
+} json_snapshot;
+
+/** json_snapshot_open checks that data holds a snapshot, and initializes snap to read
+ * it in place. data needs to be 4 bytes aligned, and kept while snap is used.
+ * return 0 or JSON_ERROR_SNAPSHOT */
+int json_snapshot_open(json_snapshot *snap, const void *data, size_t size);
+
+/** json_snapshot_type returns the type of a node: JSON_ARRAY_BEGIN or JSON_OBJECT_BEGIN
+ * for arrays and objects, or JSON_NONE if node isn't valid */
+int json_snapshot_type(const json_snapshot *snap, uint32_t node);
+
+/** json_snapshot_length returns the number of elements of an array, of members of an
+ * object, or the length of the data of a string, key or number */
+uint32_t json_snapshot_length(const json_snapshot *snap, uint32_t node);
+
+/** json_snapshot_data returns the zero terminated data of a string, key or number */
+const char *json_snapshot_data(const json_snapshot *snap, uint32_t node);
+
+/** json_snapshot_get returns the element at index of an array, or the value of the
+ * member at index of an object */
+uint32_t json_snapshot_get(const json_snapshot *snap, uint32_t node, uint32_t index);
+
+/** json_snapshot_key returns the key of the member at index of an object */
+uint32_t json_snapshot_key(const json_snapshot *snap, uint32_t node, uint32_t index);
+
+/** json_snapshot_find returns the value of the member of an object with this key,
+ * found by binary search */
+uint32_t json_snapshot_find(const json_snapshot *snap, uint32_t node, const char *key, uint32_t key_length);
+
+#define JSON_INDEX_MAX_DEPTH 16
+#define JSON_INDEX_NONE 0xffffffff
+
+/** where a value is in the indexed input */
+typedef struct json_index_entry
+{
+	/* first character of the value, and length of its text */
+	uint64_t offset;
+	uint64_t length;
+	/* entry of the array or object holding the value, JSON_INDEX_NONE for the root */
+	uint32_t parent;
+	/* entries of the elements or members of an array or object, which are
+	 * consecutive. count is 0 below the depth indexed */
+	uint32_t first;
+	uint32_t count;
+	/* JSON_ARRAY_BEGIN, JSON_OBJECT_BEGIN, JSON_STRING, JSON_INT, JSON_FLOAT,
+	 * JSON_TRUE, JSON_FALSE or JSON_NULL */
+	uint32_t type;
+	/* for a member, its key as written in the input, in keys */
+	uint32_t key;
+	uint32_t key_length;
+} json_index_entry;
+
+/** an index of the values of a json input down to a depth, to parse one of them
+ * without the rest of the input: the entry gives where the value is, so it can be
+ * read from there by a parser set with json_parser_value.
+ * the index is built from the text alone, much faster than parsing, and doesn't
+ * validate the input. it can be saved and read in place with json_index_open. */
+typedef struct json_index
+{
+	/* the root is entry 0, followed by the values of each depth in order */
+	json_index_entry *entries;
+	uint32_t nb_entries;
+	/* for the members of each object, their entries in key order */
+	uint32_t *sorted;
+	char *keys;
+	uint32_t keys_length;
+	uint32_t max_depth;
+	int owned;
+
+	/* input read so far: position, nesting and token being read */
+	uint64_t offset;
+	uint32_t depth;
+	int lex;
+	uint32_t keys_size;
+
+	/* the values found at each depth, and what's expected next at that depth */
+	struct json_index_level {
+		json_index_entry *entries;
+		uint32_t count;
+		uint32_t size;
+		int object;
+		int expect;
+		uint32_t key;
+		uint32_t key_length;
+	} levels[JSON_INDEX_MAX_DEPTH + 1];
+
+	/* allocator of all the memory of the index, or NULL */
+	const json_allocator *allocator;
+} json_index;
+
+/** json_index_init initializes an index of the values down to max_depth: 0 for
+ * the root only, 1 for the elements or members of the root... it allocates with
+ * allocator, or the standard functions if NULL, until json_index_free */
+int json_index_init(json_index *index, uint32_t max_depth, const json_allocator *allocator);
+/** free memory allocated by the index */
+int json_index_free(json_index *index);
+
+/** json_index_string reads the next length characters of the input */
+int json_index_string(json_index *index, const char *s, uint32_t length);
+/** json_index_finish finishes the index once all the input has been read.
+ * return 0 or JSON_ERROR_INDEX if the input isn't one whole value */
+int json_index_finish(json_index *index);
+
+/** json_index_save writes a finished index to callback, in the byte order of the machine */
+int json_index_save(const json_index *index, json_printer_callback callback, void *userdata);
+/** json_index_open checks that data holds a saved index, and initializes index to
+ * read it in place. data needs to be 8 bytes aligned, and kept while index is used.
+ * return 0 or JSON_ERROR_INDEX */
+int json_index_open(json_index *index, const void *data, size_t size);
+
+/** json_index_get returns the entry of the element at n of an array entry, or of
+ * the member at n of an object entry. JSON_INDEX_NONE if it's not indexed */
+uint32_t json_index_get(const json_index *index, uint32_t entry, uint32_t n);
+
+/** json_index_find returns the entry of the member of an object entry with this key,
+ * compared to the key as written in the input. JSON_INDEX_NONE if it's not indexed */
+uint32_t json_index_find(const json_index *index, uint32_t entry, const char *key, uint32_t key_length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,882 @@
+/*
+ * Copyright (C) 2009-2011 Vincent Hanquez <vincent@snarc.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 or version 3.0 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#include "json.h"
+
+#if __cplusplus >= 201103L
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+#endif
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#define JSON_HPP_COROUTINES 1
+#endif
+
+namespace json {
+
+typedef int (*json_printer_function)(json_printer *printer, int type, const char *data, uint32_t length);
+
+/** handler ignoring every event, to derive handlers from. the parser calls the
+ * member functions of the handler type directly, so they can be inlined in the
+ * event loop. data is zero terminated and only valid during the call.
+ * a non-zero return stops the parser, which returns it. a handler can't
+ * suspend the parser with JSON_SUSPEND: pull the events from a stream instead */
+struct handler {
+	int on_object_begin() { return 0; }
+	int on_object_end() { return 0; }
+	int on_array_begin() { return 0; }
+	int on_array_end() { return 0; }
+	/* key_id is the id of the key in the config keys, or JSON_KEY_UNKNOWN */
+	int on_key(const char *data, uint32_t length, int32_t key_id)
+		{ (void) data; (void) length; (void) key_id; return 0; }
+	int on_string(const char *data, uint32_t length) { (void) data; (void) length; return 0; }
+	int on_bstring(const char *data, uint32_t length) { (void) data; (void) length; return 0; }
+	/* a piece of a value longer than the config partial_size */
+	int on_partial(const char *data, uint32_t length) { (void) data; (void) length; return 0; }
+	int on_int(const char *data, uint32_t length) { (void) data; (void) length; return 0; }
+	int on_float(const char *data, uint32_t length) { (void) data; (void) length; return 0; }
+	int on_true() { return 0; }
+	int on_false() { return 0; }
+	int on_null() { return 0; }
+};
+
+/** dispatch calls the handler for each of nb_events batched events, and returns
+ * the first non-zero return of the handler. it can be used in a batch callback */
+template <class Handler>
+inline int dispatch(Handler &h, const json_event *events, uint32_t nb_events, const char *data)
+{
+	uint32_t i;
+	int ret = 0;
+
+	for (i = 0; i < nb_events && ret == 0; i++) {
+		const char *s = data + events[i].offset;
+		uint32_t length = events[i].length;
+
+		switch (events[i].type) {
+		case JSON_OBJECT_BEGIN: ret = h.on_object_begin(); break;
+		case JSON_OBJECT_END: ret = h.on_object_end(); break;
+		case JSON_ARRAY_BEGIN: ret = h.on_array_begin(); break;
+		case JSON_ARRAY_END: ret = h.on_array_end(); break;
+		case JSON_KEY: ret = h.on_key(s, length, events[i].key_id); break;
+		case JSON_STRING: ret = h.on_string(s, length); break;
+		case JSON_BSTRING: ret = h.on_bstring(s, length); break;
+		case JSON_PARTIAL: ret = h.on_partial(s, length); break;
+		case JSON_INT: ret = h.on_int(s, length); break;
+		case JSON_FLOAT: ret = h.on_float(s, length); break;
+		case JSON_TRUE: ret = h.on_true(); break;
+		case JSON_FALSE: ret = h.on_false(); break;
+		case JSON_NULL: ret = h.on_null(); break;
+		}
+	}
+	return ret;
+}
+
+/** parser delivering the events of the input to a handler. it runs the C parser
+ * in batch mode, so there's one indirect call per batch of events instead of
+ * one per event, and the handler calls are resolved at compile time.
+ * the events and errors are the ones of json_parser_string: values are limited
+ * by max_data only, and a non-zero handler return is returned by string even if
+ * the parser found an error further in the same input */
+template <class Handler, uint32_t NbEvents = 256>
+class parser {
+public:
+	explicit parser(Handler &h, const json_config *config = 0)
+		: h_(h), error_(0), stopped_(0), init_(false)
+	{
+		json_config cfg = config ? *config : json_config();
+
+		error_ = json_parser_init(&parser_, &cfg, 0, 0);
+		if (error_)
+			return;
+		init_ = true;
+		error_ = json_parser_batch(&parser_, events_, NbEvents, 0, 0, &batch, this);
+	}
+
+	~parser()
+	{
+		if (init_)
+			json_parser_free(&parser_);
+	}
+
+	/** string parses the next length bytes of the input, like json_parser_string */
+	int string(const char *s, uint32_t length, uint32_t *processed = 0)
+	{
+		int ret;
+
+		if (error_ || stopped_)
+			return error_ ? error_ : stopped_;
+		ret = json_parser_string(&parser_, s, length, processed);
+		return stopped_ ? stopped_ : ret;
+	}
+
+	/** is_done returns true when a complete document has been parsed */
+	bool is_done() { return !error_ && json_parser_is_done(&parser_); }
+
+	/** c_parser returns the underlying parser, to set it up with the C API */
+	json_parser *c_parser() { return &parser_; }
+
+private:
+	static int batch(void *userdata, const json_event *events, uint32_t nb_events, const char *data)
+	{
+		parser *p = static_cast<parser *>(userdata);
+
+		if (!p->stopped_)
+			p->stopped_ = dispatch(p->h_, events, nb_events, data);
+		return p->stopped_;
+	}
+
+	/* the C parser has pointers to itself and to the event array */
+	parser(const parser &);
+	parser &operator=(const parser &);
+
+	Handler &h_;
+	json_parser parser_;
+	json_event events_[NbEvents];
+	int error_;
+	int stopped_;
+	bool init_;
+};
+
+/** parse parses the length bytes of buf, delivering the events to h. it returns
+ * what parser::string returns: like json_parser_string, a truncated document
+ * isn't an error, use a parser and is_done to check for it */
+template <class Handler>
+inline int parse(const char *buf, uint32_t length, Handler &h, const json_config *config = 0)
+{
+	parser<Handler> p(h, config);
+
+	return p.string(buf, length);
+}
+
+#if __cplusplus >= 201103L
+
+/** a struct bound with JSON_BIND can be decoded from and encoded to a JSON object
+ * with a member per field. the fields can be bool, integer and floating point
+ * types, std::string, std::vector of those and other bound structs, which need
+ * to be bound before the structs that contain them:
+ *
+ *	JSON_BIND(point, JSON_FIELD(x), JSON_FIELD(y), JSON_FIELD_KEY(label, "name"))
+ *
+ * it has to be used outside of any namespace */
+#define JSON_BIND(T, ...) \
+	namespace json { \
+	template <> struct binding<T> { \
+		typedef T json_bound_type; \
+		static const field *fields(uint32_t *count) \
+		{ \
+			static constexpr field f[] = { __VA_ARGS__ }; \
+			*count = sizeof(f) / sizeof(f[0]); \
+			return f; \
+		} \
+	}; \
+	}
+
+/** a field bound to the member of the same name */
+#define JSON_FIELD(name) JSON_FIELD_KEY(name, #name)
+
+/** a field bound to the member key */
+#define JSON_FIELD_KEY(name, key) \
+	::json::make_field<json_bound_type, decltype(json_bound_type::name), \
+	                   &json_bound_type::name>(key, sizeof(key) - 1)
+
+/** maximum nesting of the bound values a decoder goes into */
+#define JSON_BIND_MAX_DEPTH 64
+
+enum { BIND_SCALAR, BIND_STRUCT, BIND_VECTOR };
+
+struct field;
+
+/* what the decoder and the encoder know of a bound type */
+struct type_ops {
+	int kind;
+	/* scalars: convert the data of a value event, or print the value */
+	int (*decode)(void *dst, int type, const char *data, uint32_t length);
+	int (*encode)(json_printer *printer, json_printer_function f, const void *src);
+	/* structs */
+	const field *(*fields)(uint32_t *count);
+	/* vectors: append a default element and return it, or access the elements */
+	void *(*push)(void *dst);
+	size_t (*size)(const void *src);
+	const void *(*at)(const void *src, size_t n);
+	const type_ops *element;
+};
+
+struct field {
+	const char *key;
+	uint32_t key_length;
+	uint32_t hash;
+	void *(*get)(void *obj);
+	const void *(*cget)(const void *obj);
+	const type_ops *ops;
+};
+
+/* FNV-1a, the hash of the parser keys */
+constexpr uint32_t key_hash(const char *s, uint32_t length, uint32_t hash = 2166136261u)
+{
+	return length == 0 ? hash
+	                   : key_hash(s + 1, length - 1, (hash ^ (unsigned char) *s) * 16777619u);
+}
+
+template <class T> struct binding;
+template <class T, class Enable = void> struct ops;
+
+template <class T, class M, M T::*P>
+void *member(void *obj) { return &(static_cast<T *>(obj)->*P); }
+
+template <class T, class M, M T::*P>
+const void *const_member(const void *obj) { return &(static_cast<const T *>(obj)->*P); }
+
+template <class T, class M, M T::*P>
+constexpr field make_field(const char *key, uint32_t key_length)
+{
+	return field { key, key_length, key_hash(key, key_length),
+	               &member<T, M, P>, &const_member<T, M, P>, &ops<M>::desc };
+}
+
+/* bound structs */
+template <class T, class Enable>
+struct ops {
+	static const type_ops desc;
+};
+
+template <class T, class Enable>
+const type_ops ops<T, Enable>::desc = { BIND_STRUCT, 0, 0, &binding<T>::fields, 0, 0, 0, 0 };
+
+template <class T>
+struct ops<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+	static int decode(void *dst, int type, const char *data, uint32_t length)
+	{
+		char *end;
+
+		(void) length;
+		if (type != JSON_INT)
+			return JSON_ERROR_BIND;
+		errno = 0;
+		if (std::is_signed<T>::value) {
+			long long v = strtoll(data, &end, 10);
+			if (errno || v < (long long) std::numeric_limits<T>::min()
+			          || v > (long long) std::numeric_limits<T>::max())
+				return JSON_ERROR_BIND;
+			*static_cast<T *>(dst) = (T) v;
+		} else {
+			unsigned long long v = strtoull(data, &end, 10);
+			if (errno || data[0] == '-' || v > (unsigned long long) std::numeric_limits<T>::max())
+				return JSON_ERROR_BIND;
+			*static_cast<T *>(dst) = (T) v;
+		}
+		return 0;
+	}
+
+	static int encode(json_printer *printer, json_printer_function f, const void *src)
+	{
+		char buf[32];
+		int n;
+
+		if (std::is_signed<T>::value)
+			n = snprintf(buf, sizeof(buf), "%lld", (long long) *static_cast<const T *>(src));
+		else
+			n = snprintf(buf, sizeof(buf), "%llu", (unsigned long long) *static_cast<const T *>(src));
+		return f(printer, JSON_INT, buf, n);
+	}
+
+	static const type_ops desc;
+};
+
+template <class T>
+const type_ops ops<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>::desc =
+	{ BIND_SCALAR, &decode, &encode, 0, 0, 0, 0, 0 };
+
+template <class T>
+struct ops<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+	static int decode(void *dst, int type, const char *data, uint32_t length)
+	{
+		(void) length;
+		if (type != JSON_INT && type != JSON_FLOAT)
+			return JSON_ERROR_BIND;
+		*static_cast<T *>(dst) = (T) strtod(data, NULL);
+		return 0;
+	}
+
+	/* the shortest of the precisions giving back the same value */
+	static int encode(json_printer *printer, json_printer_function f, const void *src)
+	{
+		double v = *static_cast<const T *>(src);
+		char buf[32];
+		int n = 0, precision;
+
+		if (!std::isfinite(v))
+			return JSON_ERROR_BIND;
+		for (precision = std::numeric_limits<T>::digits10; precision <= std::numeric_limits<T>::max_digits10; precision++) {
+			n = snprintf(buf, sizeof(buf), "%.*g", precision, v);
+			if ((T) strtod(buf, NULL) == (T) v)
+				break;
+		}
+		return f(printer, (strpbrk(buf, ".eE") ? JSON_FLOAT : JSON_INT), buf, n);
+	}
+
+	static const type_ops desc;
+};
+
+template <class T>
+const type_ops ops<T, typename std::enable_if<std::is_floating_point<T>::value>::type>::desc =
+	{ BIND_SCALAR, &decode, &encode, 0, 0, 0, 0, 0 };
+
+template <class T>
+struct ops<T, typename std::enable_if<std::is_same<T, bool>::value>::type> {
+	static int decode(void *dst, int type, const char *data, uint32_t length)
+	{
+		(void) data; (void) length;
+		if (type != JSON_TRUE && type != JSON_FALSE)
+			return JSON_ERROR_BIND;
+		*static_cast<bool *>(dst) = (type == JSON_TRUE);
+		return 0;
+	}
+
+	static int encode(json_printer *printer, json_printer_function f, const void *src)
+	{
+		return f(printer, *static_cast<const bool *>(src) ? JSON_TRUE : JSON_FALSE, NULL, 0);
+	}
+
+	static const type_ops desc;
+};
+
+template <class T>
+const type_ops ops<T, typename std::enable_if<std::is_same<T, bool>::value>::type>::desc =
+	{ BIND_SCALAR, &decode, &encode, 0, 0, 0, 0, 0 };
+
+template <class T>
+struct ops<T, typename std::enable_if<std::is_same<T, std::string>::value>::type> {
+	static int decode(void *dst, int type, const char *data, uint32_t length)
+	{
+		if (type != JSON_STRING && type != JSON_BSTRING)
+			return JSON_ERROR_BIND;
+		static_cast<std::string *>(dst)->assign(data, length);
+		return 0;
+	}
+
+	static int encode(json_printer *printer, json_printer_function f, const void *src)
+	{
+		const std::string *s = static_cast<const std::string *>(src);
+
+		return f(printer, JSON_STRING, s->data(), (uint32_t) s->size());
+	}
+
+	static const type_ops desc;
+};
+
+template <class T>
+const type_ops ops<T, typename std::enable_if<std::is_same<T, std::string>::value>::type>::desc =
+	{ BIND_SCALAR, &decode, &encode, 0, 0, 0, 0, 0 };
+
+/* the elements need an address: std::vector<bool> can't be bound */
+template <class E>
+struct ops<std::vector<E>, typename std::enable_if<!std::is_same<E, bool>::value>::type> {
+	static void *push(void *dst)
+	{
+		std::vector<E> *v = static_cast<std::vector<E> *>(dst);
+
+		v->emplace_back();
+		return &v->back();
+	}
+
+	static size_t size(const void *src) { return static_cast<const std::vector<E> *>(src)->size(); }
+
+	static const void *at(const void *src, size_t n)
+	{
+		return &(*static_cast<const std::vector<E> *>(src))[n];
+	}
+
+	static const type_ops desc;
+};
+
+template <class E>
+const type_ops ops<std::vector<E>, typename std::enable_if<!std::is_same<E, bool>::value>::type>::desc =
+	{ BIND_VECTOR, 0, 0, 0, &push, &size, &at, &ops<E>::desc };
+
+/** decoder is a handler decoding the events of one value into a bound type.
+ * members with no field are skipped, null leaves the field as it is, and a value
+ * of the wrong type, or a number out of the range of the field, is a
+ * JSON_ERROR_BIND */
+template <class T>
+class decoder : public handler {
+public:
+	explicit decoder(T &value)
+		: depth_(0), skip_(0), target_(&value), target_ops_(&ops<T>::desc) {}
+
+	int on_object_begin() { return begin(BIND_STRUCT); }
+	int on_object_end() { return end(); }
+	int on_array_begin() { return begin(BIND_VECTOR); }
+	int on_array_end() { return end(); }
+
+	/* the pieces of a value are joined before decoding it */
+	int on_partial(const char *data, uint32_t length)
+	{
+		if (!skip_)
+			partial_.append(data, length);
+		return 0;
+	}
+
+	int on_key(const char *key, uint32_t length, int32_t key_id)
+	{
+		struct frame *frame = &frames_[depth_ - 1];
+		uint32_t hash = 2166136261u, i;
+
+		(void) key_id;
+		if (skip_)
+			return 0;
+		if (!partial_.empty()) {
+			std::string whole;
+			whole.swap(partial_);
+			whole.append(key, length);
+			return on_key(whole.data(), (uint32_t) whole.size(), key_id);
+		}
+		for (i = 0; i < length; i++)
+			hash = (hash ^ (unsigned char) key[i]) * 16777619u;
+		target_ = 0;
+		for (i = 0; i < frame->nb_fields; i++) {
+			const field *f = &frame->fields[i];
+			if (f->hash == hash && f->key_length == length && memcmp(f->key, key, length) == 0) {
+				target_ = f->get(frame->obj);
+				target_ops_ = f->ops;
+				break;
+			}
+		}
+		return 0;
+	}
+
+	int on_string(const char *data, uint32_t length) { return scalar(JSON_STRING, data, length); }
+	int on_bstring(const char *data, uint32_t length) { return scalar(JSON_BSTRING, data, length); }
+	int on_int(const char *data, uint32_t length) { return scalar(JSON_INT, data, length); }
+	int on_float(const char *data, uint32_t length) { return scalar(JSON_FLOAT, data, length); }
+	int on_true() { return scalar(JSON_TRUE, NULL, 0); }
+	int on_false() { return scalar(JSON_FALSE, NULL, 0); }
+	int on_null() { return scalar(JSON_NULL, NULL, 0); }
+
+private:
+	/* the destination of the value starting: a new element in an array,
+	 * the field of the last key in an object, or the root value.
+	 * NULL if the value isn't bound */
+	void *value(const type_ops **o)
+	{
+		void *dst;
+
+		if (depth_ > 0 && frames_[depth_ - 1].ops->kind == BIND_VECTOR) {
+			*o = frames_[depth_ - 1].ops->element;
+			return frames_[depth_ - 1].ops->push(frames_[depth_ - 1].obj);
+		}
+		dst = target_;
+		*o = target_ops_;
+		target_ = 0;
+		return dst;
+	}
+
+	int scalar(int type, const char *data, uint32_t length)
+	{
+		const type_ops *o;
+		void *dst;
+
+		if (skip_)
+			return 0;
+		if (!partial_.empty()) {
+			std::string whole;
+			whole.swap(partial_);
+			whole.append(data, length);
+			return scalar(type, whole.data(), (uint32_t) whole.size());
+		}
+		dst = value(&o);
+		if (!dst || type == JSON_NULL)
+			return 0;
+		if (o->kind != BIND_SCALAR)
+			return JSON_ERROR_BIND;
+		return o->decode(dst, type, data, length);
+	}
+
+	int begin(int kind)
+	{
+		const type_ops *o;
+		void *dst;
+
+		if (skip_) {
+			skip_++;
+			return 0;
+		}
+		dst = value(&o);
+		if (!dst) {
+			skip_ = 1;
+			return 0;
+		}
+		if (o->kind != kind)
+			return JSON_ERROR_BIND;
+		if (depth_ == JSON_BIND_MAX_DEPTH)
+			return JSON_ERROR_NESTING_LIMIT;
+		frames_[depth_].obj = dst;
+		frames_[depth_].ops = o;
+		frames_[depth_].fields = (kind == BIND_STRUCT) ? o->fields(&frames_[depth_].nb_fields) : 0;
+		depth_++;
+		return 0;
+	}
+
+	int end()
+	{
+		if (skip_)
+			skip_--;
+		else
+			depth_--;
+		return 0;
+	}
+
+	struct frame {
+		void *obj;
+		const type_ops *ops;
+		const field *fields;
+		uint32_t nb_fields;
+	} frames_[JSON_BIND_MAX_DEPTH];
+	uint32_t depth_;
+	uint32_t skip_;
+	void *target_;
+	const type_ops *target_ops_;
+	std::string partial_;
+};
+
+/** decode decodes the JSON value of the length bytes of buf into value.
+ * return 0, a parser error, JSON_ERROR_BIND if the value doesn't match the
+ * bound type, or JSON_ERROR_INCOMPLETE if the input ends before the value */
+template <class T>
+inline int decode(const char *buf, uint32_t length, T &value, const json_config *config = 0)
+{
+	decoder<T> d(value);
+	parser<decoder<T> > p(d, config);
+	int ret;
+
+	ret = p.string(buf, length);
+	if (!ret && !p.is_done())
+		ret = JSON_ERROR_INCOMPLETE;
+	return ret;
+}
+
+inline int encode_value(json_printer *printer, json_printer_function f,
+                        const type_ops *o, const void *src)
+{
+	uint32_t count, i;
+	const field *fields;
+	size_t n, size;
+	int ret;
+
+	switch (o->kind) {
+	case BIND_SCALAR:
+		return o->encode(printer, f, src);
+	case BIND_STRUCT:
+		fields = o->fields(&count);
+		if ((ret = f(printer, JSON_OBJECT_BEGIN, NULL, 0)))
+			return ret;
+		for (i = 0; i < count; i++) {
+			if ((ret = f(printer, JSON_KEY, fields[i].key, fields[i].key_length)))
+				return ret;
+			if ((ret = encode_value(printer, f, fields[i].ops, fields[i].cget(src))))
+				return ret;
+		}
+		return f(printer, JSON_OBJECT_END, NULL, 0);
+	case BIND_VECTOR:
+		if ((ret = f(printer, JSON_ARRAY_BEGIN, NULL, 0)))
+			return ret;
+		size = o->size(src);
+		for (n = 0; n < size; n++)
+			if ((ret = encode_value(printer, f, o->element, o->at(src, n))))
+				return ret;
+		return f(printer, JSON_ARRAY_END, NULL, 0);
+	}
+	return JSON_ERROR_BIND;
+}
+
+/** encode prints value with the printer function f, json_print_raw or
+ * json_print_pretty. return 0, the printer error, or JSON_ERROR_BIND for a
+ * floating point value that isn't finite */
+template <class T>
+inline int encode(json_printer *printer, const T &value, json_printer_function f = json_print_raw)
+{
+	return encode_value(printer, f, &ops<T>::desc, &value);
+}
+
+#endif /* __cplusplus >= 201103L */
+
+#ifdef JSON_HPP_COROUTINES
+
+/** an event pulled from a stream. data is zero terminated and valid until the
+ * next event is awaited. the end of the input, or an error, is a JSON_NONE
+ * event with the error, or 0 if the document is complete */
+struct event {
+	int type;
+	const char *data;
+	uint32_t length;
+	int32_t key_id;
+	int error;
+};
+
+template <class T> class task;
+
+struct task_promise_base {
+	std::coroutine_handle<> continuation;
+	std::exception_ptr exception;
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+
+	/* resume the task awaiting this one, if any */
+	struct final_awaiter {
+		bool await_ready() noexcept { return false; }
+		template <class P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+		{
+			std::coroutine_handle<> c = h.promise().continuation;
+			return c ? c : std::noop_coroutine();
+		}
+		void await_resume() noexcept {}
+	};
+
+	final_awaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <class T>
+struct task_promise : task_promise_base {
+	std::optional<T> value;
+
+	task<T> get_return_object();
+	void return_value(T v) { value.emplace(std::move(v)); }
+};
+
+template <>
+struct task_promise<void> : task_promise_base {
+	task<void> get_return_object();
+	void return_void() {}
+};
+
+/** task is the coroutine type of the consumers of a stream. it starts when it is
+ * awaited, by the task calling it, or by start for the top level task, so a
+ * consumer can be written as recursive descent with a task per value */
+template <class T = void>
+class task {
+public:
+	typedef task_promise<T> promise_type;
+	typedef std::coroutine_handle<promise_type> handle;
+
+	explicit task(handle h) : h_(h) {}
+	task(task &&t) noexcept : h_(std::exchange(t.h_, {})) {}
+	task &operator=(task &&t) noexcept
+	{
+		if (this != &t) {
+			if (h_)
+				h_.destroy();
+			h_ = std::exchange(t.h_, {});
+		}
+		return *this;
+	}
+	~task()
+	{
+		if (h_)
+			h_.destroy();
+	}
+
+	/** start runs a top level task until it awaits its first event */
+	void start() { h_.resume(); }
+
+	/** done returns true when the task has returned */
+	bool done() const { return !h_ || h_.done(); }
+
+	/** result returns what the task returned, or throws what it threw */
+	T result()
+	{
+		if (h_.promise().exception)
+			std::rethrow_exception(h_.promise().exception);
+		if constexpr (!std::is_void_v<T>)
+			return std::move(*h_.promise().value);
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept
+	{
+		h_.promise().continuation = c;
+		return h_;
+	}
+	T await_resume() { return result(); }
+
+private:
+	handle h_;
+};
+
+template <class T>
+inline task<T> task_promise<T>::get_return_object()
+{
+	return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object()
+{
+	return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+/** stream turns the parser inside out: the input is pushed with feed as it
+ * arrives, and a consumer task pulls the events with co_await next(). each
+ * event resumes the consumer, which runs until it awaits the next one, so the
+ * events aren't copied or queued, and a stream costs a parser and the frames of
+ * its consumer tasks. the consumer must not call feed or end itself */
+class stream {
+public:
+	explicit stream(const json_config *config = 0)
+		: error_(0), init_(false), waiting_(nullptr), event_()
+	{
+		json_config cfg = config ? *config : json_config();
+
+		error_ = json_parser_init(&parser_, &cfg, 0, 0);
+		if (error_)
+			return;
+		init_ = true;
+		error_ = json_parser_batch(&parser_, events_, 64, 0, 0, &batch, this);
+	}
+
+	~stream()
+	{
+		if (init_)
+			json_parser_free(&parser_);
+	}
+
+	stream(const stream &) = delete;
+	stream &operator=(const stream &) = delete;
+
+	struct awaiter {
+		stream &s;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> h) noexcept { s.waiting_ = h; }
+		event await_resume() const noexcept { return s.event_; }
+	};
+
+	/** next is awaited by the consumer for the next event */
+	awaiter next() { return awaiter { *this }; }
+
+	/** feed parses the next length bytes of the input, resuming the consumer for
+	 * each event. on a parser error, the consumer gets a JSON_NONE event with it.
+	 * return 0, the parser error, or JSON_ERROR_CALLBACK if the consumer returned
+	 * before the end of the document */
+	int feed(const char *s, uint32_t length, uint32_t *processed = 0)
+	{
+		int ret;
+
+		if (error_)
+			return error_;
+		ret = json_parser_string(&parser_, s, length, processed);
+		if (ret)
+			fail(ret);
+		return ret;
+	}
+
+	/** end tells the stream the input is over. a consumer still waiting gets a
+	 * JSON_NONE event, with JSON_ERROR_INCOMPLETE if the document isn't complete */
+	int end()
+	{
+		if (error_)
+			return error_;
+		if (!json_parser_is_done(&parser_)) {
+			fail(JSON_ERROR_INCOMPLETE);
+			return JSON_ERROR_INCOMPLETE;
+		}
+		resume(JSON_NONE, NULL, 0, JSON_KEY_UNKNOWN, 0);
+		return 0;
+	}
+
+	/** is_done returns true when a complete document has been parsed */
+	bool is_done() { return !error_ && json_parser_is_done(&parser_); }
+
+	/** c_parser returns the underlying parser, to set it up with the C API */
+	json_parser *c_parser() { return &parser_; }
+
+private:
+	bool resume(int type, const char *data, uint32_t length, int32_t key_id, int error)
+	{
+		std::coroutine_handle<> h = std::exchange(waiting_, nullptr);
+
+		if (!h)
+			return false;
+		event_ = event { type, data, length, key_id, error };
+		h.resume();
+		return true;
+	}
+
+	void fail(int error)
+	{
+		error_ = error;
+		resume(JSON_NONE, NULL, 0, JSON_KEY_UNKNOWN, error);
+	}
+
+	static int batch(void *userdata, const json_event *events, uint32_t nb_events, const char *data)
+	{
+		stream *s = static_cast<stream *>(userdata);
+		uint32_t i;
+
+		for (i = 0; i < nb_events; i++)
+			if (!s->resume(events[i].type, data + events[i].offset, events[i].length,
+			               events[i].key_id, 0))
+				return JSON_ERROR_CALLBACK;
+		return 0;
+	}
+
+	json_parser parser_;
+	json_event events_[64];
+	int error_;
+	bool init_;
+	std::coroutine_handle<> waiting_;
+	event event_;
+};
+
+/** skip awaits the rest of the value started by e, which is an array or object
+ * begin. return 0, or the error of the JSON_NONE event ending the input */
+inline task<int> skip(stream &s, event e)
+{
+	uint32_t depth = 1;
+
+	if (e.type != JSON_ARRAY_BEGIN && e.type != JSON_OBJECT_BEGIN)
+		co_return 0;
+	while (depth > 0) {
+		e = co_await s.next();
+		switch (e.type) {
+		case JSON_NONE:
+			co_return e.error ? e.error : JSON_ERROR_INCOMPLETE;
+		case JSON_ARRAY_BEGIN: case JSON_OBJECT_BEGIN:
+			depth++;
+			break;
+		case JSON_ARRAY_END: case JSON_OBJECT_END:
+			depth--;
+			break;
+		}
+	}
+	co_return 0;
+}
+
+#endif /* JSON_HPP_COROUTINES */
+
+} /* namespace json */
+
+#endif /* JSON_HPP */
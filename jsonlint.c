@@ -22,6 +22,8 @@
 #include "json.h"
 
 char *indent_string = NULL;
+/* strings up to this length are shared by the tree, if interning */
+int intern_length = -1;
 
 char *string_of_errors[] =
 {
@@ -37,14 +39,23 @@ char *string_of_errors[] =
 	[JSON_ERROR_UNICODE_UNEXPECTED_LOW_SURROGATE] = "unexpected unicode low surrogate",
 	[JSON_ERROR_COMMA_OUT_OF_STRUCTURE] = "error comma out of structure",
 	[JSON_ERROR_CALLBACK] = "error in a callback",
-	[JSON_ERROR_UTF8]     = "utf8 validation error"
+	[JSON_ERROR_UTF8]     = "utf8 validation error",
+	[JSON_ERROR_BASE64]   = "base64 decoding error",
+	[JSON_ERROR_RECORD]   = "invalid binary record",
+	[JSON_ERROR_BINARY_FORMAT] = "invalid CBOR or MessagePack data",
+	[JSON_ERROR_SNAPSHOT] = "invalid snapshot",
+	[JSON_ERROR_INDEX]    = "invalid index",
+	[JSON_ERROR_BIND]     = "value doesn't match the bound type",
+	[JSON_ERROR_INCOMPLETE] = "incomplete document",
+	[JSON_ERROR_BUDGET]   = "memory budget exhausted",
+	[JSON_ERROR_PARTIAL]  = "partial value given to a callback needing whole values",
 };
 
 static int printchannel(void *userdata, const char *data, uint32_t length)
 {
 	FILE *channel = userdata;
 	int ret;
-	ret = fwrite(data, length, 1, channel);
+	ret = fwrite(data, 1, length, channel);
 	if (ret != length)
 		return 1;
 	return 0;
@@ -78,6 +89,17 @@ void close_filename(const char *filename, FILE *file)
 		fclose(file);
 }
 
+/* the output file is replaced by the output of the first json file, the
+ * outputs of the following ones are appended to it */
+FILE *open_output(const char *filename)
+{
+	static int opened = 0;
+	FILE *output = open_filename(filename, (opened) ? "a" : "w", 0);
+
+	opened = 1;
+	return output;
+}
+
 int process_file(json_parser *parser, FILE *input, int *retlines, int *retcols)
 {
 	char buffer[4096];
@@ -220,12 +242,368 @@ static int do_format(json_config *config, const char *filename, const char *outp
 	return 0;
 }
 
+static int do_minify(json_config *config, const char *filename, const char *outputfile)
+{
+	FILE *input, *output;
+	json_parser parser;
+	int ret;
+	int col, lines;
 
-struct json_val_elem {
-	char *key;
-	uint32_t key_length;
-	struct json_val *val;
-};
+	input = open_filename(filename, "r", 1);
+	if (!input)
+		return 2;
+
+	output = open_output(outputfile);
+	if (!output)
+		return 2;
+
+	/* no callback needed: the parser copies the tokens to the output */
+	ret = json_parser_init(&parser, config, NULL, NULL);
+	if (ret) {
+		fprintf(stderr, "error: initializing parser failed: [code=%d] %s\n", ret, string_of_errors[ret]);
+		return ret;
+	}
+	json_parser_minify(&parser, printchannel, output);
+
+	ret = process_file(&parser, input, &lines, &col);
+	if (ret) {
+		fprintf(stderr, "line %d, col %d: [code=%d] %s\n",
+		        lines, col, ret, string_of_errors[ret]);
+		return 1;
+	}
+
+	ret = json_parser_is_done(&parser);
+	if (!ret) {
+		fprintf(stderr, "syntax error\n");
+		return 1;
+	}
+
+	/* cleanup */
+	json_parser_free(&parser);
+	fwrite("\n", 1, 1, output);
+	close_filename(outputfile, output);
+	close_filename(filename, input);
+	return 0;
+}
+
+static int do_record(json_config *config, const char *filename, const char *outputfile)
+{
+	FILE *input, *output;
+	json_parser parser;
+	json_recorder rec;
+	int ret;
+	int col, lines;
+
+	input = open_filename(filename, "r", 1);
+	if (!input)
+		return 2;
+
+	output = open_filename(outputfile, "wb", 0);
+	if (!output)
+		return 2;
+
+	ret = json_recorder_init(&rec, printchannel, output, NULL);
+	if (ret) {
+		fprintf(stderr, "error: initializing recorder failed: [code=%d] %s\n", ret, string_of_errors[ret]);
+		return ret;
+	}
+
+	ret = json_parser_init(&parser, config, json_recorder_callback, &rec);
+	if (ret) {
+		fprintf(stderr, "error: initializing parser failed: [code=%d] %s\n", ret, string_of_errors[ret]);
+		return ret;
+	}
+
+	ret = process_file(&parser, input, &lines, &col);
+	if (ret) {
+		fprintf(stderr, "line %d, col %d: [code=%d] %s\n",
+		        lines, col, ret, string_of_errors[ret]);
+		return 1;
+	}
+
+	ret = json_parser_is_done(&parser);
+	if (!ret) {
+		fprintf(stderr, "syntax error\n");
+		return 1;
+	}
+
+	/* cleanup */
+	json_parser_free(&parser);
+	json_recorder_free(&rec);
+	close_filename(outputfile, output);
+	close_filename(filename, input);
+	return 0;
+}
+
+static int do_compile_dom(json_config *config, const char *filename, const char *outputfile)
+{
+	FILE *input, *output;
+	json_parser parser;
+	json_snapshot_writer writer;
+	int ret;
+	int col, lines;
+
+	input = open_filename(filename, "r", 1);
+	if (!input)
+		return 2;
+
+	output = open_filename(outputfile, "wb", 0);
+	if (!output)
+		return 2;
+
+	ret = json_snapshot_writer_init(&writer, printchannel, output, NULL);
+	if (ret) {
+		fprintf(stderr, "error: initializing snapshot writer failed: [code=%d] %s\n", ret, string_of_errors[ret]);
+		return ret;
+	}
+
+	ret = json_parser_init(&parser, config, json_snapshot_writer_callback, &writer);
+	if (ret) {
+		fprintf(stderr, "error: initializing parser failed: [code=%d] %s\n", ret, string_of_errors[ret]);
+		return ret;
+	}
+
+	ret = process_file(&parser, input, &lines, &col);
+	if (ret) {
+		fprintf(stderr, "line %d, col %d: [code=%d] %s\n",
+		        lines, col, ret, string_of_errors[ret]);
+		return 1;
+	}
+
+	ret = json_parser_is_done(&parser);
+	if (!ret) {
+		fprintf(stderr, "syntax error\n");
+		return 1;
+	}
+
+	/* cleanup */
+	json_parser_free(&parser);
+	json_snapshot_writer_free(&writer);
+	close_filename(outputfile, output);
+	close_filename(filename, input);
+	return 0;
+}
+
+static int do_index(const char *filename, const char *outputfile, uint32_t depth)
+{
+	FILE *input, *output;
+	json_index index;
+	char buffer[65536];
+	size_t read;
+	int ret;
+
+	input = open_filename(filename, "r", 1);
+	if (!input)
+		return 2;
+
+	output = open_filename(outputfile, "wb", 0);
+	if (!output)
+		return 2;
+
+	ret = json_index_init(&index, depth, NULL);
+	if (ret) {
+		fprintf(stderr, "error: initializing index failed: [code=%d] %s\n", ret, string_of_errors[ret]);
+		return ret;
+	}
+
+	while ((read = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+		ret = json_index_string(&index, buffer, read);
+		if (ret)
+			break;
+	}
+	if (!ret)
+		ret = json_index_finish(&index);
+	if (!ret)
+		ret = json_index_save(&index, printchannel, output);
+	if (ret) {
+		fprintf(stderr, "error: indexing failed: [code=%d] %s\n", ret, string_of_errors[ret]);
+		return 1;
+	}
+
+	/* cleanup */
+	json_index_free(&index);
+	close_filename(outputfile, output);
+	close_filename(filename, input);
+	return 0;
+}
+
+/* find the entry of path, made of the keys and element numbers separated by '/' */
+static uint32_t index_lookup(json_index *index, const char *path)
+{
+	uint32_t entry = 0;
+
+	while (entry != JSON_INDEX_NONE && *path) {
+		const char *end;
+		if (*path == '/') {
+			path++;
+			continue;
+		}
+		end = strchr(path, '/');
+		if (!end)
+			end = path + strlen(path);
+		if (index->entries[entry].type == JSON_ARRAY_BEGIN) {
+			char *number_end;
+			unsigned long n = strtoul(path, &number_end, 10);
+			entry = (number_end == end) ? json_index_get(index, entry, n) : JSON_INDEX_NONE;
+		} else
+			entry = json_index_find(index, entry, path, end - path);
+		path = end;
+	}
+	return entry;
+}
+
+static int do_get(json_config *config, const char *filename, const char *outputfile,
+                  const char *indexfile, const char *path)
+{
+	FILE *input, *output, *idx;
+	json_parser parser;
+	json_printer printer;
+	json_index index;
+	json_index_entry *e;
+	char *data = NULL, buffer[4096];
+	size_t length = 0, size = 0;
+	uint64_t left;
+	uint32_t entry;
+	int ret;
+
+	input = open_filename(filename, "r", 1);
+	if (!input)
+		return 2;
+
+	output = open_output(outputfile);
+	if (!output)
+		return 2;
+
+	idx = open_filename(indexfile, "rb", 1);
+	if (!idx)
+		return 2;
+
+	/* the index is read in place, from memory aligned by malloc */
+	while (1) {
+		size_t read;
+		if (length == size) {
+			size = (size) ? size * 2 : 65536;
+			data = realloc(data, size);
+			if (!data) {
+				fprintf(stderr, "error: out of memory\n");
+				return 2;
+			}
+		}
+		read = fread(data + length, 1, size - length, idx);
+		if (read == 0)
+			break;
+		length += read;
+	}
+	close_filename(indexfile, idx);
+
+	ret = json_index_open(&index, data, length);
+	if (ret) {
+		fprintf(stderr, "error: opening index failed: [code=%d] %s\n", ret, string_of_errors[ret]);
+		return 1;
+	}
+
+	entry = index_lookup(&index, path);
+	if (entry == JSON_INDEX_NONE) {
+		fprintf(stderr, "error: %s isn't in the index\n", path);
+		return 1;
+	}
+	e = &index.entries[entry];
+	if (fseeko(input, (off_t) e->offset, SEEK_SET)) {
+		fprintf(stderr, "error: cannot seek in %s: %s\n", filename, strerror(errno));
+		return 2;
+	}
+
+	json_print_init(&printer, printchannel, output);
+	if (indent_string)
+		printer.indentstr = indent_string;
+
+	ret = json_parser_init(&parser, config, &prettyprint, &printer);
+	if (ret) {
+		fprintf(stderr, "error: initializing parser failed: [code=%d] %s\n", ret, string_of_errors[ret]);
+		return ret;
+	}
+	json_parser_value(&parser);
+
+	/* only the text of the value is parsed */
+	for (left = e->length; left > 0 && !ret; ) {
+		size_t read = fread(buffer, 1, (left < sizeof(buffer)) ? left : sizeof(buffer), input);
+		if (read == 0)
+			break;
+		ret = json_parser_string(&parser, buffer, read, NULL);
+		left -= read;
+	}
+	if (!ret)
+		ret = json_parser_value_end(&parser);
+	if (ret) {
+		fprintf(stderr, "error: [code=%d] %s\n", ret, string_of_errors[ret]);
+		return 1;
+	}
+	if (!json_parser_is_done(&parser)) {
+		fprintf(stderr, "syntax error\n");
+		return 1;
+	}
+
+	/* cleanup */
+	json_parser_free(&parser);
+	json_print_free(&printer);
+	free(data);
+	fwrite("\n", 1, 1, output);
+	close_filename(outputfile, output);
+	close_filename(filename, input);
+	return 0;
+}
+
+static int do_replay(const char *filename, const char *outputfile)
+{
+	FILE *input, *output;
+	json_printer printer;
+	char *data = NULL;
+	size_t length = 0, size = 0;
+	int ret;
+
+	input = open_filename(filename, "rb", 1);
+	if (!input)
+		return 2;
+
+	output = open_output(outputfile);
+	if (!output)
+		return 2;
+
+	/* the replay needs the whole record in memory */
+	while (1) {
+		size_t read;
+		if (length == size) {
+			size = (size) ? size * 2 : 65536;
+			data = realloc(data, size);
+			if (!data) {
+				fprintf(stderr, "error: out of memory\n");
+				return 2;
+			}
+		}
+		read = fread(data + length, 1, size - length, input);
+		if (read == 0)
+			break;
+		length += read;
+	}
+
+	json_print_init(&printer, printchannel, output);
+	if (indent_string)
+		printer.indentstr = indent_string;
+
+	ret = json_replay(data, length, prettyprint, &printer, NULL);
+	if (ret) {
+		fprintf(stderr, "error: replay failed: [code=%d] %s\n", ret, string_of_errors[ret]);
+		return 1;
+	}
+
+	/* cleanup */
+	json_print_free(&printer);
+	free(data);
+	fwrite("\n", 1, 1, output);
+	close_filename(outputfile, output);
+	close_filename(filename, input);
+	return 0;
+}
 
 typedef struct json_val {
 	int type;
@@ -233,7 +611,7 @@ typedef struct json_val {
 	union {
 		char *data;
 		struct json_val **array;
-		struct json_val_elem **object;
+		json_object *object;
 	} u;
 } json_val_t;
 
@@ -245,7 +623,12 @@ static void *tree_create_structure(int nesting, int is_object)
 		 * meaning of the json enum type for array and object */
 		if (is_object) {
 			v->type = JSON_OBJECT_BEGIN;
-			v->u.object = NULL;
+			v->u.object = malloc(sizeof(json_object));
+			if (!v->u.object) {
+				free(v);
+				return NULL;
+			}
+			json_object_init(v->u.object, NULL);
 		} else {
 			v->type = JSON_ARRAY_BEGIN;
 			v->u.array = NULL;
@@ -273,6 +656,10 @@ static void *tree_create_data(int type, const char *data, uint32_t length)
 	if (v) {
 		v->type = type;
 		v->length = length;
+		if (type == JSON_STRING && (int64_t) length <= intern_length) {
+			v->u.data = (char *) data;
+			return v;
+		}
 		v->u.data = memalloc_copy_length(data, length);
 		if (!v->u.data) {
 			free(v);
@@ -286,31 +673,14 @@ static int tree_append(void *structure, char *key, uint32_t key_length, void *ob
 {
 	json_val_t *parent = structure;
 	if (key) {
-		struct json_val_elem *objelem;
-
-		if (parent->length == 0) {
-			parent->u.object = calloc(1 + 1, sizeof(json_val_t *)); /* +1 for null */
-			if (!parent->u.object)
-				return 1;
-		} else {
-			uint32_t newsize = parent->length + 1 + 1; /* +1 for null */
-			void *newptr;
-
-			newptr = realloc(parent->u.object, newsize * sizeof(json_val_t *));
-			if (!newptr)
+		if (intern_length < 0) {
+			key = memalloc_copy_length(key, key_length);
+			if (!key)
 				return -1;
-			parent->u.object = newptr;
 		}
-
-		objelem = malloc(sizeof(struct json_val_elem));
-		if (!objelem)
+		if (json_object_append(parent->u.object, key, key_length, obj))
 			return -1;
-
-		objelem->key = memalloc_copy_length(key, key_length);
-		objelem->key_length = key_length;
-		objelem->val = obj;
-		parent->u.object[parent->length++] = objelem;
-		parent->u.object[parent->length] = NULL;
+		parent->length++;
 	} else {
 		if (parent->length == 0) {
 			parent->u.array = calloc(1 + 1, sizeof(json_val_t *)); /* +1 for null */
@@ -320,7 +690,7 @@ static int tree_append(void *structure, char *key, uint32_t key_length, void *ob
 			uint32_t newsize = parent->length + 1 + 1; /* +1 for null */
 			void *newptr;
 
-			newptr = realloc(parent->u.object, newsize * sizeof(json_val_t *));
+			newptr = realloc(parent->u.array, newsize * sizeof(json_val_t *));
 			if (!newptr)
 				return -1;
 			parent->u.array = newptr;
@@ -348,6 +718,9 @@ static int do_tree(json_config *config, const char *filename, json_val_t **root_
 		fprintf(stderr, "error: initializing helper failed: [code=%d] %s\n", ret, string_of_errors[ret]);
 		return ret;
 	}
+	/* the interned strings are kept with the tree */
+	if (intern_length >= 0)
+		json_parser_dom_intern(&dom, intern_length);
 
 	ret = json_parser_init(&parser, config, json_parser_dom_callback, &dom);
 	if (ret) {
@@ -390,8 +763,8 @@ static int print_tree_iter(json_val_t *element, FILE *output)
 	case JSON_OBJECT_BEGIN:
 		fprintf(output, "object begin (%d element)\n", element->length);
 		for (i = 0; i < element->length; i++) {
-			fprintf(output, "key: %s\n", element->u.object[i]->key);
-			print_tree_iter(element->u.object[i]->val, output);
+			fprintf(output, "key: %s\n", element->u.object->members[i].key);
+			print_tree_iter(element->u.object->members[i].value, output);
 		}
 		fprintf(output, "object end\n");
 		break;
@@ -441,19 +814,30 @@ int usage(const char *argv0)
 	printf("\t--no-yaml-comments : disallow YAML comment (default to on)\n");
 	printf("\t--no-c-comments : disallow C comment (default to on)\n");
 	printf("\t--format : pretty print the json file to stdout (unless -o specified)\n");
+	printf("\t--minify : copy the json file without whitespace and comments to stdout (unless -o specified)\n");
+	printf("\t--record : convert the json file to a binary record of its events to stdout (unless -o specified)\n");
+	printf("\t--replay : pretty print a binary record made by --record to stdout (unless -o specified)\n");
+	printf("\t--compile-dom : write a snapshot of the json file, to read in place with json_snapshot_open, to stdout (unless -o specified)\n");
+	printf("\t--index : write an index of the values of the json file down to --index-depth, to stdout (unless -o specified)\n");
+	printf("\t--index-depth : depth of the values indexed by --index (default to 1: the elements or members of the root)\n");
+	printf("\t--get PATH : pretty print only the value at PATH, keys and element numbers separated by '/', found with the index given by --index-file\n");
+	printf("\t--index-file : index made by --index of the json file, for --get\n");
 	printf("\t--verify : quietly verified if the json file is valid. exit 0 if valid, 1 if not\n");
 	printf("\t--benchmark : quietly iterate multiples times over valid json files\n");
 	printf("\t--max-nesting : limit the number of nesting in structure (default to no limit)\n");
 	printf("\t--max-data : limit the number of characters of data (string/int/float) (default to no limit)\n");
 	printf("\t--indent-string : set the string to use for indenting one level (default to 1 tab)\n");
 	printf("\t--tree : build a tree (DOM)\n");
-	printf("\t-o : output to a specific file instead of stdout\n");
+	printf("\t--intern : share the keys, and the strings up to this length, in the tree\n");
+	printf("\t-o : output to a specific file instead of stdout. the file is replaced, except by --format\n");
 	exit(0);
 }
 
 int main(int argc, char **argv)
 {
-	int format = 0, verify = 0, use_tree = 0, benchmarks = 0;
+	int format = 0, minify = 0, record = 0, replay = 0, compile_dom = 0, verify = 0, use_tree = 0, benchmarks = 0;
+	int index = 0, index_depth = 1;
+	char *get_path = NULL, *index_file = NULL;
 	int ret = 0, i;
 	json_config config;
 	char *output = "-";
@@ -471,6 +855,14 @@ int main(int argc, char **argv)
 			{ "no-yaml-comments", 0, 0, 0 },
 			{ "no-c-comments", 0, 0, 0 },
 			{ "format", 0, 0, 0 },
+			{ "minify", 0, 0, 0 },
+			{ "record", 0, 0, 0 },
+			{ "replay", 0, 0, 0 },
+			{ "compile-dom", 0, 0, 0 },
+			{ "index", 0, 0, 0 },
+			{ "index-depth", 1, 0, 0 },
+			{ "get", 1, 0, 0 },
+			{ "index-file", 1, 0, 0 },
 			{ "verify", 0, 0, 0 },
 			{ "benchmark", 1, 0, 0 },
 			{ "help", 0, 0, 0 },
@@ -478,6 +870,7 @@ int main(int argc, char **argv)
 			{ "max-data", 1, 0, 0 },
 			{ "indent-string", 1, 0, 0 },
 			{ "tree", 0, 0, 0 },
+			{ "intern", 1, 0, 0 },
 			{ 0 },
 		};
 		int c = getopt_long(argc, argv, "o:", long_options, &option_index);
@@ -496,6 +889,22 @@ int main(int argc, char **argv)
 				config.allow_c_comments = config.allow_yaml_comments = 0;
 			else if (strcmp(name, "format") == 0)
 				format = 1;
+			else if (strcmp(name, "minify") == 0)
+				minify = 1;
+			else if (strcmp(name, "record") == 0)
+				record = 1;
+			else if (strcmp(name, "replay") == 0)
+				replay = 1;
+			else if (strcmp(name, "compile-dom") == 0)
+				compile_dom = 1;
+			else if (strcmp(name, "index") == 0)
+				index = 1;
+			else if (strcmp(name, "index-depth") == 0)
+				index_depth = atoi(optarg);
+			else if (strcmp(name, "get") == 0)
+				get_path = strdup(optarg);
+			else if (strcmp(name, "index-file") == 0)
+				index_file = strdup(optarg);
 			else if (strcmp(name, "verify") == 0)
 				verify = 1;
 			else if (strcmp(name, "max-nesting") == 0)
@@ -508,6 +917,8 @@ int main(int argc, char **argv)
 				indent_string = strdup(optarg);
 			else if (strcmp(name, "tree") == 0)
 				use_tree = 1;
+			else if (strcmp(name, "intern") == 0)
+				intern_length = atoi(optarg);
 			break;
 			}
 		case 'o':
@@ -521,6 +932,10 @@ int main(int argc, char **argv)
 		output = "-";
 	if (optind >= argc)
 		usage(argv[0]);
+	if ((record || compile_dom || index) && argc - optind > 1) {
+		fprintf(stderr, "error: --record, --compile-dom and --index take one json file\n");
+		exit(2);
+	}
 
 	if (benchmarks > 0) {
 		for (i = 0; i < benchmarks; i++) {
@@ -547,6 +962,23 @@ int main(int argc, char **argv)
 		} else {
 			if (format)
 				ret = do_format(&config, argv[i], output);
+			else if (minify)
+				ret = do_minify(&config, argv[i], output);
+			else if (record)
+				ret = do_record(&config, argv[i], output);
+			else if (replay)
+				ret = do_replay(argv[i], output);
+			else if (compile_dom)
+				ret = do_compile_dom(&config, argv[i], output);
+			else if (index)
+				ret = do_index(argv[i], output, index_depth);
+			else if (get_path) {
+				if (!index_file) {
+					fprintf(stderr, "error: --get needs --index-file\n");
+					exit(2);
+				}
+				ret = do_get(&config, argv[i], output, index_file, get_path);
+			}
 			else if (verify)
 				ret = do_verify(&config, argv[i]);
 			else
@@ -0,0 +1,1704 @@
+/*
+ * tests of the library functions that jsonlint doesn't cover
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "json.h"
+
+static int failures = 0;
+
+static void check(const char *name, int ok)
+{
+	if (ok)
+		printf("\033[1;32mSUCCESS\033[0m:  %s\n", name);
+	else {
+		printf("\033[1;31mFAILED\033[0m :  %s\n", name);
+		failures++;
+	}
+}
+
+/* DOM values: a structure remembers its kind, a data value its type and text */
+struct value {
+	int type;
+	char data[32];
+	int count;
+};
+
+static void *create_structure(int nesting, int is_object)
+{
+	struct value *v = calloc(1, sizeof(*v));
+	v->type = (is_object) ? JSON_OBJECT_BEGIN : JSON_ARRAY_BEGIN;
+	return v;
+}
+
+static void *create_data(int type, const char *data, uint32_t length)
+{
+	struct value *v = calloc(1, sizeof(*v));
+	v->type = type;
+	if (data)
+		snprintf(v->data, sizeof(v->data), "%.*s", (int) length, data);
+	return v;
+}
+
+static int append(void *structure, char *key, uint32_t key_length, void *obj)
+{
+	((struct value *) structure)->count++;
+	free(obj);
+	return 0;
+}
+
+/* a value on its own, parsed with json_parser_value, becomes the DOM root */
+static void test_dom_value(void)
+{
+	static const struct { const char *text; int type; const char *data; } values[] = {
+		{ "\"hello\"", JSON_STRING, "hello" },
+		{ "-12", JSON_INT, "-12" },
+		{ "true", JSON_TRUE, "" },
+		{ "[1,2]", JSON_ARRAY_BEGIN, "" },
+	};
+	json_parser_dom dom;
+	json_parser parser;
+	struct value *root;
+	char name[64];
+	int i, ret;
+
+	for (i = 0; i < (int) (sizeof(values) / sizeof(values[0])); i++) {
+		json_parser_dom_init(&dom, create_structure, create_data, append);
+		json_parser_init(&parser, NULL, json_parser_dom_callback, &dom);
+		json_parser_value(&parser);
+		ret = json_parser_string(&parser, values[i].text, strlen(values[i].text), NULL);
+		if (!ret)
+			ret = json_parser_value_end(&parser);
+		root = dom.root_structure;
+		snprintf(name, sizeof(name), "dom root %s", values[i].text);
+		check(name, !ret && root && root->type == values[i].type
+		            && strcmp(root->data, values[i].data) == 0);
+		free(root);
+		json_parser_free(&parser);
+		json_parser_dom_free(&dom);
+	}
+}
+
+/* members appended by the DOM helper, with their key, kept to be checked */
+struct member {
+	char key[16];
+	struct value *value;
+};
+
+static struct member members[8];
+static int nb_members;
+
+static int append_member(void *structure, char *key, uint32_t key_length, void *obj)
+{
+	if (nb_members == 8)
+		return 1;
+	snprintf(members[nb_members].key, sizeof(members[0].key), "%.*s", (int) key_length, (key) ? key : "");
+	members[nb_members++].value = obj;
+	((struct value *) structure)->count++;
+	return 0;
+}
+
+static void free_members(void)
+{
+	while (nb_members > 0)
+		free(members[--nb_members].value);
+}
+
+/* a base64 member is a JSON_BSTRING value of the tree, under its key */
+static void test_dom_base64(void)
+{
+	static const char *base64_keys[] = { "blob", NULL };
+	static const char text[] = "{\"blob\": \"aGVsbG8=\", \"x\": 1}";
+	json_parser_dom dom;
+	json_config config;
+	json_parser parser;
+	struct value *root;
+	int ret;
+
+	memset(&config, 0, sizeof(config));
+	config.base64_keys = base64_keys;
+	json_parser_dom_init(&dom, create_structure, create_data, append_member);
+	json_parser_init(&parser, &config, json_parser_dom_callback, &dom);
+	ret = json_parser_string(&parser, text, strlen(text), NULL);
+	root = dom.root_structure;
+	check("dom base64", !ret && root && root->count == 2 && nb_members == 2
+	                    && strcmp(members[0].key, "blob") == 0
+	                    && members[0].value->type == JSON_BSTRING
+	                    && strcmp(members[0].value->data, "hello") == 0
+	                    && strcmp(members[1].key, "x") == 0
+	                    && members[1].value->type == JSON_INT);
+	free_members();
+	free(root);
+	json_parser_free(&parser);
+	json_parser_dom_free(&dom);
+}
+
+/* CBOR byte strings and MessagePack bin values given by json_decode reach the DOM */
+static void test_dom_decode(void)
+{
+	static const struct { json_binary_format format; const char *name; const char *data; size_t length; } docs[] = {
+		{ JSON_FORMAT_CBOR, "dom cbor bytes", "\xa1\x61\x62\x42\x01\x02", 6 },
+		{ JSON_FORMAT_MSGPACK, "dom msgpack bin", "\x81\xa1\x62\xc4\x02\x01\x02", 7 },
+	};
+	json_parser_dom dom;
+	struct value *root;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+		json_parser_dom_init(&dom, create_structure, create_data, append_member);
+		ret = json_decode(docs[i].format, docs[i].data, docs[i].length,
+		                  json_parser_dom_callback, &dom, NULL);
+		root = dom.root_structure;
+		check(docs[i].name, !ret && root && root->count == 1 && nb_members == 1
+		                    && strcmp(members[0].key, "b") == 0
+		                    && members[0].value->type == JSON_BSTRING
+		                    && memcmp(members[0].value->data, "\x01\x02", 3) == 0);
+		free_members();
+		free(root);
+		json_parser_dom_free(&dom);
+	}
+}
+
+/* pointers given by a DOM helper interning keys and strings */
+static const char *interned[8];
+static int nb_interned;
+
+static void *intern_create_data(int type, const char *data, uint32_t length)
+{
+	if (nb_interned < 8)
+		interned[nb_interned++] = data;
+	return (void *) data;
+}
+
+static int intern_append(void *structure, char *key, uint32_t key_length, void *obj)
+{
+	if (key && nb_interned < 8)
+		interned[nb_interned++] = key;
+	return 0;
+}
+
+static void *intern_create_structure(int nesting, int is_object)
+{
+	return (void *) interned;
+}
+
+/* the same keys, and the same short strings, are shared */
+static void test_dom_intern(void)
+{
+	static const char text[] = "[{\"key\": \"abc\"}, {\"key\": \"abc\"}, \"long string\", \"long string\"]";
+	json_parser_dom dom;
+	json_parser parser;
+	int ret;
+
+	nb_interned = 0;
+	json_parser_dom_init(&dom, intern_create_structure, intern_create_data, intern_append);
+	json_parser_dom_intern(&dom, 4);
+	json_parser_init(&parser, NULL, json_parser_dom_callback, &dom);
+	ret = json_parser_string(&parser, text, strlen(text), NULL);
+	/* data then key for each member, then the two long strings, not interned */
+	check("dom intern", !ret && nb_interned == 6 && interned[0] == interned[2]
+	                    && interned[1] == interned[3] && strcmp(interned[1], "key") == 0
+	                    && strcmp(interned[0], "abc") == 0);
+	json_parser_free(&parser);
+	json_parser_dom_free(&dom);
+}
+
+/* values found by their path in an index are the text of these values */
+static void test_index(void)
+{
+	static const char text[] = "{ \"a\": [1, {\"b\": \"x\"}], \"c\": true }";
+	static const struct { const char *path[3]; const char *value; } values[] = {
+		{ { NULL }, text },
+		{ { "a", NULL }, "[1, {\"b\": \"x\"}]" },
+		{ { "a", "1", NULL }, "{\"b\": \"x\"}" },
+		{ { "c", NULL }, "true" },
+		{ { "a", "1", "b" }, NULL },
+		{ { "d", NULL }, NULL },
+	};
+	json_index index;
+	uint32_t entry;
+	char name[64];
+	int i, j, ret;
+
+	json_index_init(&index, 2, NULL);
+	ret = json_index_string(&index, text, strlen(text));
+	if (!ret)
+		ret = json_index_finish(&index);
+	check("index finish", ret == 0);
+	for (i = 0; i < (int) (sizeof(values) / sizeof(values[0])); i++) {
+		const json_index_entry *e;
+
+		entry = 0;
+		strcpy(name, "index /");
+		for (j = 0; j < 3 && values[i].path[j] && entry != JSON_INDEX_NONE; j++) {
+			const char *p = values[i].path[j];
+			strcat(name, p);
+			strcat(name, "/");
+			if (index.entries[entry].type == JSON_ARRAY_BEGIN)
+				entry = json_index_get(&index, entry, atoi(p));
+			else
+				entry = json_index_find(&index, entry, p, strlen(p));
+		}
+		if (!values[i].value) {
+			check(name, entry == JSON_INDEX_NONE);
+			continue;
+		}
+		e = (entry != JSON_INDEX_NONE) ? &index.entries[entry] : NULL;
+		check(name, e && e->length == strlen(values[i].value)
+		            && memcmp(text + e->offset, values[i].value, e->length) == 0);
+	}
+	json_index_free(&index);
+}
+
+/* json_object_find gives the first member with a key, scanning small objects
+ * and looking up larger ones in their index, which sees members appended later */
+static void test_object(void)
+{
+	static char keys[120][8], duplicates[3][8] = { "k2", "k2", "k7" };
+	json_object obj;
+	uint32_t i;
+	int ok;
+
+	for (i = 0; i < 120; i++)
+		snprintf(keys[i], sizeof(keys[i]), "k%u", i);
+	json_object_init(&obj, NULL);
+
+	/* scanned: the first of duplicated keys, no prefix, no index */
+	for (i = 0; i < 5; i++)
+		json_object_append(&obj, keys[i], strlen(keys[i]), NULL);
+	json_object_append(&obj, duplicates[0], 2, NULL);
+	check("object scan", obj.count < JSON_OBJECT_INDEX_THRESHOLD
+	                     && json_object_find(&obj, "k2", 2) == &obj.members[2]
+	                     && json_object_find(&obj, "k4", 2) == &obj.members[4]
+	                     && json_object_find(&obj, "k", 1) == NULL
+	                     && json_object_find(&obj, "k9", 2) == NULL
+	                     && json_object_find(&obj, "", 0) == NULL && obj.index == NULL);
+
+	/* indexed: the same answers */
+	for (i = 5; i < 20; i++)
+		json_object_append(&obj, keys[i], strlen(keys[i]), NULL);
+	json_object_append(&obj, duplicates[1], 2, NULL);
+	ok = json_object_find(&obj, "k2", 2) == &obj.members[2] && obj.index != NULL
+	     && json_object_find(&obj, "k", 1) == NULL && json_object_find(&obj, "k20", 3) == NULL;
+	for (i = 5; ok && i < 20; i++)
+		ok = json_object_find(&obj, keys[i], strlen(keys[i])) == &obj.members[i + 1];
+	check("object index", ok);
+
+	/* appended after the index was built, enough for it to grow */
+	for (i = 20; i < 120; i++)
+		json_object_append(&obj, keys[i], strlen(keys[i]), NULL);
+	json_object_append(&obj, duplicates[2], 2, NULL);
+	ok = json_object_find(&obj, "k2", 2) == &obj.members[2]
+	     && json_object_find(&obj, "k7", 2) == &obj.members[8]
+	     && json_object_find(&obj, "k120", 4) == NULL;
+	for (i = 20; ok && i < 120; i++)
+		ok = json_object_find(&obj, keys[i], strlen(keys[i])) == &obj.members[i + 2];
+	check("object append after index", ok && obj.indexed == obj.count);
+	json_object_free(&obj);
+}
+
+/* output of a recorder, an encoder or a snapshot writer */
+struct output {
+	char data[1024];
+	uint32_t length;
+};
+
+static int append_output(void *userdata, const char *s, uint32_t length)
+{
+	struct output *out = userdata;
+
+	if (out->length + length > sizeof(out->data))
+		return 1;
+	memcpy(out->data + out->length, s, length);
+	out->length += length;
+	return 0;
+}
+
+/* the library callbacks given the values in pieces, by a parser with partial_size */
+static int parse_with(uint32_t partial_size, const char *text,
+                      json_parser_callback callback, void *userdata)
+{
+	json_config config;
+	json_parser parser;
+	int ret;
+
+	memset(&config, 0, sizeof(config));
+	config.partial_size = partial_size;
+	json_parser_init(&parser, &config, callback, userdata);
+	ret = json_parser_string(&parser, text, strlen(text), NULL);
+	json_parser_free(&parser);
+	return ret;
+}
+
+static int record_with(uint32_t partial_size, const char *text, struct output *out)
+{
+	json_recorder rec;
+	int ret;
+
+	memset(out, 0, sizeof(*out));
+	json_recorder_init(&rec, append_output, out, NULL);
+	ret = parse_with(partial_size, text, json_recorder_callback, &rec);
+	json_recorder_free(&rec);
+	return ret;
+}
+
+static int encode_with(uint32_t partial_size, const char *text, struct output *out)
+{
+	json_encoder enc;
+	int ret;
+
+	memset(out, 0, sizeof(*out));
+	json_encoder_init(&enc, JSON_FORMAT_CBOR, append_output, out, NULL);
+	ret = parse_with(partial_size, text, json_encoder_callback, &enc);
+	json_encoder_free(&enc);
+	return ret;
+}
+
+static int snapshot_with(uint32_t partial_size, const char *text, struct output *out)
+{
+	json_snapshot_writer w;
+	int ret;
+
+	memset(out, 0, sizeof(*out));
+	json_snapshot_writer_init(&w, append_output, out, NULL);
+	ret = parse_with(partial_size, text, json_snapshot_writer_callback, &w);
+	json_snapshot_writer_free(&w);
+	return ret;
+}
+
+static int same_output(int ret1, struct output *out1, int ret2, struct output *out2)
+{
+	return !ret1 && !ret2 && out1->length > 0 && out1->length == out2->length
+	       && memcmp(out1->data, out2->data, out1->length) == 0;
+}
+
+static const char partial_text[] =
+	"{\"a long key of the object\": [\"a string longer than a piece\", 12345678901234,"
+	" -1.25e+100, \"\\u00e9t\\u00e9 \\u00e9t\\u00e9\"], \"k\": \"v\"}";
+
+/* the pieces of JSON_PARTIAL are joined: the output is the same as with whole values */
+static void test_partial_callbacks(void)
+{
+	struct output whole, pieces;
+	json_parser_dom dom;
+	json_config config;
+	json_parser parser;
+	json_printer printer;
+	struct value *root;
+	int ret;
+
+	check("partial record", same_output(record_with(0, partial_text, &whole), &whole,
+	                                    record_with(4, partial_text, &pieces), &pieces));
+	check("partial cbor", same_output(encode_with(0, partial_text, &whole), &whole,
+	                                  encode_with(4, partial_text, &pieces), &pieces));
+	check("partial snapshot", same_output(snapshot_with(0, partial_text, &whole), &whole,
+	                                      snapshot_with(4, partial_text, &pieces), &pieces));
+
+	json_parser_dom_init(&dom, create_structure, create_data, append);
+	ret = parse_with(4, "[\"a string longer than a piece\", 12345678901234]",
+	                 json_parser_dom_callback, &dom);
+	root = dom.root_structure;
+	check("partial dom", !ret && root && root->count == 2);
+	free(root);
+	json_parser_dom_free(&dom);
+
+	memset(&config, 0, sizeof(config));
+	config.partial_size = 4;
+	json_parser_dom_init(&dom, create_structure, create_data, append);
+	json_parser_init(&parser, &config, json_parser_dom_callback, &dom);
+	json_parser_value(&parser);
+	ret = json_parser_string(&parser, "\"a string longer than a piece\"", 30, NULL);
+	if (!ret)
+		ret = json_parser_value_end(&parser);
+	root = dom.root_structure;
+	check("partial dom value", !ret && root && root->type == JSON_STRING
+	                           && strcmp(root->data, "a string longer than a piece") == 0);
+	free(root);
+	json_parser_free(&parser);
+	json_parser_dom_free(&dom);
+
+	memset(&whole, 0, sizeof(whole));
+	json_print_init(&printer, append_output, &whole);
+	ret = parse_with(4, partial_text, (json_parser_callback) json_print_raw, &printer);
+	check("partial printer", ret == JSON_ERROR_PARTIAL);
+	json_print_free(&printer);
+}
+
+/* an allocator counting the blocks it gave and not got back. each block starts
+ * with a header, so a block given to the standard free would be noticed */
+struct counting {
+	long live;
+	long total;
+	/* the allocation that fails, from 1, or 0 */
+	long fail;
+};
+
+#define COUNTING_HEADER 16
+
+static void *counting_realloc(void *ctx, void *ptr, size_t size)
+{
+	struct counting *c = ctx;
+	char *p;
+
+	if (c->fail && c->total + 1 == c->fail)
+		return NULL;
+	p = realloc((ptr) ? (char *) ptr - COUNTING_HEADER : NULL, size + COUNTING_HEADER);
+	if (!p)
+		return NULL;
+	if (!ptr)
+		c->live++;
+	c->total++;
+	return p + COUNTING_HEADER;
+}
+
+static void *counting_calloc(void *ctx, size_t nmemb, size_t size)
+{
+	char *p = counting_realloc(ctx, NULL, nmemb * size);
+
+	if (p)
+		memset(p, 0, nmemb * size);
+	return p;
+}
+
+static void counting_free(void *ctx, void *ptr)
+{
+	((struct counting *) ctx)->live--;
+	free((char *) ptr - COUNTING_HEADER);
+}
+
+static int no_event(void *userdata, int type, const char *data, uint32_t length)
+{
+	return 0;
+}
+
+/* the writers, the readers, the index and the objects only allocate with their allocator */
+static void test_allocator(void)
+{
+	struct counting counting = { 0, 0, 0 };
+	json_allocator allocator = { counting_calloc, counting_realloc, counting_free, &counting };
+	struct output out;
+	json_recorder rec;
+	json_encoder enc;
+	json_snapshot_writer w;
+	json_index index;
+	json_object obj;
+	char keys[32][4];
+	int i, ret;
+
+	json_recorder_init(&rec, append_output, &out, &allocator);
+	memset(&out, 0, sizeof(out));
+	ret = parse_with(4, partial_text, json_recorder_callback, &rec);
+	json_recorder_free(&rec);
+	ret = ret || json_replay(out.data, out.length, no_event, NULL, &allocator);
+	check("allocator record", !ret && counting.total > 0 && counting.live == 0);
+
+	counting.total = 0;
+	json_encoder_init(&enc, JSON_FORMAT_MSGPACK, append_output, &out, &allocator);
+	memset(&out, 0, sizeof(out));
+	ret = parse_with(4, partial_text, json_encoder_callback, &enc);
+	json_encoder_free(&enc);
+	ret = ret || json_decode(JSON_FORMAT_MSGPACK, out.data, out.length, no_event, NULL, &allocator);
+	check("allocator binary format", !ret && counting.total > 0 && counting.live == 0);
+
+	counting.total = 0;
+	json_snapshot_writer_init(&w, append_output, &out, &allocator);
+	memset(&out, 0, sizeof(out));
+	ret = parse_with(4, partial_text, json_snapshot_writer_callback, &w);
+	json_snapshot_writer_free(&w);
+	check("allocator snapshot", !ret && counting.total > 0 && counting.live == 0);
+
+	counting.total = 0;
+	json_index_init(&index, 2, &allocator);
+	ret = json_index_string(&index, partial_text, strlen(partial_text));
+	if (!ret)
+		ret = json_index_finish(&index);
+	json_index_free(&index);
+	check("allocator index", !ret && counting.total > 0 && counting.live == 0);
+
+	/* enough members for the hash index */
+	counting.total = 0;
+	json_object_init(&obj, &allocator);
+	for (i = 0; i < 32; i++) {
+		snprintf(keys[i], sizeof(keys[i]), "k%d", i);
+		json_object_append(&obj, keys[i], strlen(keys[i]), NULL);
+	}
+	ret = json_object_find(&obj, "k20", 3) != &obj.members[20];
+	json_object_free(&obj);
+	check("allocator object", !ret && counting.total > 0 && counting.live == 0);
+}
+
+/* the events a parser gives, as text, to compare event sequences */
+struct trace {
+	char text[2048];
+	uint32_t length;
+	json_parser *parser;
+	/* suspend the parser after the events of this type, or after every event if -1 */
+	int suspend;
+};
+
+static int trace_callback(void *userdata, int type, const char *data, uint32_t length)
+{
+	struct trace *t = userdata;
+	int n;
+
+	if (t->parser)
+		n = snprintf(t->text + t->length, sizeof(t->text) - t->length, "%u:",
+		             json_parser_document(t->parser));
+	else
+		n = 0;
+	n += snprintf(t->text + t->length + n, sizeof(t->text) - t->length - n, "%d:%.*s ",
+	              type, (int) length, (data) ? data : "");
+	if (t->length + n >= sizeof(t->text))
+		return 1;
+	t->length += n;
+	if (t->suspend && (t->suspend < 0 || t->suspend == type))
+		return JSON_SUSPEND;
+	return 0;
+}
+
+static int same_trace(const struct trace *t1, const struct trace *t2)
+{
+	return t1->length > 0 && t1->length == t2->length && memcmp(t1->text, t2->text, t1->length) == 0;
+}
+
+/* give text to the parser, resuming it after each suspension */
+static int feed(json_parser *parser, const char *text, uint32_t length, int *suspensions)
+{
+	uint32_t processed;
+	int ret, i;
+
+	for (i = 0; i < 100000; i++) {
+		ret = json_parser_string(parser, text, length, &processed);
+		if (ret != JSON_SUSPEND)
+			return ret;
+		(*suspensions)++;
+		text += processed;
+		length -= processed;
+	}
+	return JSON_SUSPEND;
+}
+
+/* parse text with a new parser, tracing its events */
+static int trace_fresh(const json_config *config, const char *text, struct trace *t)
+{
+	json_config c = *config;
+	json_parser parser;
+	int ret;
+
+	memset(t, 0, sizeof(*t));
+	json_parser_init(&parser, &c, trace_callback, t);
+	ret = json_parser_string(&parser, text, strlen(text), NULL);
+	json_parser_free(&parser);
+	return ret;
+}
+
+static const char reuse_text[] =
+	"{\"key\": [1, \"a string longer than a piece\", -2.5e3], \"other\": {\"x\": null}}";
+
+/* a parser reset after a document, finished or not, parses the next one as a new parser */
+static void test_reset(void)
+{
+	static const char *firsts[] = { reuse_text, "[1, {\"a\": \"unfinished", "[1, x]", "{\"a\": 12" };
+	struct trace fresh, reused;
+	json_config config;
+	json_parser parser;
+	char name[64];
+	int i, ret;
+
+	memset(&config, 0, sizeof(config));
+	config.partial_size = 4;
+	trace_fresh(&config, reuse_text, &fresh);
+	for (i = 0; i < (int) (sizeof(firsts) / sizeof(firsts[0])); i++) {
+		memset(&reused, 0, sizeof(reused));
+		json_parser_init(&parser, &config, trace_callback, &reused);
+		json_parser_string(&parser, firsts[i], strlen(firsts[i]), NULL);
+		json_parser_reset(&parser);
+		reused.length = 0;
+		ret = json_parser_string(&parser, reuse_text, strlen(reuse_text), NULL);
+		snprintf(name, sizeof(name), "reset after %.12s", firsts[i]);
+		check(name, !ret && json_parser_is_done(&parser) && reused.length == fresh.length
+		            && memcmp(reused.text, fresh.text, fresh.length) == 0);
+		json_parser_free(&parser);
+	}
+}
+
+/* the pool gives back the parsers put in it, makes new ones when empty, and
+ * frees the parsers put when full */
+static void test_pool(void)
+{
+	struct counting counting = { 0, 0, 0 };
+	json_allocator allocator = { counting_calloc, counting_realloc, counting_free, &counting };
+	json_parser *p1, *p2, *p3, *again;
+	struct trace fresh, pooled;
+	json_parser_pool pool;
+	json_config config;
+	long live;
+	int ret;
+
+	memset(&config, 0, sizeof(config));
+	config.allocator = &allocator;
+	trace_fresh(&config, reuse_text, &fresh);
+	json_parser_pool_init(&pool, &config, 2);
+
+	json_parser_pool_get(&pool, &p1, trace_callback, &pooled);
+	json_parser_pool_get(&pool, &p2, trace_callback, &pooled);
+	live = counting.live;
+	json_parser_pool_get(&pool, &p3, trace_callback, &pooled);
+	check("pool new parsers", p1 != p2 && p2 != p3 && p1 != p3 && counting.live > live);
+
+	memset(&pooled, 0, sizeof(pooled));
+	json_parser_string(p1, "[1, 2", 5, NULL);
+	json_parser_pool_put(&pool, p1);
+	json_parser_pool_put(&pool, p2);
+	json_parser_pool_put(&pool, p3);
+	check("pool full", counting.live == live);
+
+	json_parser_pool_get(&pool, &again, trace_callback, &pooled);
+	memset(&pooled, 0, sizeof(pooled));
+	ret = json_parser_string(again, reuse_text, strlen(reuse_text), NULL);
+	check("pool reuse", (again == p1 || again == p2) && !ret && pooled.length == fresh.length
+	                    && memcmp(pooled.text, fresh.text, fresh.length) == 0);
+	json_parser_pool_put(&pool, again);
+
+	json_parser_pool_free(&pool);
+	check("pool free", counting.live == 0);
+}
+
+/* each document parsed on its own, with its index given to the callback; an
+ * error in a document doesn't change the next ones */
+static void test_documents(void)
+{
+	static const json_document documents[] = {
+		{ "[1]", 3 },
+		{ "{\"a\": x}", 8 },
+		{ "[2, ", 4 },
+		{ "{\"b\": true}", 11 },
+		{ "[3]", 3 },
+	};
+	/* document:type:data of each event */
+	static const char expected[] =
+		"0:1: 0:5:1 0:3: "
+		"1:2: 1:8:a "
+		"2:1: 2:5:2 "
+		"3:2: 3:8:b 3:9: 3:4: "
+		"4:1: 4:5:3 4:3: ";
+	int status[5];
+	struct trace t;
+	json_parser parser;
+	int ret;
+
+	memset(&t, 0, sizeof(t));
+	t.parser = &parser;
+	json_parser_init(&parser, NULL, trace_callback, &t);
+	ret = json_parser_documents(&parser, documents, 5, status);
+	check("documents count", ret == 2);
+	check("documents status", status[0] == 0 && status[1] == JSON_ERROR_UNEXPECTED_CHAR
+	                          && status[2] == JSON_ERROR_INCOMPLETE && status[3] == 0
+	                          && status[4] == 0);
+	check("documents events", t.length == strlen(expected) && memcmp(t.text, expected, t.length) == 0);
+	json_parser_free(&parser);
+}
+
+/* a callback suspending the parser gets the same events as one that doesn't,
+ * wherever the input is cut, including when the suspending character also ends
+ * an array */
+static void test_suspend(void)
+{
+	static const struct { int type; const char *name; } suspends[] = {
+		{ -1, "suspend every event" },
+		{ JSON_INT, "suspend after numbers" },
+		{ JSON_FLOAT, "suspend on array end" },
+	};
+	uint32_t length = strlen(reuse_text), cut;
+	struct trace fresh, t;
+	json_config config;
+	json_parser parser;
+	int i, ret, ok, suspensions;
+
+	memset(&config, 0, sizeof(config));
+	trace_fresh(&config, reuse_text, &fresh);
+	for (i = 0; i < (int) (sizeof(suspends) / sizeof(suspends[0])); i++) {
+		ok = 1;
+		suspensions = 0;
+		for (cut = 0; cut <= length; cut++) {
+			memset(&t, 0, sizeof(t));
+			t.suspend = suspends[i].type;
+			json_parser_init(&parser, &config, trace_callback, &t);
+			ret = feed(&parser, reuse_text, cut, &suspensions);
+			if (!ret)
+				ret = feed(&parser, reuse_text + cut, length - cut, &suspensions);
+			ok = ok && !ret && json_parser_is_done(&parser) && same_trace(&t, &fresh);
+			json_parser_free(&parser);
+		}
+		check(suspends[i].name, ok && suspensions > 0);
+	}
+}
+
+/* parse text up to cut, save the parser, and finish the parse with another parser
+ * restored from the saved state */
+static int save_restore(const json_config *config, const char *text, uint32_t cut, struct trace *t)
+{
+	json_config c = *config;
+	json_parser parser;
+	struct output saved;
+	int ret;
+
+	memset(t, 0, sizeof(*t));
+	memset(&saved, 0, sizeof(saved));
+	json_parser_init(&parser, &c, trace_callback, t);
+	ret = json_parser_string(&parser, text, cut, NULL);
+	if (!ret)
+		ret = json_parser_save(&parser, append_output, &saved);
+	json_parser_free(&parser);
+	if (ret)
+		return ret;
+
+	json_parser_init(&parser, &c, trace_callback, t);
+	ret = json_parser_restore(&parser, saved.data, saved.length);
+	if (!ret)
+		ret = json_parser_string(&parser, text + cut, strlen(text) - cut, NULL);
+	if (!ret && !json_parser_is_done(&parser))
+		ret = JSON_ERROR_INCOMPLETE;
+	json_parser_free(&parser);
+	return ret;
+}
+
+/* a parse saved and restored anywhere, in a string, an escape or a number, gives
+ * the same events as a parse in one go */
+static void test_save_restore(void)
+{
+	uint32_t length = strlen(partial_text), cut;
+	const char *escape = strstr(partial_text, "\\u00e9") + 3;
+	const char *string = strstr(partial_text, "longer than");
+	struct trace fresh, t;
+	json_config config;
+	json_parser parser;
+	struct output saved;
+	int ok, ret;
+
+	memset(&config, 0, sizeof(config));
+	trace_fresh(&config, partial_text, &fresh);
+	for (ok = 1, cut = 0; cut <= length; cut++)
+		ok = ok && !save_restore(&config, partial_text, cut, &t) && same_trace(&t, &fresh);
+	check("save restore", ok);
+
+	ok = !save_restore(&config, partial_text, string - partial_text, &t) && same_trace(&t, &fresh)
+	     && !save_restore(&config, partial_text, escape - partial_text, &t) && same_trace(&t, &fresh);
+	check("save restore mid-string", ok);
+
+	/* with the pieces of a value already delivered */
+	config.partial_size = 4;
+	trace_fresh(&config, partial_text, &fresh);
+	for (ok = 1, cut = 0; cut <= length; cut++)
+		ok = ok && !save_restore(&config, partial_text, cut, &t) && same_trace(&t, &fresh);
+	check("save restore partial", ok);
+
+	/* a damaged state is refused */
+	memset(&saved, 0, sizeof(saved));
+	json_parser_init(&parser, &config, trace_callback, &t);
+	json_parser_string(&parser, partial_text, string - partial_text, NULL);
+	json_parser_save(&parser, append_output, &saved);
+	json_parser_free(&parser);
+	saved.data[saved.length - 1] ^= 1;
+	json_parser_init(&parser, &config, trace_callback, &t);
+	ret = json_parser_restore(&parser, saved.data, saved.length);
+	check("restore damaged", ret == JSON_ERROR_SNAPSHOT);
+	json_parser_free(&parser);
+}
+
+/* joins the JSON_PARTIAL pieces before tracing the values, checking each piece */
+struct pieces {
+	struct trace t;
+	char value[256];
+	uint32_t length;
+	uint32_t count;
+	uint32_t max_piece;
+	int suspend;
+	int ok;
+};
+
+/* a piece ends on a whole utf8 sequence */
+static int utf8_whole(const char *data, uint32_t length)
+{
+	uint32_t i = length, n = 0;
+
+	while (i > 0 && ((unsigned char) data[i - 1] & 0xc0) == 0x80 && n < 4) {
+		i--;
+		n++;
+	}
+	if (i == 0 || (unsigned char) data[i - 1] < 0x80)
+		return n == 0;
+	i = (unsigned char) data[i - 1];
+	return n + 1 == (uint32_t) ((i >= 0xf0) ? 4 : (i >= 0xe0) ? 3 : 2);
+}
+
+static int pieces_callback(void *userdata, int type, const char *data, uint32_t length)
+{
+	struct pieces *p = userdata;
+
+	if (type == JSON_PARTIAL) {
+		if (p->length + length > sizeof(p->value) || !utf8_whole(data, length))
+			p->ok = 0;
+		else {
+			memcpy(p->value + p->length, data, length);
+			p->length += length;
+		}
+		p->count++;
+		if (length > p->max_piece)
+			p->max_piece = length;
+		return (p->suspend) ? JSON_SUSPEND : 0;
+	}
+	if (p->length > 0) {
+		/* the last event of a value in pieces is never empty */
+		if (length == 0 || p->length + length > sizeof(p->value))
+			p->ok = 0;
+		else
+			memcpy(p->value + p->length, data, length);
+		length += p->length;
+		data = p->value;
+		p->length = 0;
+	}
+	return trace_callback(&p->t, type, data, length);
+}
+
+/* with partial_size, long strings, keys and numbers come in pieces that make the
+ * whole values, also when the callback suspends the parser on each piece */
+static void test_partial(void)
+{
+	struct trace fresh;
+	struct pieces p;
+	json_config config;
+	json_parser parser;
+	int ret, suspensions = 0;
+
+	memset(&config, 0, sizeof(config));
+	trace_fresh(&config, partial_text, &fresh);
+	config.partial_size = 4;
+
+	memset(&p, 0, sizeof(p));
+	p.ok = 1;
+	json_parser_init(&parser, &config, pieces_callback, &p);
+	ret = json_parser_string(&parser, partial_text, strlen(partial_text), NULL);
+	json_parser_free(&parser);
+	check("partial pieces", !ret && p.ok && p.count > 0 && same_trace(&p.t, &fresh));
+	/* an utf8 sequence isn't cut, so a piece can be a few bytes longer */
+	check("partial piece size", p.max_piece >= 4 && p.max_piece < 4 + 4);
+
+	memset(&p, 0, sizeof(p));
+	p.ok = 1;
+	p.suspend = 1;
+	json_parser_init(&parser, &config, pieces_callback, &p);
+	ret = feed(&parser, partial_text, strlen(partial_text), &suspensions);
+	json_parser_free(&parser);
+	check("partial suspend", !ret && p.ok && suspensions == (int) p.count && same_trace(&p.t, &fresh));
+}
+
+/* a buffer grown by a long value is shrunk back with shrink_buffer, and parsers
+ * sharing a budget stop when it's exhausted, then go on once memory is given back */
+static void test_buffer_memory(void)
+{
+	static const char text[] = "[\"a string of some twenty bytes\", 1]";
+	json_budget budget = { 40, 0 };
+	struct trace fresh, t;
+	json_config config;
+	json_parser p1, p2, p3;
+	uint32_t processed;
+	int ret;
+
+	memset(&config, 0, sizeof(config));
+	config.buffer_initial_size = 16;
+	trace_fresh(&config, text, &fresh);
+	memset(&t, 0, sizeof(t));
+	json_parser_init(&p1, &config, trace_callback, &t);
+	json_parser_string(&p1, text, strlen(text), NULL);
+	check("buffer grown", p1.buffer_size > 16);
+	json_parser_free(&p1);
+
+	config.shrink_buffer = 1;
+	memset(&t, 0, sizeof(t));
+	json_parser_init(&p1, &config, trace_callback, &t);
+	ret = json_parser_string(&p1, text, strlen(text), NULL);
+	check("buffer shrunk", !ret && p1.buffer_size == 16 && same_trace(&t, &fresh));
+	json_parser_free(&p1);
+
+	config.budget = &budget;
+	memset(&t, 0, sizeof(t));
+	json_parser_init(&p1, &config, trace_callback, &t);
+	json_parser_init(&p2, &config, trace_callback, NULL);
+	ret = json_parser_init(&p3, &config, trace_callback, NULL);
+	check("budget init", ret == JSON_ERROR_BUDGET && budget.used == 32);
+
+	ret = json_parser_string(&p1, text, strlen(text), &processed);
+	check("budget exhausted", ret == JSON_ERROR_BUDGET && processed < strlen(text) && budget.used == 32);
+	json_parser_free(&p2);
+	ret = json_parser_string(&p1, text + processed, strlen(text) - processed, NULL);
+	check("budget retry", !ret && json_parser_is_done(&p1) && same_trace(&t, &fresh)
+	                      && budget.used == 16);
+	json_parser_free(&p1);
+	check("budget given back", budget.used == 0);
+}
+
+static int no_batch(void *userdata, const json_event *events, uint32_t nb_events, const char *data)
+{
+	return 0;
+}
+
+static int match_all(void *userdata, uint32_t depth)
+{
+	return 1;
+}
+
+static int no_array(void *userdata, int type, const void *values, uint32_t count)
+{
+	return 0;
+}
+
+/* print arrays of integers, doubles and strings, after a key, nested and empty,
+ * with the array functions or element by element */
+static int print_arrays(int (*f)(json_printer *, int, const char *, uint32_t), int by_element,
+                        struct output *out)
+{
+	static const int64_t ints[] = { 1, -20, 300 };
+	static const double doubles[] = { 0.5, -1e100, 3 };
+	static const char *strings[] = { "a", NULL, "\"quoted\"\n" };
+	json_printer printer;
+	char b[32];
+	int i, ret;
+
+	memset(out, 0, sizeof(*out));
+	json_print_init(&printer, append_output, out);
+	ret = (*f)(&printer, JSON_OBJECT_BEGIN, NULL, 0);
+	ret = ret || (*f)(&printer, JSON_KEY, "k", 1);
+	if (by_element) {
+		ret = ret || (*f)(&printer, JSON_ARRAY_BEGIN, NULL, 0);
+		for (i = 0; i < 3; i++)
+			ret = ret || (*f)(&printer, JSON_INT, b, snprintf(b, sizeof(b), "%lld", (long long) ints[i]));
+		ret = ret || (*f)(&printer, JSON_ARRAY_END, NULL, 0);
+	} else
+		ret = ret || json_print_int64_array(&printer, f, ints, 3);
+	ret = ret || (*f)(&printer, JSON_KEY, "n", 1);
+	ret = ret || (*f)(&printer, JSON_ARRAY_BEGIN, NULL, 0);
+	if (by_element) {
+		static const char *texts[] = { "0.5", "-1e+100", "3" };
+		ret = ret || (*f)(&printer, JSON_ARRAY_BEGIN, NULL, 0);
+		for (i = 0; i < 3; i++)
+			ret = ret || (*f)(&printer, JSON_FLOAT, texts[i], strlen(texts[i]));
+		ret = ret || (*f)(&printer, JSON_ARRAY_END, NULL, 0);
+		ret = ret || (*f)(&printer, JSON_ARRAY_BEGIN, NULL, 0);
+		for (i = 0; i < 3; i++) {
+			if (strings[i])
+				ret = ret || (*f)(&printer, JSON_STRING, strings[i], strlen(strings[i]));
+			else
+				ret = ret || (*f)(&printer, JSON_NULL, NULL, 0);
+		}
+		ret = ret || (*f)(&printer, JSON_ARRAY_END, NULL, 0);
+		ret = ret || (*f)(&printer, JSON_ARRAY_BEGIN, NULL, 0);
+		ret = ret || (*f)(&printer, JSON_ARRAY_END, NULL, 0);
+	} else {
+		ret = ret || json_print_double_array(&printer, f, doubles, 3);
+		ret = ret || json_print_string_array(&printer, f, strings, NULL, 3);
+		ret = ret || json_print_int64_array(&printer, f, ints, 0);
+	}
+	ret = ret || (*f)(&printer, JSON_ARRAY_END, NULL, 0);
+	ret = ret || (*f)(&printer, JSON_KEY, "e", 1);
+	if (by_element) {
+		ret = ret || (*f)(&printer, JSON_ARRAY_BEGIN, NULL, 0);
+		ret = ret || (*f)(&printer, JSON_ARRAY_END, NULL, 0);
+	} else
+		ret = ret || json_print_double_array(&printer, f, doubles, 0);
+	ret = ret || (*f)(&printer, JSON_OBJECT_END, NULL, 0);
+	json_print_free(&printer);
+	return ret;
+}
+
+/* doubles are printed with the fewest digits that read back the same, and the
+ * array functions print what printing element by element does */
+static void test_print_arrays(void)
+{
+	static const struct { double d; const char *text; } doubles[] = {
+		{ 0.1, "0.1" }, { 1e-9, "0.000000001" }, { 1e-10, "1e-10" }, { 5e-324, "5e-324" }, { -0.0, "-0" },
+		{ 9007199254740992.0, "9007199254740992" }, { 1.0 / 3, "0.3333333333333333" },
+		{ 2.5, "2.5" }, { -1e300, "-1e+300" }, { 1.7976931348623157e308, "1.7976931348623157e+308" },
+	};
+	double values[sizeof(doubles) / sizeof(doubles[0])];
+	struct output out, elements;
+	json_printer printer;
+	char expected[512];
+	uint32_t n;
+	size_t i;
+	int ret, ok = 1;
+
+	n = snprintf(expected, sizeof(expected), "[");
+	for (i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+		double d = strtod(doubles[i].text, NULL);
+		n += snprintf(expected + n, sizeof(expected) - n, "%s%s", (i) ? "," : "", doubles[i].text);
+		/* the expected text reads back as the double, sign of zero included */
+		ok = ok && memcmp(&d, &doubles[i].d, sizeof(d)) == 0;
+		values[i] = doubles[i].d;
+	}
+	snprintf(expected + n, sizeof(expected) - n, "]");
+	memset(&out, 0, sizeof(out));
+	json_print_init(&printer, append_output, &out);
+	ret = json_print_double_array(&printer, json_print_raw, values, i);
+	json_print_free(&printer);
+	check("print shortest doubles", ok && !ret && strcmp(out.data, expected) == 0);
+
+	values[0] = strtod("nan", NULL);
+	values[1] = strtod("inf", NULL);
+	values[2] = -values[1];
+	memset(&out, 0, sizeof(out));
+	json_print_init(&printer, append_output, &out);
+	ret = json_print_double_array(&printer, json_print_raw, values, 3);
+	json_print_free(&printer);
+	check("print nan and infinities", !ret && strcmp(out.data, "[null,null,null]") == 0);
+
+	ret = print_arrays(json_print_raw, 0, &out) || print_arrays(json_print_raw, 1, &elements);
+	check("print raw arrays", same_output(ret, &out, 0, &elements));
+	ret = print_arrays(json_print_pretty, 0, &out) || print_arrays(json_print_pretty, 1, &elements);
+	check("print pretty arrays", same_output(ret, &out, 0, &elements));
+}
+
+/* with skip_unknown_keys, an unknown member is skipped up to the end of its
+ * value, whatever its nesting and the brackets in its strings, also when the
+ * input comes one byte at a time and when its key or strings come in pieces */
+static void test_skip_unknown_keys(void)
+{
+	static const char *keys[] = { "id", "name", NULL };
+	static const char text[] =
+		"{\"id\": 1, \"junk\": {\"a\": [1, {\"b\": \"}]\"}, [[]], \"x}\"], \"c\": {\"d\": {}}},"
+		" \"name\": \"n\", \"x\": \"]}\\\"}\", \"an unknown key longer than a piece\":"
+		" [{\"k\": \"a string longer than a piece }\"}, -1.5e10], \"id\": 2}";
+	static const char expected[] = "2: 8:id 5:1 8:name 7:n 8:id 5:2 4: ";
+	static const uint32_t partial_sizes[] = { 0, 4 };
+	json_config config;
+	json_parser parser;
+	struct trace t;
+	uint32_t i, length = strlen(text);
+	int by_byte, p, ret;
+	char name[64];
+
+	memset(&config, 0, sizeof(config));
+	config.keys = keys;
+	config.skip_unknown_keys = 1;
+	for (p = 0; p < 2; p++) {
+		for (by_byte = 0; by_byte < 2; by_byte++) {
+			config.partial_size = partial_sizes[p];
+			memset(&t, 0, sizeof(t));
+			json_parser_init(&parser, &config, trace_callback, &t);
+			if (by_byte) {
+				for (i = 0, ret = 0; i < length && !ret; i++)
+					ret = json_parser_string(&parser, text + i, 1, NULL);
+			} else
+				ret = json_parser_string(&parser, text, length, NULL);
+			json_parser_free(&parser);
+			snprintf(name, sizeof(name), "skip unknown keys%s%s", (by_byte) ? " by byte" : "",
+			         (partial_sizes[p]) ? " in pieces" : "");
+			check(name, !ret && strcmp(t.text, expected) == 0);
+		}
+	}
+}
+
+/* the bytes of a base64 member, in JSON_PARTIAL pieces and a JSON_BSTRING */
+struct bytes {
+	char data[16384];
+	uint32_t length;
+	uint32_t pieces;
+	int type;
+	int ok;
+};
+
+static int bytes_callback(void *userdata, int type, const char *data, uint32_t length)
+{
+	struct bytes *b = userdata;
+
+	if (type != JSON_PARTIAL && type != JSON_BSTRING)
+		return 0;
+	/* a piece is cut on a base64 quantum of 4 characters: it decodes to whole groups of 3 bytes */
+	if (b->length + length > sizeof(b->data) || (type == JSON_PARTIAL && length % 3))
+		b->ok = 0;
+	else {
+		memcpy(b->data + b->length, data, length);
+		b->length += length;
+	}
+	if (type == JSON_PARTIAL)
+		b->pieces++;
+	b->type = type;
+	return 0;
+}
+
+static int bytes_parse(uint32_t partial_size, const char *text, uint32_t length, struct bytes *b)
+{
+	static const char *base64_keys[] = { "b", NULL };
+	json_config config;
+	json_parser parser;
+	int ret;
+
+	memset(&config, 0, sizeof(config));
+	memset(b, 0, sizeof(*b));
+	b->ok = 1;
+	config.base64_keys = base64_keys;
+	config.partial_size = partial_size;
+	json_parser_init(&parser, &config, bytes_callback, b);
+	ret = json_parser_string(&parser, text, length, NULL);
+	json_parser_free(&parser);
+	return ret;
+}
+
+static int append_text(void *userdata, const char *s, uint32_t length)
+{
+	struct bytes *b = userdata;
+
+	if (b->length + length > sizeof(b->data))
+		return 1;
+	memcpy(b->data + b->length, s, length);
+	b->length += length;
+	return 0;
+}
+
+/* base64 members are decoded padded or not, refused when not base64, and cut in
+ * pieces on a quantum; the printer writes a long JSON_BSTRING in several chunks */
+static void test_base64(void)
+{
+	static const struct { const char *text; const char *value; } good[] = {
+		{ "{\"b\": \"aGVsbG8=\"}", "hello" }, { "{\"b\": \"aGVsbG8\"}", "hello" },
+		{ "{\"b\": \"aGVsbA==\"}", "hell" }, { "{\"b\": \"aGVsbA\"}", "hell" },
+		{ "{\"b\": \"aGVs\"}", "hel" }, { "{\"b\": \"\"}", "" },
+		{ "{\"b\": \"aGVs\\u0062G8=\"}", "hello" },
+	};
+	static const char *bad[] = {
+		/* bits past the data not zero */
+		"{\"b\": \"aGVsbG9=\"}", "{\"b\": \"aGVsbB\"}",
+		/* padding in the middle, too much padding, one character left over */
+		"{\"b\": \"aGk=aGk=\"}", "{\"b\": \"aGk==\"}", "{\"b\": \"aGVsb\"}",
+		/* out of the alphabet */
+		"{\"b\": \"aG$s\"}", "{\"b\": \"aGV sbG8=\"}",
+	};
+	static char binary[10000];
+	static struct bytes printed, parsed;
+	json_printer printer;
+	size_t i;
+	int ret, ok;
+
+	for (i = 0; i < sizeof(binary); i++)
+		binary[i] = (char) (i * 7 + (i >> 8));
+
+	ok = 1;
+	for (i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+		ret = bytes_parse(0, good[i].text, strlen(good[i].text), &parsed);
+		ok = ok && !ret && parsed.type == JSON_BSTRING && parsed.length == strlen(good[i].value)
+		     && memcmp(parsed.data, good[i].value, parsed.length) == 0;
+	}
+	check("base64 decode", ok);
+	ok = 1;
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+		ok = ok && bytes_parse(0, bad[i], strlen(bad[i]), &parsed) == JSON_ERROR_BASE64;
+	check("base64 errors", ok);
+
+	/* printed in chunks of 3072 bytes, as 4096 characters each */
+	memset(&printed, 0, sizeof(printed));
+	append_text(&printed, "{\"b\":", 5);
+	json_print_init(&printer, append_text, &printed);
+	printer.base64 = 1;
+	ret = json_print_raw(&printer, JSON_BSTRING, binary, sizeof(binary));
+	json_print_free(&printer);
+	append_text(&printed, "}", 1);
+	check("base64 print", !ret && printed.length == 5 + 2 + (sizeof(binary) + 2) / 3 * 4 + 1
+	                      && memchr(printed.data, '=', printed.length - 4) == NULL);
+
+	ret = bytes_parse(0, printed.data, printed.length, &parsed);
+	check("base64 print and parse", !ret && parsed.type == JSON_BSTRING && parsed.pieces == 0
+	                                && parsed.length == sizeof(binary)
+	                                && memcmp(parsed.data, binary, sizeof(binary)) == 0);
+
+	/* pieces are cut on a quantum even when partial_size isn't a multiple of 4 */
+	for (i = 5; i <= 9; i += 2) {
+		ret = bytes_parse(i, printed.data, printed.length, &parsed);
+		check((i == 5) ? "base64 pieces of 5" : (i == 7) ? "base64 pieces of 7" : "base64 pieces of 9",
+		      !ret && parsed.ok && parsed.type == JSON_BSTRING && parsed.pieces > 1
+		      && parsed.length == sizeof(binary) && memcmp(parsed.data, binary, sizeof(binary)) == 0);
+	}
+	/* padding ending a piece is in the middle of the value */
+	ret = bytes_parse(4, "{\"b\": \"aGk=aGk=aGk=\"}", 21, &parsed);
+	check("base64 padding in a piece", ret == JSON_ERROR_BASE64);
+}
+
+/* the arrays given to the array callback */
+struct arrays {
+	int calls;
+	int type[4];
+	uint32_t count[4];
+	union { int64_t i; double d; } values[4][16];
+};
+
+static int capture_array(void *userdata, int type, const void *values, uint32_t count)
+{
+	struct arrays *a = userdata;
+
+	if (a->calls == 4 || count > 16)
+		return 1;
+	a->type[a->calls] = type;
+	a->count[a->calls] = count;
+	memcpy(a->values[a->calls], values, count * 8);
+	a->calls++;
+	return 0;
+}
+
+/* trace text, given whole or one byte at a time, with numeric arrays captured or not */
+static int trace_arrays(const char *text, int by_byte, struct arrays *a, struct trace *t)
+{
+	json_config config;
+	json_parser parser;
+	uint32_t i, length = strlen(text);
+	int ret = 0;
+
+	memset(&config, 0, sizeof(config));
+	memset(t, 0, sizeof(*t));
+	if (a)
+		memset(a, 0, sizeof(*a));
+	json_parser_init(&parser, &config, trace_callback, t);
+	if (a)
+		json_parser_arrays(&parser, match_all, capture_array, a);
+	if (by_byte) {
+		for (i = 0; i < length && !ret; i++)
+			ret = json_parser_string(&parser, text + i, 1, NULL);
+	} else
+		ret = json_parser_string(&parser, text, length, NULL);
+	json_parser_free(&parser);
+	return ret;
+}
+
+/* captured arrays hold the values strtod gives, whether number_value computes
+ * them or falls back to strtod; other arrays, and arrays cut by an error, give
+ * the events of a parser without arrays */
+static void test_arrays(void)
+{
+	static const int64_t ints[] = { 0, -1, 18, 123456789012345678, INT64_MAX, INT64_MIN };
+	static const char *floats[] = {
+		"1", "0.1", "-2.5e-3", "1e22", "9007199254740992", "1e23", "4.35e-300",
+		"9007199254740993", "9223372036854775808", "3.141592653589793238462643",
+		"-0.0", "5e-324", "1.7976931348623157e308",
+	};
+	static const char *fallbacks[] = {
+		"[1, 2.5, \"a\"]", "[1, true, 2]", "[null]", "[1, {\"k\": 2}]", "[\"a\", 1]",
+	};
+	static const char *errors[] = { "[1, 2.5, 3x]", "[1, 2,]", "[1, 2 3]", "{\"a\": [1, -]}" };
+	char text[512];
+	struct arrays a;
+	struct trace with, without;
+	uint32_t n;
+	size_t i;
+	int by_byte, ret1, ret2, ok;
+
+	n = snprintf(text, sizeof(text), "{\"i\": [0, -1, 18, 123456789012345678, %s, %s], \"f\": [",
+	             "9223372036854775807", "-9223372036854775808");
+	for (i = 0; i < sizeof(floats) / sizeof(floats[0]); i++)
+		n += snprintf(text + n, sizeof(text) - n, "%s%s", (i) ? ", " : "", floats[i]);
+	snprintf(text + n, sizeof(text) - n, "]}");
+
+	for (by_byte = 0; by_byte < 2; by_byte++) {
+		ret1 = trace_arrays(text, by_byte, &a, &with);
+		ok = !ret1 && strcmp(with.text, "2: 8:i 8:f 4: ") == 0 && a.calls == 2
+		     && a.type[0] == JSON_INT && a.count[0] == 6
+		     && a.type[1] == JSON_FLOAT && a.count[1] == sizeof(floats) / sizeof(floats[0]);
+		for (i = 0; ok && i < a.count[0]; i++)
+			ok = a.values[0][i].i == ints[i];
+		for (i = 0; ok && i < a.count[1]; i++) {
+			double d = strtod(floats[i], NULL);
+			ok = memcmp(&a.values[1][i].d, &d, sizeof(d)) == 0;
+		}
+		check((by_byte) ? "arrays values by byte" : "arrays values", ok);
+
+		ok = 1;
+		for (i = 0; i < sizeof(fallbacks) / sizeof(fallbacks[0]); i++) {
+			ret1 = trace_arrays(fallbacks[i], by_byte, &a, &with);
+			ret2 = trace_arrays(fallbacks[i], by_byte, NULL, &without);
+			ok = ok && !ret1 && !ret2 && a.calls == 0 && same_trace(&with, &without);
+		}
+		check((by_byte) ? "arrays fallback by byte" : "arrays fallback", ok);
+
+		ok = 1;
+		for (i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+			ret1 = trace_arrays(errors[i], by_byte, &a, &with);
+			ret2 = trace_arrays(errors[i], by_byte, NULL, &without);
+			ok = ok && ret1 && ret1 == ret2 && a.calls == 0 && same_trace(&with, &without);
+		}
+		check((by_byte) ? "arrays error by byte" : "arrays error", ok);
+	}
+}
+
+/* a parser, in all its modes, and the DOM helper only allocate with their allocator,
+ * and give it all the memory back, also when json_parser_init fails */
+static void test_parser_allocator(void)
+{
+	static const char *keys[] = { "key", "other", NULL };
+	static const char text[] = "{\"key\": [1, 2, 3], \"other\": [\"a string longer than a piece\", 1.5]}";
+	struct counting counting = { 0, 0, 0 };
+	json_allocator allocator = { counting_calloc, counting_realloc, counting_free, &counting };
+	json_event events[4];
+	json_config config;
+	json_parser parser;
+	json_parser_dom dom;
+	struct value *root;
+	long total;
+	int ret, ok;
+
+	memset(&config, 0, sizeof(config));
+	config.allocator = &allocator;
+	config.keys = keys;
+	config.buffer_initial_size = 8;
+	config.partial_size = 16;
+	ret = json_parser_init(&parser, &config, trace_callback, NULL);
+	ret = ret || json_parser_batch(&parser, events, 4, NULL, 0, no_batch, NULL);
+	ret = ret || json_parser_arrays(&parser, match_all, no_array, NULL);
+	ret = ret || json_parser_string(&parser, text, strlen(text), NULL);
+	json_parser_free(&parser);
+	check("allocator parser", !ret && counting.total > 0 && counting.live == 0);
+
+	/* each allocation of json_parser_init failing in turn */
+	config.partial_size = 0;
+	counting.total = 0;
+	json_parser_init(&parser, &config, trace_callback, NULL);
+	json_parser_free(&parser);
+	total = counting.total;
+	for (ok = 1, counting.fail = 1; counting.fail <= total; counting.fail++) {
+		counting.total = 0;
+		ret = json_parser_init(&parser, &config, trace_callback, NULL);
+		ok = ok && ret == JSON_ERROR_NO_MEMORY && counting.live == 0;
+	}
+	counting.fail = 0;
+	check("allocator parser init failure", ok && total > 0);
+
+	counting.total = 0;
+	json_parser_dom_init(&dom, create_structure, create_data, append);
+	json_parser_dom_allocator(&dom, &allocator);
+	json_parser_dom_intern(&dom, 4);
+	json_parser_init(&parser, NULL, json_parser_dom_callback, &dom);
+	ret = json_parser_string(&parser, text, strlen(text), NULL);
+	json_parser_free(&parser);
+	root = dom.root_structure;
+	free(root);
+	json_parser_dom_free(&dom);
+	check("allocator dom", !ret && root && counting.total > 0 && counting.live == 0);
+}
+
+/* the encoder writes the shortest forms, and json_decode gives back the events it was given */
+static void test_binary_formats(void)
+{
+	static const char text[] = "{\"a\": [1, -1, 1.5, 0.1, \"x\", true, false, null], \"b\": 1000}";
+	static const char cbor[] = "\xa2\x61\x61\x88\x01\x20\xfa\x3f\xc0\x00\x00\xfb\x3f\xb9\x99\x99\x99\x99\x99\x9a"
+	                           "\x61\x78\xf5\xf4\xf6\x61\x62\x19\x03\xe8";
+	static const char msgpack[] = "\x82\xa1\x61\x98\x01\xff\xca\x3f\xc0\x00\x00\xcb\x3f\xb9\x99\x99\x99\x99\x99\x9a"
+	                              "\xa1\x78\xc3\xc2\xc0\xa1\x62\xcd\x03\xe8";
+	static const char round[] =
+		"{\"list\": [0, 23, 24, 255, 256, 65535, 65536, 4294967296, -24, -25, -256, -257,"
+		" -65537, -4294967297, 1.5, -0.25, 0.1, 1e+300, true, false, null],"
+		" \"nested\": {\"a\": [[], {}], \"s\": \"a string of more than thirty one bytes, \\u00e9\"},"
+		" \"\": \"\"}";
+	static const json_binary_format formats[] = { JSON_FORMAT_CBOR, JSON_FORMAT_MSGPACK };
+	struct trace parsed, decoded;
+	struct output out;
+	json_encoder enc;
+	size_t i;
+	int ret;
+
+	memset(&out, 0, sizeof(out));
+	json_encoder_init(&enc, JSON_FORMAT_CBOR, append_output, &out, NULL);
+	ret = parse_with(0, text, json_encoder_callback, &enc);
+	json_encoder_free(&enc);
+	check("cbor bytes", !ret && out.length == sizeof(cbor) - 1 && memcmp(out.data, cbor, out.length) == 0);
+
+	memset(&out, 0, sizeof(out));
+	json_encoder_init(&enc, JSON_FORMAT_MSGPACK, append_output, &out, NULL);
+	ret = parse_with(0, text, json_encoder_callback, &enc);
+	json_encoder_free(&enc);
+	check("msgpack bytes", !ret && out.length == sizeof(msgpack) - 1 && memcmp(out.data, msgpack, out.length) == 0);
+
+	memset(&parsed, 0, sizeof(parsed));
+	ret = parse_with(0, round, trace_callback, &parsed);
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		memset(&out, 0, sizeof(out));
+		json_encoder_init(&enc, formats[i], append_output, &out, NULL);
+		ret = ret || parse_with(0, round, json_encoder_callback, &enc);
+		json_encoder_free(&enc);
+		memset(&decoded, 0, sizeof(decoded));
+		ret = ret || json_decode(formats[i], out.data, out.length, trace_callback, &decoded, NULL);
+		check((formats[i] == JSON_FORMAT_CBOR) ? "cbor round trip" : "msgpack round trip",
+		      !ret && strcmp(parsed.text, decoded.text) == 0);
+	}
+}
+
+/* what json_decode accepts beyond what the encoder writes, and what it refuses */
+static void test_decode_malformed(void)
+{
+	static const struct { json_binary_format format; const char *data; size_t length; const char *trace; } good[] = {
+		{ JSON_FORMAT_CBOR, "\x7f\x61" "a\x62" "bc\xff", 7, "7:abc " },
+		{ JSON_FORMAT_CBOR, "\x7f\xff", 2, "7: " },
+		{ JSON_FORMAT_CBOR, "\x9f\x01\x9f\xff\xff", 5, "1: 5:1 1: 3: 3: " },
+		{ JSON_FORMAT_CBOR, "\xbf\x61" "a\x01\xff", 5, "2: 8:a 5:1 4: " },
+		{ JSON_FORMAT_CBOR, "\xa2\x01\x02\x20\x03", 5, "2: 8:1 5:2 8:-1 5:3 4: " },
+		{ JSON_FORMAT_MSGPACK, "\x81\xff\x02", 3, "2: 8:-1 5:2 4: " },
+	};
+	static const struct { json_binary_format format; const char *data; size_t length; } bad[] = {
+		/* truncated */
+		{ JSON_FORMAT_CBOR, "\x19\x01", 2 },
+		{ JSON_FORMAT_CBOR, "\x82\x01", 2 },
+		{ JSON_FORMAT_CBOR, "\x9f\x01", 2 },
+		{ JSON_FORMAT_CBOR, "\x7f\x61" "a", 3 },
+		{ JSON_FORMAT_MSGPACK, "\xcd\x01", 2 },
+		{ JSON_FORMAT_MSGPACK, "\x92\x01", 2 },
+		/* lengths beyond the input */
+		{ JSON_FORMAT_CBOR, "\x63" "ab", 3 },
+		{ JSON_FORMAT_CBOR, "\x5a\xff\xff\xff\xff\x01", 6 },
+		{ JSON_FORMAT_MSGPACK, "\xa3" "ab", 3 },
+		{ JSON_FORMAT_MSGPACK, "\xc4\x05\x01", 3 },
+		{ JSON_FORMAT_MSGPACK, "\xdb\xff\xff\xff\xff\x01", 6 },
+		/* indefinite strings with chunks of another type or indefinite */
+		{ JSON_FORMAT_CBOR, "\x7f\x61" "a\x01\xff", 5 },
+		{ JSON_FORMAT_CBOR, "\x7f\x42\x01\x02\xff", 5 },
+		{ JSON_FORMAT_CBOR, "\x5f\x5f\xff\xff", 4 },
+		/* map keys neither strings nor integers */
+		{ JSON_FORMAT_CBOR, "\xa1\x80\x01", 3 },
+		{ JSON_FORMAT_CBOR, "\xa1\xf5\x01", 3 },
+		{ JSON_FORMAT_CBOR, "\xa1\xfa\x3f\xc0\x00\x00\x01", 7 },
+		{ JSON_FORMAT_MSGPACK, "\x81\x90\x01", 3 },
+		{ JSON_FORMAT_MSGPACK, "\x81\xc0\x01", 3 },
+		/* a break where no value is complete, and reserved heads */
+		{ JSON_FORMAT_CBOR, "\xff", 1 },
+		{ JSON_FORMAT_CBOR, "\xbf\x61" "a\xff", 4 },
+		{ JSON_FORMAT_CBOR, "\x1c", 1 },
+		{ JSON_FORMAT_CBOR, "\x1f", 1 },
+		{ JSON_FORMAT_CBOR, "\xf8\x20", 2 },
+		{ JSON_FORMAT_MSGPACK, "\xc1", 1 },
+		{ JSON_FORMAT_MSGPACK, "\xd4\x01\x01", 3 },
+	};
+	struct trace t;
+	size_t i;
+	int ret, ok = 1;
+
+	for (i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+		memset(&t, 0, sizeof(t));
+		ret = json_decode(good[i].format, good[i].data, good[i].length, trace_callback, &t, NULL);
+		check(good[i].trace, !ret && strcmp(t.text, good[i].trace) == 0);
+	}
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		ret = json_decode(bad[i].format, bad[i].data, bad[i].length, no_event, NULL, NULL);
+		if (ret != JSON_ERROR_BINARY_FORMAT) {
+			printf("malformed input %u: %d\n", (unsigned) i, ret);
+			ok = 0;
+		}
+	}
+	check("decode malformed", ok);
+}
+
+/* integers of 64 bits magnitude go from CBOR or MessagePack to JSON text and back unchanged */
+static void test_decode_integers(void)
+{
+	static const struct { json_binary_format format; const char *data; size_t length; const char *text; } docs[] = {
+		{ JSON_FORMAT_CBOR, "\x81\x1b\xff\xff\xff\xff\xff\xff\xff\xff", 10, "[18446744073709551615]" },
+		{ JSON_FORMAT_CBOR, "\x81\x1b\x80\x00\x00\x00\x00\x00\x00\x00", 10, "[9223372036854775808]" },
+		{ JSON_FORMAT_CBOR, "\x81\x3b\x80\x00\x00\x00\x00\x00\x00\x00", 10, "[-9223372036854775809]" },
+		{ JSON_FORMAT_CBOR, "\x81\x3b\xff\xff\xff\xff\xff\xff\xff\xff", 10, "[-18446744073709551616]" },
+		{ JSON_FORMAT_MSGPACK, "\x91\xcf\xff\xff\xff\xff\xff\xff\xff\xff", 10, "[18446744073709551615]" },
+		{ JSON_FORMAT_MSGPACK, "\x91\xd3\x80\x00\x00\x00\x00\x00\x00\x00", 10, "[-9223372036854775808]" },
+	};
+	/* beyond, integers are kept as a double: here -2^63 and +-2^64, which a float holds */
+	static const struct { json_binary_format format; const char *text; const char *data; size_t length; } wide[] = {
+		{ JSON_FORMAT_MSGPACK, "[-9223372036854775809]", "\x91\xca\xdf\x00\x00\x00", 6 },
+		{ JSON_FORMAT_CBOR, "[18446744073709551616]", "\x81\xfa\x5f\x80\x00\x00", 6 },
+		{ JSON_FORMAT_CBOR, "[-18446744073709551617]", "\x81\xfa\xdf\x80\x00\x00", 6 },
+	};
+	struct output text, bytes;
+	json_printer printer;
+	json_encoder enc;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+		memset(&text, 0, sizeof(text));
+		json_print_init(&printer, append_output, &text);
+		ret = json_decode(docs[i].format, docs[i].data, docs[i].length,
+		                  (json_parser_callback) json_print_raw, &printer, NULL);
+		json_print_free(&printer);
+		memset(&bytes, 0, sizeof(bytes));
+		json_encoder_init(&enc, docs[i].format, append_output, &bytes, NULL);
+		ret = ret || parse_with(0, text.data, json_encoder_callback, &enc);
+		json_encoder_free(&enc);
+		check(docs[i].text, !ret && strcmp(text.data, docs[i].text) == 0
+		                    && bytes.length == docs[i].length
+		                    && memcmp(bytes.data, docs[i].data, docs[i].length) == 0);
+	}
+	for (i = 0; i < sizeof(wide) / sizeof(wide[0]); i++) {
+		memset(&bytes, 0, sizeof(bytes));
+		json_encoder_init(&enc, wide[i].format, append_output, &bytes, NULL);
+		ret = parse_with(0, wide[i].text, json_encoder_callback, &enc);
+		json_encoder_free(&enc);
+		check(wide[i].text, !ret && bytes.length == wide[i].length
+		                    && memcmp(bytes.data, wide[i].data, wide[i].length) == 0);
+	}
+}
+
+/* CBOR tags are skipped however many there are, and a tag must be followed by an item */
+static void test_decode_tags(void)
+{
+	static const char tagged[] = "\xc1\xd8\x20\xd9\x01\x00\x01";
+	size_t n = 10 * 1000 * 1000;
+	struct trace t;
+	char *data;
+	int ret;
+
+	memset(&t, 0, sizeof(t));
+	ret = json_decode(JSON_FORMAT_CBOR, tagged, sizeof(tagged) - 1, trace_callback, &t, NULL);
+	check("cbor tags", !ret && strcmp(t.text, "5:1 ") == 0);
+
+	data = malloc(n + 1);
+	memset(data, 0xc0, n);
+	data[n] = 0x01;
+	memset(&t, 0, sizeof(t));
+	ret = json_decode(JSON_FORMAT_CBOR, data, n + 1, trace_callback, &t, NULL);
+	check("cbor many tags", !ret && strcmp(t.text, "5:1 ") == 0);
+	ret = json_decode(JSON_FORMAT_CBOR, data, n, trace_callback, &t, NULL);
+	check("cbor tags without item", ret == JSON_ERROR_BINARY_FORMAT);
+	ret = json_decode(JSON_FORMAT_CBOR, "\xd9\x01", 2, trace_callback, &t, NULL);
+	check("cbor truncated tag", ret == JSON_ERROR_BINARY_FORMAT);
+	free(data);
+}
+
+static char *read_file(const char *filename, size_t *length)
+{
+	FILE *file = fopen(filename, "rb");
+	char *data = NULL;
+	size_t size = 0, read;
+
+	*length = 0;
+	if (!file)
+		return NULL;
+	while (1) {
+		if (*length == size) {
+			size = (size) ? size * 2 : 4096;
+			data = realloc(data, size + 1);
+		}
+		read = fread(data + *length, 1, size - *length, file);
+		if (read == 0)
+			break;
+		*length += read;
+	}
+	fclose(file);
+	data[*length] = '\0';
+	return data;
+}
+
+#define CHECK_MAX_DEPTH 64
+
+/* each value of a json file, looked up in its snapshot by its path */
+struct snapshot_check {
+	json_snapshot snap;
+	uint32_t nodes[CHECK_MAX_DEPTH];
+	uint32_t counts[CHECK_MAX_DEPTH];
+	int depth;
+	char *key;
+	uint32_t key_length;
+	int ok;
+};
+
+static int snapshot_check_callback(void *userdata, int type, const char *data, uint32_t length)
+{
+	struct snapshot_check *c = userdata;
+	uint32_t node, parent;
+
+	switch (type) {
+	case JSON_KEY:
+		free(c->key);
+		c->key = malloc(length + 1);
+		memcpy(c->key, data, length + 1);
+		c->key_length = length;
+		return 0;
+	case JSON_ARRAY_END: case JSON_OBJECT_END:
+		c->depth--;
+		if (json_snapshot_length(&c->snap, c->nodes[c->depth]) != c->counts[c->depth])
+			c->ok = 0;
+		return 0;
+	}
+	if (c->depth == 0)
+		node = c->snap.root;
+	else {
+		parent = c->nodes[c->depth - 1];
+		c->counts[c->depth - 1]++;
+		if (json_snapshot_type(&c->snap, parent) == JSON_ARRAY_BEGIN)
+			node = json_snapshot_get(&c->snap, parent, c->counts[c->depth - 1] - 1);
+		else
+			node = json_snapshot_find(&c->snap, parent, c->key, c->key_length);
+	}
+	if (json_snapshot_type(&c->snap, node) != type)
+		c->ok = 0;
+	else if (type == JSON_ARRAY_BEGIN || type == JSON_OBJECT_BEGIN) {
+		if (c->depth == CHECK_MAX_DEPTH)
+			return JSON_ERROR_NESTING_LIMIT;
+		c->nodes[c->depth] = node;
+		c->counts[c->depth++] = 0;
+	} else if (data && (json_snapshot_length(&c->snap, node) != length
+	                    || memcmp(json_snapshot_data(&c->snap, node), data, length) != 0))
+		c->ok = 0;
+	return 0;
+}
+
+/* check that a snapshot made by jsonlint --compile-dom holds the json file */
+static int check_snapshot(const char *filename, const char *snapshotname)
+{
+	struct snapshot_check c;
+	json_config config;
+	json_parser parser;
+	char *text, *snapshot;
+	size_t text_length, snapshot_length;
+	int ret;
+
+	memset(&c, 0, sizeof(c));
+	memset(&config, 0, sizeof(config));
+	config.allow_c_comments = config.allow_yaml_comments = 1;
+	text = read_file(filename, &text_length);
+	snapshot = read_file(snapshotname, &snapshot_length);
+	if (!text || !snapshot || json_snapshot_open(&c.snap, snapshot, snapshot_length))
+		return 1;
+	c.ok = 1;
+	json_parser_init(&parser, &config, snapshot_check_callback, &c);
+	ret = json_parser_string(&parser, text, text_length, NULL);
+	json_parser_free(&parser);
+	free(c.key);
+	free(text);
+	free(snapshot);
+	return (ret || !c.ok) ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 4 && strcmp(argv[1], "snapshot") == 0)
+		return check_snapshot(argv[2], argv[3]);
+
+	test_dom_value();
+	test_dom_intern();
+	test_dom_base64();
+	test_dom_decode();
+	test_index();
+	test_object();
+	test_partial_callbacks();
+	test_allocator();
+	test_reset();
+	test_pool();
+	test_documents();
+	test_suspend();
+	test_save_restore();
+	test_partial();
+	test_buffer_memory();
+	test_parser_allocator();
+	test_arrays();
+	test_print_arrays();
+	test_base64();
+	test_skip_unknown_keys();
+	test_binary_formats();
+	test_decode_malformed();
+	test_decode_integers();
+	test_decode_tags();
+	return (failures) ? 1 : 0;
+}
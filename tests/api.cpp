@@ -0,0 +1,275 @@
+/*
+ * tests of json.hpp, built as C++11, and as C++20 for the coroutine stream
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+static int failures = 0;
+
+static void check(const char *name, bool ok)
+{
+	if (ok)
+		printf("\033[1;32mSUCCESS\033[0m:  %s (C++%ld)\n", name, (long) (__cplusplus / 100 % 100));
+	else {
+		printf("\033[1;31mFAILED\033[0m :  %s (C++%ld)\n", name, (long) (__cplusplus / 100 % 100));
+		failures++;
+	}
+}
+
+/* writes each event it gets, to compare event sequences */
+struct trace : json::handler {
+	std::string out;
+	int stop_on_true;
+
+	trace() : stop_on_true(0) {}
+
+	void add(const char *tag, const char *data = 0, uint32_t length = 0)
+	{
+		out += tag;
+		if (data)
+			out.append(data, length);
+		out += ' ';
+	}
+
+	int on_object_begin() { add("{"); return 0; }
+	int on_object_end() { add("}"); return 0; }
+	int on_array_begin() { add("["); return 0; }
+	int on_array_end() { add("]"); return 0; }
+	int on_key(const char *data, uint32_t length, int32_t key_id)
+	{
+		char id[16];
+		snprintf(id, sizeof(id), "%d:", (int) key_id);
+		add(id, data, length);
+		return 0;
+	}
+	int on_string(const char *data, uint32_t length) { add("s:", data, length); return 0; }
+	int on_int(const char *data, uint32_t length) { add("i:", data, length); return 0; }
+	int on_float(const char *data, uint32_t length) { add("f:", data, length); return 0; }
+	int on_true() { add("t"); return stop_on_true; }
+	int on_false() { add("f"); return 0; }
+	int on_null() { add("n"); return 0; }
+};
+
+static const char document[] =
+	"{\"a\": [1, 2.5, \"s\\n\", true, false, null], \"b\": {\"c\": \"d\"}, \"e\": []}";
+static const char document_trace[] =
+	"{ 0:a [ i:1 f:2.5 s:s\n t f n ] -1:b { -1:c s:d } 1:e [ ] } ";
+
+static void test_handler()
+{
+	static const char *keys[] = { "a", "e", NULL };
+	json_config config;
+	uint32_t length = (uint32_t) strlen(document), cut;
+	bool ok;
+
+	memset(&config, 0, sizeof(config));
+	config.keys = keys;
+
+	trace t;
+	int ret = json::parse(document, length, t, &config);
+	check("handler dispatch", ret == 0 && t.out == document_trace);
+
+	/* batches of 2 events, and the input cut at each position */
+	ok = true;
+	for (cut = 0; cut <= length; cut++) {
+		trace t2;
+		json::parser<trace, 2> p(t2, &config);
+		ret = p.string(document, cut);
+		if (!ret)
+			ret = p.string(document + cut, length - cut);
+		ok = ok && ret == 0 && p.is_done() && t2.out == document_trace;
+	}
+	check("handler chunks", ok);
+
+	trace t3;
+	t3.stop_on_true = 42;
+	check("handler stop", json::parse(document, length, t3, &config) == 42);
+}
+
+struct inner {
+	int x;
+	std::string name;
+};
+
+struct outer {
+	inner in;
+	std::vector<inner> list;
+	std::vector<double> values;
+	bool flag;
+	unsigned char small;
+	std::string missing;
+};
+
+JSON_BIND(inner, JSON_FIELD(x), JSON_FIELD_KEY(name, "n"))
+JSON_BIND(outer, JSON_FIELD(in), JSON_FIELD(list), JSON_FIELD(values), JSON_FIELD(flag),
+          JSON_FIELD(small), JSON_FIELD(missing))
+
+/* keeps the output of a printer */
+static int append_output(void *userdata, const char *s, uint32_t length)
+{
+	static_cast<std::string *>(userdata)->append(s, length);
+	return 0;
+}
+
+static void test_bind()
+{
+	static const char text[] =
+		"{\"unknown\": {\"x\": [1, {\"in\": 2}]}, \"in\": {\"x\": -3, \"n\": \"abc\", \"y\": 1},"
+		" \"list\": [{\"x\": 1}, {\"n\": \"z\", \"x\": 2}], \"values\": [1, 2.5e1],"
+		" \"flag\": true, \"small\": 200, \"missing\": null, \"other\": null}";
+	outer o;
+	int ret;
+
+	o.flag = false;
+	o.small = 0;
+	o.missing = "kept";
+	ret = json::decode(text, (uint32_t) strlen(text), o);
+	check("bind decode", ret == 0 && o.in.x == -3 && o.in.name == "abc"
+	                     && o.list.size() == 2 && o.list[0].x == 1 && o.list[0].name.empty()
+	                     && o.list[1].x == 2 && o.list[1].name == "z"
+	                     && o.values.size() == 2 && o.values[1] == 25.0
+	                     && o.flag && o.small == 200 && o.missing == "kept");
+
+	std::string out;
+	json_printer printer;
+	json_print_init(&printer, append_output, &out);
+	ret = json::encode(&printer, o);
+	json_print_free(&printer);
+	outer back;
+	back.flag = false;
+	back.small = 0;
+	ret = ret || json::decode(out.data(), (uint32_t) out.size(), back);
+	check("bind encode", ret == 0 && back.in.x == -3 && back.in.name == "abc"
+	                     && back.list.size() == 2 && back.list[1].name == "z"
+	                     && back.values == o.values && back.flag && back.small == 200
+	                     && back.missing == "kept");
+
+	static const char *errors[] = {
+		"{\"small\": 256}",
+		"{\"small\": -1}",
+		"{\"in\": {\"x\": \"1\"}}",
+		"{\"list\": {}}",
+		"{\"flag\": 1}",
+	};
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+		outer e;
+		ok = ok && json::decode(errors[i], (uint32_t) strlen(errors[i]), e) == JSON_ERROR_BIND;
+	}
+	check("bind type errors", ok);
+
+	outer incomplete;
+	check("bind incomplete", json::decode(text, 20, incomplete) == JSON_ERROR_INCOMPLETE);
+}
+
+#ifdef JSON_HPP_COROUTINES
+
+/* a consumer writing the events of one value, with the same format as trace */
+static json::task<int> consume(json::stream &s, std::string &out)
+{
+	int depth = 0;
+
+	do {
+		json::event e = co_await s.next();
+		switch (e.type) {
+		case JSON_NONE:
+			co_return (e.error) ? e.error : -1;
+		case JSON_OBJECT_BEGIN: out += "{ "; depth++; break;
+		case JSON_ARRAY_BEGIN: out += "[ "; depth++; break;
+		case JSON_OBJECT_END: out += "} "; depth--; break;
+		case JSON_ARRAY_END: out += "] "; depth--; break;
+		case JSON_KEY:
+			out += std::to_string(e.key_id) + ":" + std::string(e.data, e.length) + " ";
+			break;
+		case JSON_STRING: out += "s:" + std::string(e.data, e.length) + " "; break;
+		case JSON_INT: out += "i:" + std::string(e.data, e.length) + " "; break;
+		case JSON_FLOAT: out += "f:" + std::string(e.data, e.length) + " "; break;
+		case JSON_TRUE: out += "t "; break;
+		case JSON_FALSE: out += "f "; break;
+		case JSON_NULL: out += "n "; break;
+		}
+	} while (depth > 0);
+	json::event last = co_await s.next();
+	co_return (last.type == JSON_NONE) ? last.error : -1;
+}
+
+/* a consumer skipping the value of "b" */
+static json::task<int> consume_skip(json::stream &s, std::string &out)
+{
+	json::event e = co_await s.next();
+
+	while (e.type != JSON_NONE) {
+		if (e.type == JSON_KEY) {
+			out.append(e.data, e.length);
+			json::event v = co_await s.next();
+			int ret = co_await json::skip(s, v);
+			if (ret)
+				co_return ret;
+		}
+		e = co_await s.next();
+	}
+	co_return e.error;
+}
+
+static void test_stream()
+{
+	static const char *keys[] = { "a", "e", NULL };
+	uint32_t length = (uint32_t) strlen(document), i;
+	json_config config;
+
+	memset(&config, 0, sizeof(config));
+	config.keys = keys;
+
+	/* one byte at a time: events cross each chunk boundary */
+	json::stream s(&config);
+	std::string out;
+	json::task<int> t = consume(s, out);
+	int ret = 0;
+	t.start();
+	for (i = 0; i < length && !ret; i++)
+		ret = s.feed(document + i, 1);
+	if (!ret)
+		ret = s.end();
+	check("stream chunks", ret == 0 && t.done() && t.result() == 0 && out == document_trace);
+
+	json::stream s2;
+	std::string members;
+	json::task<int> t2 = consume_skip(s2, members);
+	t2.start();
+	ret = s2.feed(document, length);
+	if (!ret)
+		ret = s2.end();
+	check("stream skip", ret == 0 && t2.done() && t2.result() == 0 && members == "abe");
+
+	json::stream s3;
+	std::string out3;
+	json::task<int> t3 = consume(s3, out3);
+	t3.start();
+	ret = s3.feed("[1, 2", 5);
+	check("stream incomplete", ret == 0 && s3.end() == JSON_ERROR_INCOMPLETE
+	                           && t3.done() && t3.result() == JSON_ERROR_INCOMPLETE);
+
+	json::stream s4;
+	std::string out4;
+	json::task<int> t4 = consume(s4, out4);
+	t4.start();
+	ret = s4.feed("[1, x]", 6);
+	check("stream error", ret == JSON_ERROR_UNEXPECTED_CHAR && t4.done()
+	                      && t4.result() == JSON_ERROR_UNEXPECTED_CHAR && out4 == "[ i:1 ");
+}
+
+#endif
+
+int main()
+{
+	test_handler();
+	test_bind();
+#ifdef JSON_HPP_COROUTINES
+	test_stream();
+#endif
+	return (failures) ? 1 : 0;
+}